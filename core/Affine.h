@@ -0,0 +1,152 @@
+﻿#pragma once
+//3x4仿射变换：左边3x3是线性部分（旋转、缩放、错切），最后一列是平移，相当于最后一行为(0,0,0,1)的4x4矩阵
+#include "Ray.h"
+#include <cmath>
+
+struct affine3 {
+    double m[3][4];
+
+    static affine3 identity() {
+        return translation(vec3(0, 0, 0));
+    }
+
+    static affine3 translation(const vec3& offset) {
+        affine3 a;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++)
+                a.m[i][j] = i == j ? 1 : 0;
+            a.m[i][3] = offset[i];
+        }
+        return a;
+    }
+
+    static affine3 scaling(const vec3& s) {
+        affine3 a = identity();
+        for (int i = 0; i < 3; i++)
+            a.m[i][i] = s[i];
+        return a;
+    }
+
+    /// <summary>
+    /// 绕过原点的轴旋转angle度（右手定则），用Rodrigues公式构造
+    /// </summary>
+    static affine3 rotation(const vec3& axis, double angle) {
+        const vec3 k = unit_vector(axis);
+        const double radians = degrees_to_radians(angle);
+        const double s = sin(radians), c = cos(radians), v = 1 - c;
+        affine3 a = identity();
+        a.m[0][0] = c + k.x() * k.x() * v;
+        a.m[0][1] = k.x() * k.y() * v - k.z() * s;
+        a.m[0][2] = k.x() * k.z() * v + k.y() * s;
+        a.m[1][0] = k.y() * k.x() * v + k.z() * s;
+        a.m[1][1] = c + k.y() * k.y() * v;
+        a.m[1][2] = k.y() * k.z() * v - k.x() * s;
+        a.m[2][0] = k.z() * k.x() * v - k.y() * s;
+        a.m[2][1] = k.z() * k.y() * v + k.x() * s;
+        a.m[2][2] = c + k.z() * k.z() * v;
+        return a;
+    }
+
+    //与rotate_y相同的旋转
+    static affine3 rotation_y(double angle) {
+        const double radians = degrees_to_radians(angle);
+        affine3 a = identity();
+        a.m[0][0] = cos(radians);
+        a.m[0][2] = sin(radians);
+        a.m[2][0] = -sin(radians);
+        a.m[2][2] = cos(radians);
+        return a;
+    }
+
+    vec3 point(const vec3& p) const {
+        return vec3(
+            m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+            m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+            m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]);
+    }
+
+    vec3 vector(const vec3& v) const {
+        return vec3(
+            m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+            m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+            m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z());
+    }
+
+    /// <summary>
+    /// 用线性部分的转置乘向量。对逆变换调用时就是法线的变换（逆矩阵的转置），结果没有归一化
+    /// </summary>
+    vec3 transpose_vector(const vec3& n) const {
+        return vec3(
+            m[0][0] * n.x() + m[1][0] * n.y() + m[2][0] * n.z(),
+            m[0][1] * n.x() + m[1][1] * n.y() + m[2][1] * n.z(),
+            m[0][2] * n.x() + m[1][2] * n.y() + m[2][2] * n.z());
+    }
+
+    ray apply(const ray& r) const {
+        return ray(point(r.origin()), vector(r.direction()), r.time());
+    }
+
+    /// <summary>
+    /// 变换后的包围盒：每个轴分别取线性部分各项与原盒子两端乘积的较小和较大值(Arvo的方法)
+    /// </summary>
+    aabb apply(const aabb& box) const {
+        vec3 lo, hi;
+        for (int i = 0; i < 3; i++) {
+            lo[i] = hi[i] = m[i][3];
+            for (int j = 0; j < 3; j++) {
+                double a = m[i][j] * box.min()[j];
+                double b = m[i][j] * box.max()[j];
+                lo[i] += ffmin(a, b);
+                hi[i] += ffmax(a, b);
+            }
+        }
+        return aabb(lo, hi);
+    }
+
+    double determinant() const {
+        return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+            - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+            + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    }
+
+    affine3 inverse() const;
+};
+
+/// <summary>
+/// 复合变换：先做b再做a
+/// </summary>
+inline affine3 operator*(const affine3& a, const affine3& b) {
+    affine3 c;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            c.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j];
+        }
+        c.m[i][3] += a.m[i][3];
+    }
+    return c;
+}
+
+/// <summary>
+/// 线性部分用伴随矩阵求逆，平移部分为 -A^-1 t；矩阵不可逆时输出错误并返回单位变换
+/// </summary>
+inline affine3 affine3::inverse() const {
+    const double det = determinant();
+    if (det == 0) {
+        std::cerr << "affine3: singular transform.\n";
+        return identity();
+    }
+    const double inv_det = 1.0 / det;
+    affine3 r;
+    r.m[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * inv_det;
+    r.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+    r.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+    r.m[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * inv_det;
+    r.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+    r.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+    r.m[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * inv_det;
+    r.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+    r.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+    for (int i = 0; i < 3; i++)
+        r.m[i][3] = -(r.m[i][0] * m[0][3] + r.m[i][1] * m[1][3] + r.m[i][2] * m[2][3]);
+    return r;
+}
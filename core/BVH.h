@@ -2,21 +2,32 @@
 #include "HittableList.h"
 #include "Ray.h"
 #include <algorithm>
+#include <vector>
 
+//BVH的构建方式：random_median为原来的随机选轴、中位数划分；sah按表面积启发式(SAH)选择划分轴和位置
+enum class bvh_build { random_median, sah };
+
+//构建时使用的图元信息，包围盒和中心只计算一次
+struct bvh_build_item {
+    shared_ptr<hittable> object;
+    aabb box;
+    vec3 centroid;
+};
 
 class bvh_node : public hittable {
 public:
     bvh_node();
 
-    bvh_node(hittableList& list, double time0, double time1)
-        : bvh_node(list.objects, 0, list.objects.size(), time0, time1)
-    {}
+    bvh_node(hittableList& list, double time0, double time1, bvh_build mode = bvh_build::sah);
 
     bvh_node(
         std::vector<std::shared_ptr<hittable>>& objects,
         size_t start, size_t end, double time0, double time1);
 
+    bvh_node(std::vector<bvh_build_item>& items, size_t start, size_t end, int level = 1);
+
     virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const;
+    virtual bool intersect(const ray& r, double tmin, double tmax, hit_record& rec) const;
     virtual bool bounding_box(double t0, double t1, aabb& output_box) const;
 
 public:
@@ -48,6 +59,23 @@ inline bool box_z_compare(const shared_ptr<hittable> a, const shared_ptr<hittabl
     return box_compare(a, b, 2);
 }
 
+bvh_node::bvh_node(hittableList& list, double time0, double time1, bvh_build mode) {
+    if (mode == bvh_build::random_median) {
+        *this = bvh_node(list.objects, 0, list.objects.size(), time0, time1);
+        return;
+    }
+
+    std::vector<bvh_build_item> items;
+    items.reserve(list.objects.size());
+    for (const auto& object : list.objects) {
+        aabb object_box;
+        if (!object->bounding_box(time0, time1, object_box))
+            std::cerr << "No bounding box in bvh_node constructor.\n";
+        items.push_back({ object, object_box, object_box.centroid() });
+    }
+    *this = bvh_node(items, 0, items.size());
+}
+
 bvh_node::bvh_node(std::vector<std::shared_ptr<hittable>>& objects,size_t start, size_t end, double time0, double time1) {
     //随机选择一个轴作为划分节点的依据
     int axis = random_int(0, 2);
@@ -89,13 +117,164 @@ bvh_node::bvh_node(std::vector<std::shared_ptr<hittable>>& objects,size_t start,
 }
 
 
+const int sah_bin_count = 16;
+//图元数量不超过这个值时直接按最长轴的中位数划分，分箱带来的收益已经很小
+const size_t sah_min_primitives = 4;
+
+//压平后的BVH用固定大小的栈遍历，树的深度(根节点为第1层)不能超过这个值
+const int bvh_max_depth = 64;
+//留给叶子附近按类型再分开的几层，见primitive_bvh
+const int bvh_depth_reserve = 8;
+
+/// <summary>
+/// 从第level层开始对count个图元一直做中位数划分，最深的节点在第几层
+/// </summary>
+inline int bvh_median_depth(size_t count, int level) {
+    for (; count > 1; count = (count + 1) / 2)
+        level++;
+    return level;
+}
+
+/// <summary>
+/// SAH在图元分布很不均匀时(比如位置按指数增长)每层可能只分出一个图元，树的深度与图元数量成正比。
+/// 剩下的层数只够中位数划分的平衡树时不再用SAH，保证整棵树不超过bvh_max_depth - bvh_depth_reserve层
+/// </summary>
+inline bool bvh_sah_allowed(size_t count, int level) {
+    return bvh_median_depth(count, level + 1) <= bvh_max_depth - bvh_depth_reserve;
+}
+
+/// <summary>
+/// 在[start,end)范围内按中心坐标最长的轴做中位数划分，返回划分位置
+/// </summary>
+template <typename Item>
+size_t bvh_median_split(std::vector<Item>& items, size_t start, size_t end, const aabb& centroid_box) {
+    auto extent = centroid_box.max() - centroid_box.min();
+    int axis = extent.x() > extent.y() ? (extent.x() > extent.z() ? 0 : 2) : (extent.y() > extent.z() ? 1 : 2);
+    size_t mid = start + (end - start) / 2;
+    std::nth_element(items.begin() + start, items.begin() + mid, items.begin() + end,
+        [axis](const Item& a, const Item& b) { return a.centroid[axis] < b.centroid[axis]; });
+    return mid;
+}
+
+/// <summary>
+/// 分箱SAH：把每个轴上图元中心的范围分成若干个箱子，在箱子边界中找代价 A_l*N_l + A_r*N_r 最小的划分平面，
+/// 然后按该平面把图元原地分成两组。每层只需要线性时间，整体构建为 O(n log n)
+/// Item 需要提供 box 和 centroid 成员，三角网格等其他图元也可以复用
+/// </summary>
+/// <param name="level">被划分的节点在第几层，用来限制树的深度</param>
+/// <returns>划分位置mid，[start,mid)和[mid,end)分别属于左右子树</returns>
+template <typename Item>
+size_t bvh_sah_split(std::vector<Item>& items, size_t start, size_t end, int level) {
+    aabb centroid_box(items[start].centroid, items[start].centroid);
+    for (size_t i = start + 1; i < end; i++)
+        centroid_box = surrounding_box(centroid_box, aabb(items[i].centroid, items[i].centroid));
+
+    if (end - start <= sah_min_primitives || !bvh_sah_allowed(end - start, level))
+        return bvh_median_split(items, start, end, centroid_box);
+
+    struct bin {
+        aabb box;
+        size_t count = 0;
+    };
+
+    double best_cost = infinity;
+    int best_axis = -1;
+    int best_split = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        double lo = centroid_box.min()[axis];
+        double extent = centroid_box.max()[axis] - lo;
+        if (extent <= 0)
+            continue;
+
+        bin bins[sah_bin_count];
+        double scale = sah_bin_count / extent;
+        for (size_t i = start; i < end; i++) {
+            int b = std::min(sah_bin_count - 1, static_cast<int>((items[i].centroid[axis] - lo) * scale));
+            bins[b].box = bins[b].count == 0 ? items[i].box : surrounding_box(bins[b].box, items[i].box);
+            bins[b].count++;
+        }
+
+        //从右往左扫描一遍得到每个划分平面右侧的面积和数量，再从左往右扫描计算代价
+        double right_area[sah_bin_count];
+        size_t right_count[sah_bin_count];
+        aabb accum;
+        size_t count = 0;
+        for (int b = sah_bin_count - 1; b > 0; b--) {
+            if (bins[b].count > 0) {
+                accum = count == 0 ? bins[b].box : surrounding_box(accum, bins[b].box);
+                count += bins[b].count;
+            }
+            right_area[b] = count > 0 ? accum.area() : 0;
+            right_count[b] = count;
+        }
+        count = 0;
+        for (int b = 0; b < sah_bin_count - 1; b++) {
+            if (bins[b].count > 0) {
+                accum = count == 0 ? bins[b].box : surrounding_box(accum, bins[b].box);
+                count += bins[b].count;
+            }
+            if (count == 0 || right_count[b + 1] == 0)
+                continue;
+            double cost = count * accum.area() + right_count[b + 1] * right_area[b + 1];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = b;
+            }
+        }
+    }
+
+    //所有图元的中心重合，没有可用的划分平面
+    if (best_axis < 0)
+        return bvh_median_split(items, start, end, centroid_box);
+
+    double lo = centroid_box.min()[best_axis];
+    double scale = sah_bin_count / (centroid_box.max()[best_axis] - lo);
+    auto middle = std::partition(items.begin() + start, items.begin() + end, [&](const Item& item) {
+        int b = std::min(sah_bin_count - 1, static_cast<int>((item.centroid[best_axis] - lo) * scale));
+        return b <= best_split;
+    });
+    size_t mid = middle - items.begin();
+    if (mid == start || mid == end)
+        return bvh_median_split(items, start, end, centroid_box);
+    return mid;
+}
+
+bvh_node::bvh_node(std::vector<bvh_build_item>& items, size_t start, size_t end, int level) {
+    size_t object_span = end - start;
+    if (object_span == 1) {
+        left = right = items[start].object;
+        box = items[start].box;
+        return;
+    }
+    if (object_span == 2) {
+        left = items[start].object;
+        right = items[start + 1].object;
+        box = surrounding_box(items[start].box, items[start + 1].box);
+        return;
+    }
+
+    size_t mid = bvh_sah_split(items, start, end, level);
+    auto left_node = make_shared<bvh_node>(items, start, mid, level + 1);
+    auto right_node = make_shared<bvh_node>(items, mid, end, level + 1);
+    box = surrounding_box(left_node->box, right_node->box);
+    left = left_node;
+    right = right_node;
+}
 
 bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    if (!intersect(r, t_min, t_max, rec))
+        return false;
+    finalize_hit(r, rec);
+    return true;
+}
+
+bool bvh_node::intersect(const ray& r, double t_min, double t_max, hit_record& rec) const {
     if (!box.hit(r, t_min, t_max))
         return false;
 
-    bool hit_left = left->hit(r, t_min, t_max, rec);
-    bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
+    bool hit_left = left->intersect(r, t_min, t_max, rec);
+    bool hit_right = right->intersect(r, t_min, hit_left ? rec.t : t_max, rec);
 
     return hit_left || hit_right;
 }
@@ -103,4 +282,57 @@ bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) co
 bool bvh_node::bounding_box(double t0, double t1, aabb& output_box) const {
     output_box = box;
     return true;
+}
+
+//BVH的质量指标
+struct bvh_stats {
+    double sah_cost = 0;  //以根节点面积归一化的期望遍历代价，遍历和求交代价都按1计
+    int max_depth = 0;
+    int node_count = 0;
+    int leaf_count = 0;
+    int primitive_count = 0;
+    int min_leaf_size = 0;
+    int max_leaf_size = 0;
+
+    double average_leaf_size() const {
+        return leaf_count > 0 ? double(primitive_count) / leaf_count : 0;
+    }
+};
+
+void collect_bvh_stats(const bvh_node& node, int depth, double root_area, bvh_stats& stats) {
+    stats.node_count++;
+    stats.max_depth = std::max(stats.max_depth, depth);
+    double probability = root_area > 0 ? node.box.area() / root_area : 1;
+
+    auto left = dynamic_cast<const bvh_node*>(node.left.get());
+    auto right = dynamic_cast<const bvh_node*>(node.right.get());
+    if (left && right) {
+        stats.sah_cost += probability;
+        collect_bvh_stats(*left, depth + 1, root_area, stats);
+        collect_bvh_stats(*right, depth + 1, root_area, stats);
+        return;
+    }
+
+    //叶子节点：子节点是实际的图元，只有一个图元时左右指向同一个物体
+    int size = node.left == node.right ? 1 : 2;
+    stats.sah_cost += probability * size;
+    stats.leaf_count++;
+    stats.primitive_count += size;
+    stats.min_leaf_size = stats.leaf_count == 1 ? size : std::min(stats.min_leaf_size, size);
+    stats.max_leaf_size = std::max(stats.max_leaf_size, size);
+}
+
+bvh_stats compute_bvh_stats(const bvh_node& root) {
+    bvh_stats stats;
+    collect_bvh_stats(root, 1, root.box.area(), stats);
+    return stats;
+}
+
+std::ostream& operator<<(std::ostream& out, const bvh_stats& stats) {
+    return out << "SAH cost " << stats.sah_cost
+        << ", depth " << stats.max_depth
+        << ", nodes " << stats.node_count
+        << ", leaves " << stats.leaf_count
+        << ", leaf size " << stats.min_leaf_size << "-" << stats.max_leaf_size
+        << " (avg " << stats.average_leaf_size() << ")";
 }
\ No newline at end of file
@@ -0,0 +1,1019 @@
+﻿#pragma once
+//性能测试：各个子系统的微基准，结果输出到标准错误
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "utils.h"
+#include "ThreadPool.h"
+#include "BVH.h"
+#include "LinearBVH.h"
+#include "Packet.h"
+#include "Lights.h"
+#include "Progressive.h"
+#include "Sphere.h"
+#include "box.h"
+#include "Material.h"
+#include "MeshLoader.h"
+#include "Instance.h"
+#include "CompiledScene.h"
+#include "Vec3a.h"
+
+class bench_timer {
+public:
+    bench_timer() : start(std::chrono::steady_clock::now()) {}
+
+    double seconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point start;
+};
+
+//防止编译器把只为计时而计算的结果优化掉
+static volatile double bench_sink;
+
+//基准测试顺带做的正确性检查失败的次数，不为0时--bench以错误码退出
+int bench_failures = 0;
+
+/// <summary>
+/// 正确性检查：失败时输出FAILED并计数，不让错误的结果混在性能数字里被忽略
+/// </summary>
+void bench_expect(bool ok, const std::string& what) {
+    if (!ok) {
+        bench_failures++;
+        std::cerr << "  FAILED: " << what << "\n";
+    }
+}
+
+//两种求交做法的距离允许的相对误差：单精度构建中顶点和光线是float，中间结果的舍入次序不同，最后几位会不一样；
+//光线擦过球面时二次方程有相消误差，float下相对误差约为sqrt(float的机器精度)
+const double bench_t_tolerance = sizeof(real) == sizeof(float) ? 5e-4 : 1e-9;
+
+/// <summary>
+/// 同一个距离、同一种材质：距离按相对误差比较，重合的面上两种做法可能选中不同的面，最后几位会不一样。
+/// float下相切的两个球在这个误差内分不出先后，可能选中不同的球，只比较距离；材质的对应关系由double构建检查
+/// </summary>
+inline bool bench_same_hit(const hit_record& a, const hit_record& b) {
+    return fabs(a.t - b.t) <= bench_t_tolerance * a.t && (a.mat_ptr == b.mat_ptr || sizeof(real) == sizeof(float));
+}
+
+/// <summary>
+/// 两种求交做法在同一批光线上的结果是否一致，输出不一致的数量，有不一致时记为失败
+/// </summary>
+/// <param name="same">两个交点是否一致，形如 bool(const hit_record&amp;, const hit_record&amp;)</param>
+template <typename Same>
+void bench_compare_hits(const std::string& what, const hittable& expected, const hittable& actual,
+    const std::vector<ray>& rays, Same same) {
+    int mismatches = 0;
+    for (const auto& r : rays) {
+        hit_record a, b;
+        bool hit_a = expected.hit(r, 0.001, infinity, a);
+        bool hit_b = actual.hit(r, 0.001, infinity, b);
+        if (hit_a != hit_b || (hit_a && !same(a, b)))
+            mismatches++;
+    }
+    std::cerr << "  " << what << ": " << mismatches << " of " << rays.size() << " hits differ\n";
+    bench_expect(mismatches == 0, what + " hits differ");
+}
+
+void print_bench(const std::string& name, double count, double seconds, const char* unit) {
+    char line[160];
+    snprintf(line, sizeof(line), "  %-36s %10.2f M%s/s  (%.3fs)", name.c_str(), count / seconds / 1e6, unit, seconds);
+    std::cerr << line << '\n';
+}
+
+/// <summary>
+/// 在线程池的每个线程上执行同一个函数，返回墙钟时间
+/// </summary>
+template <typename Body>
+double bench_parallel(thread_pool& pool, Body body) {
+    std::vector<thread_pool::task> tasks;
+    for (int t = 0; t < pool.size(); t++)
+        tasks.push_back([&](int) { body(); });
+    pool.run(tasks);
+    return pool.wall_seconds;
+}
+
+/// <summary>
+/// 比较原来的 rand() 和线程私有采样器生成 [0,1) 随机数的速度，分别测单线程和多线程
+/// </summary>
+void bench_random(int threads = 0) {
+    const int n = 1 << 24;
+    std::cerr << "random_double benchmark (" << n << " samples per thread)\n";
+
+    {
+        bench_timer timer;
+        double sum = 0;
+        for (int i = 0; i < n; i++)
+            sum += rand() / (RAND_MAX + 1.0);
+        bench_sink = sum;
+        print_bench("rand(), 1 thread", n, timer.seconds(), "samples");
+    }
+    {
+        bench_timer timer;
+        double sum = 0;
+        for (int i = 0; i < n; i++)
+            sum += random_double();
+        bench_sink = sum;
+        print_bench("sampler, 1 thread", n, timer.seconds(), "samples");
+    }
+
+    thread_pool pool(threads);
+    double seconds = bench_parallel(pool, [&] {
+        double sum = 0;
+        for (int i = 0; i < n; i++)
+            sum += rand() / (RAND_MAX + 1.0);
+        bench_sink = sum;
+    });
+    print_bench("rand(), " + std::to_string(pool.size()) + " threads", double(n) * pool.size(), seconds, "samples");
+
+    seconds = bench_parallel(pool, [&] {
+        double sum = 0;
+        for (int i = 0; i < n; i++)
+            sum += random_double();
+        bench_sink = sum;
+    });
+    print_bench("sampler, " + std::to_string(pool.size()) + " threads", double(n) * pool.size(), seconds, "samples");
+
+    //渲染时每个采样都要重新定位随机序列，这里单独测一下定位的开销
+    bench_timer timer;
+    double sum = 0;
+    for (int i = 0; i < n; i++) {
+        seed_sampler(1, i, i);
+        sum += random_double();
+    }
+    bench_sink = sum;
+    print_bench("seed_sampler + 1 sample, 1 thread", n, timer.seconds(), "samples");
+}
+
+/// <summary>
+/// 生成一组朝向场景包围盒内随机点的光线，所有BVH测试使用同一组光线
+/// </summary>
+std::vector<ray> bench_rays(const hittable& world, int count) {
+    aabb bounds;
+    world.bounding_box(0, 1, bounds);
+    auto center = bounds.centroid();
+    auto radius = (bounds.max() - bounds.min()).length();
+    std::vector<ray> rays;
+    rays.reserve(count);
+    for (int i = 0; i < count; i++) {
+        auto origin = center + radius * random_unit_vector();
+        vec3 target(random_double(bounds.min().x(), bounds.max().x()),
+            random_double(bounds.min().y(), bounds.max().y()),
+            random_double(bounds.min().z(), bounds.max().z()));
+        rays.push_back(ray(origin, target - origin, random_double()));
+    }
+    return rays;
+}
+
+/// <summary>
+/// 对每条光线求最近交点，返回耗时（秒）
+/// </summary>
+double bench_trace(const hittable& world, const std::vector<ray>& rays) {
+    bench_timer timer;
+    int hits = 0;
+    for (const auto& r : rays) {
+        hit_record rec;
+        if (world.hit(r, 0.001, infinity, rec))
+            hits++;
+    }
+    bench_sink = hits;
+    return timer.seconds();
+}
+
+/// <summary>
+/// final_scene()中的两组物体：1000个小球组成的球团和400个盒子组成的地面
+/// </summary>
+hittableList bench_sphere_cluster(int count) {
+    hittableList objects;
+    auto white = make_shared<lambertian_vec>(vec3(0.73, 0.73, 0.73));
+    for (int j = 0; j < count; j++)
+        objects.add(make_shared<sphere>(vec3::random(0, 165), 10, white));
+    return objects;
+}
+
+hittableList bench_box_ground() {
+    hittableList boxes;
+    auto ground = make_shared<lambertian_vec>(vec3(0.48, 0.83, 0.53));
+    const int boxes_per_side = 20;
+    for (int i = 0; i < boxes_per_side; i++) {
+        for (int j = 0; j < boxes_per_side; j++) {
+            auto w = 100.0;
+            auto x0 = -1000.0 + i * w;
+            auto z0 = -1000.0 + j * w;
+            boxes.add(make_shared<box>(vec3(x0, 0, z0), vec3(x0 + w, random_double(1, 101), z0 + w), ground));
+        }
+    }
+    return boxes;
+}
+
+/// <summary>
+/// 命中记录中材质句柄的开销：原来的shared_ptr<material>每次赋值都要原子地增减引用计数，
+/// 多个线程共享少数几个材质时，引用计数所在的缓存行会在核之间来回传递；现在的裸指针只是一次普通的写。
+/// 最后在所有线程上同时追踪同一组光线，看整体的求交速度
+/// </summary>
+void bench_material_handles(int threads = 0) {
+    //与原来的hit_record布局相同，只用来对比
+    struct shared_handle_record {
+        vec3 p;
+        vec3 normal;
+        shared_ptr<material> mat_ptr;
+        double t;
+        double u;
+        double v;
+        bool front_face;
+    };
+    std::vector<shared_ptr<material>> materials = {
+        make_shared<lambertian_vec>(vec3(0.73, 0.73, 0.73)), make_shared<lambertian_vec>(vec3(0.65, 0.05, 0.05)),
+        make_shared<metal>(vec3(0.8, 0.8, 0.8), 0.0), make_shared<dielectric>(1.5) };
+    const int n = 1 << 24;
+    std::cerr << "Material handle benchmark (" << n << " hit records per thread)\n";
+
+    //每次模拟一次图元求交写入材质，再模拟旧的hittableList::hit把临时记录复制到结果中
+    auto shared_records = [&] {
+        shared_handle_record temp, rec;
+        double sum = 0;
+        for (int i = 0; i < n; i++) {
+            temp.mat_ptr = materials[i & 3];
+            temp.t = i;
+            rec = temp;
+            sum += rec.t;
+        }
+        bench_sink = sum;
+    };
+    auto raw_records = [&] {
+        hit_record temp, rec;
+        double sum = 0;
+        for (int i = 0; i < n; i++) {
+            temp.mat_ptr = materials[i & 3].get();
+            temp.t = i;
+            rec = temp;
+            sum += rec.t;
+        }
+        bench_sink = sum;
+    };
+
+    bench_timer timer;
+    shared_records();
+    print_bench("shared_ptr<material>, 1 thread", n, timer.seconds(), "records");
+    timer = bench_timer();
+    raw_records();
+    print_bench("const material*, 1 thread", n, timer.seconds(), "records");
+
+    thread_pool pool(threads);
+    const std::string suffix = ", " + std::to_string(pool.size()) + " threads";
+    print_bench("shared_ptr<material>" + suffix, double(n) * pool.size(), bench_parallel(pool, shared_records), "records");
+    print_bench("const material*" + suffix, double(n) * pool.size(), bench_parallel(pool, raw_records), "records");
+
+    seed_sampler(2023, 0, 0);
+    auto list = bench_sphere_cluster(1000);
+    qbvh tree(make_shared<bvh_node>(list, 0, 1));
+    auto rays = bench_rays(tree, 200000);
+    double seconds = bench_parallel(pool, [&] { bench_trace(tree, rays); });
+    print_bench("trace sphere cluster" + suffix, double(rays.size()) * pool.size(), seconds, "rays");
+}
+
+/// <summary>
+/// 两阶段求交的效果：每个候选图元都立即计算完整交点信息（原来的做法），
+/// 与遍历时只求t、最后只对最近的交点计算交点信息的对比。不用BVH时落选的候选最多，差别最明显
+/// </summary>
+void bench_deferred_hits() {
+    seed_sampler(2023, 0, 0);
+    auto list = bench_sphere_cluster(1000);
+    auto rays = bench_rays(list, 20000);
+    std::cerr << "Deferred hit benchmark, sphere cluster (1000)\n";
+
+    bench_timer timer;
+    int hits = 0;
+    for (const auto& r : rays) {
+        hit_record rec;
+        double closest_so_far = infinity;
+        bool hit_anything = false;
+        for (const auto& object : list.objects) {
+            if (object->hit(r, 0.001, closest_so_far, rec)) {
+                hit_anything = true;
+                closest_so_far = rec.t;
+            }
+        }
+        hits += hit_anything;
+    }
+    bench_sink = hits;
+    print_bench("list, eager hit", rays.size(), timer.seconds(), "rays");
+    print_bench("list, intersect + finalize", rays.size(), bench_trace(list, rays), "rays");
+}
+
+/// <summary>
+/// 比较随机轴中位数划分和分箱SAH两种BVH：构建时间、树的质量和求交速度
+/// </summary>
+void bench_bvh() {
+    seed_sampler(2023, 0, 0);
+    struct bench_scene {
+        std::string name;
+        hittableList objects;
+    };
+    std::vector<bench_scene> scenes = {
+        { "sphere cluster (1000)", bench_sphere_cluster(1000) },
+        { "box ground (400)", bench_box_ground() },
+    };
+
+    std::cerr << "BVH benchmark\n";
+    for (auto& scene : scenes) {
+        auto rays = bench_rays(scene.objects, 200000);
+        for (auto mode : { bvh_build::random_median, bvh_build::sah }) {
+            const char* name = mode == bvh_build::sah ? "sah" : "random median";
+            auto list = scene.objects;
+            bench_timer timer;
+            bvh_node tree(list, 0, 1, mode);
+            double build = timer.seconds();
+            std::cerr << "  " << scene.name << ", " << name << ": " << compute_bvh_stats(tree)
+                << ", build " << build * 1000 << "ms\n";
+            print_bench("    trace", rays.size(), bench_trace(tree, rays), "rays");
+        }
+        auto list = scene.objects;
+        auto tree = make_shared<bvh_node>(list, 0, 1);
+        print_bench("    trace sah, linear_bvh", rays.size(), bench_trace(linear_bvh(tree), rays), "rays");
+        print_bench("    trace sah, 4-wide", rays.size(), bench_trace(qbvh(tree), rays), "rays");
+        print_bench("    trace sah, 8-wide", rays.size(), bench_trace(obvh(tree), rays), "rays");
+    }
+
+    //构建时间随图元数量的变化，应接近 n log n
+    for (int count : { 10000, 100000, 1000000 }) {
+        auto list = bench_sphere_cluster(count);
+        bench_timer timer;
+        bvh_node tree(list, 0, 1, bvh_build::sah);
+        double build = timer.seconds();
+        std::cerr << "  sah build " << count << " spheres: " << build * 1000 << "ms, "
+            << build * 1e9 / (count * std::log2(double(count))) << "ns per n log n\n";
+    }
+}
+
+/// <summary>
+/// 经纬度细分的单位球面网格，两极各用一个顶点，网格是封闭的
+/// </summary>
+void bench_sphere_mesh(int rings, int segments, std::vector<vec3>& positions, std::vector<mesh_face>& faces) {
+    positions.clear();
+    faces.clear();
+    positions.push_back(vec3(0, 1, 0));
+    for (int i = 1; i < rings; i++) {
+        double theta = pi * i / rings;
+        for (int j = 0; j < segments; j++) {
+            double phi = 2 * pi * j / segments;
+            positions.push_back(vec3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi)));
+        }
+    }
+    positions.push_back(vec3(0, -1, 0));
+
+    const uint32_t south = static_cast<uint32_t>(positions.size() - 1);
+    auto ring_vertex = [&](int i, int j) { return static_cast<uint32_t>(1 + (i - 1) * segments + j % segments); };
+    auto add = [&](uint32_t a, uint32_t b, uint32_t c) { faces.push_back({ { a, b, c }, { -1, -1, -1 }, { -1, -1, -1 } }); };
+    for (int j = 0; j < segments; j++) {
+        add(0, ring_vertex(1, j + 1), ring_vertex(1, j));
+        for (int i = 1; i < rings - 1; i++) {
+            add(ring_vertex(i, j), ring_vertex(i, j + 1), ring_vertex(i + 1, j + 1));
+            add(ring_vertex(i, j), ring_vertex(i + 1, j + 1), ring_vertex(i + 1, j));
+        }
+        add(south, ring_vertex(rings - 1, j), ring_vertex(rings - 1, j + 1));
+    }
+}
+
+/// <summary>
+/// 三角网格：约100万个三角形的球面写成OBJ和二进制PLY后读回，测读取、BVH构建和求交速度；
+/// 再从封闭网格内部向各个方向（包括正对顶点和边的方向）发射光线，统计从缝隙漏出去的数量
+/// </summary>
+void bench_mesh() {
+    std::vector<vec3> positions;
+    std::vector<mesh_face> faces;
+    bench_sphere_mesh(708, 708, positions, faces);
+    auto white = make_shared<lambertian_vec>(vec3(0.73, 0.73, 0.73));
+    std::cerr << "Mesh benchmark, sphere (" << faces.size() << " triangles)\n";
+
+    const std::string obj_name = "bench_mesh.obj", ply_name = "bench_mesh.ply";
+    {
+        FILE* obj = fopen(obj_name.c_str(), "w");
+        for (const auto& p : positions)
+            fprintf(obj, "v %.9g %.9g %.9g\n", p.x(), p.y(), p.z());
+        for (const auto& f : faces)
+            fprintf(obj, "f %u %u %u\n", f.v[0] + 1, f.v[1] + 1, f.v[2] + 1);
+        fclose(obj);
+
+        FILE* ply = fopen(ply_name.c_str(), "wb");
+        fprintf(ply, "ply\nformat binary_little_endian 1.0\nelement vertex %zu\n"
+            "property float x\nproperty float y\nproperty float z\nelement face %zu\n"
+            "property list uchar int vertex_indices\nend_header\n", positions.size(), faces.size());
+        for (const auto& p : positions) {
+            float xyz[3] = { float(p.x()), float(p.y()), float(p.z()) };
+            fwrite(xyz, sizeof(float), 3, ply);
+        }
+        for (const auto& f : faces) {
+            unsigned char count = 3;
+            int32_t v[3] = { int32_t(f.v[0]), int32_t(f.v[1]), int32_t(f.v[2]) };
+            fwrite(&count, 1, 1, ply);
+            fwrite(v, sizeof(int32_t), 3, ply);
+        }
+        fclose(ply);
+    }
+
+    bench_timer obj_timer;
+    auto from_obj = load_mesh(obj_name, white);
+    double obj_seconds = obj_timer.seconds();
+    bench_timer ply_timer;
+    auto from_ply = load_mesh(ply_name, white);
+    double ply_seconds = ply_timer.seconds();
+    remove(obj_name.c_str());
+    remove(ply_name.c_str());
+    if (!from_obj || !from_ply)
+        return;
+    print_bench("load obj (including bvh)", double(from_obj->triangle_count()), obj_seconds, "tris");
+    print_bench("load binary ply (including bvh)", double(from_ply->triangle_count()), ply_seconds, "tris");
+
+    bench_timer build_timer;
+    triangle_mesh mesh(positions, {}, {}, faces, white);
+    double build = build_timer.seconds();
+    std::cerr << "  bvh: " << mesh.bvh.nodes.size() << " nodes, depth " << mesh.bvh.depth << ", build " << build * 1000
+        << "ms, " << sizeof(mesh_face) * mesh.faces.size() / (1 << 20) << "MB faces\n";
+
+    seed_sampler(2023, 0, 0);
+    auto rays = bench_rays(mesh, 200000);
+    print_bench("trace", rays.size(), bench_trace(mesh, rays), "rays");
+
+    //封闭网格的内部任何方向的光线都必须击中网格，正对顶点和边的光线最容易从缝隙漏过去
+    std::vector<ray> inside;
+    const vec3 center(0, 0, 0);
+    for (size_t i = 0; i < positions.size(); i++)
+        inside.push_back(ray(center, positions[i] - center));
+    for (const auto& f : faces)
+        inside.push_back(ray(center, 0.5 * (positions[f.v[0]] + positions[f.v[1]]) - center));
+    for (int i = 0; i < 200000; i++)
+        inside.push_back(ray(vec3::random(-0.5, 0.5), random_unit_vector()));
+    int leaks = 0;
+    for (const auto& r : inside) {
+        hit_record rec;
+        if (!mesh.hit(r, 0.001, infinity, rec))
+            leaks++;
+    }
+    std::cerr << "  watertight: " << leaks << " of " << inside.size() << " rays from inside escaped\n";
+    bench_expect(leaks == 0, "watertight mesh leaks rays");
+}
+
+/// <summary>
+/// 实例化：同一个约2万个三角形的网格摆放成100到10万个随机旋转缩放的实例，组成顶层BVH，
+/// 看构建时间、内存和求交速度随实例数量的变化；再与原来平移旋转包装链放在列表中的做法比较
+/// </summary>
+void bench_instancing() {
+    std::vector<vec3> positions;
+    std::vector<mesh_face> faces;
+    bench_sphere_mesh(100, 100, positions, faces);
+    auto white = make_shared<lambertian_vec>(vec3(0.73, 0.73, 0.73));
+    auto mesh = make_shared<triangle_mesh>(positions, std::vector<vec3>(), std::vector<vec3>(), faces, white);
+    const double mesh_bytes = double(sizeof(vec3) * mesh->positions.size() + sizeof(mesh_face) * mesh->faces.size()
+        + sizeof(linear_bvh_node) * mesh->bvh.nodes.size());
+    std::cerr << "Instancing benchmark, mesh (" << mesh->triangle_count() << " triangles, "
+        << mesh_bytes / (1 << 20) << "MB)\n";
+
+    seed_sampler(2023, 0, 0);
+    for (int count : { 100, 1000, 10000, 100000 }) {
+        //实例的密度保持不变，场景随数量变大
+        const double extent = 4 * std::cbrt(double(count));
+        hittableList instances;
+        for (int i = 0; i < count; i++) {
+            auto placement = affine3::translation(vec3::random(0, extent))
+                * affine3::rotation(random_unit_vector(), random_double(0, 360))
+                * affine3::scaling(vec3(1, 1, 1) * random_double(0.5, 1.5));
+            instances.add(make_shared<instance>(mesh, placement));
+        }
+        bench_timer timer;
+        auto tlas = flatten_bvh(make_shared<bvh_node>(instances, 0, 1));
+        double build = timer.seconds();
+        auto top = std::dynamic_pointer_cast<qbvh>(tlas);
+        const double instance_bytes = double(count) * sizeof(instance) + (top ? top->nodes.size() * sizeof(top->nodes[0]) : 0);
+        std::cerr << "  " << count << " instances: tlas build " << build * 1000 << "ms, "
+            << instance_bytes / (1 << 20) << "MB instances + tlas (" << mesh_bytes * count / (1 << 30)
+            << "GB if copied)\n";
+        auto rays = bench_rays(*tlas, 50000);
+        print_bench("    trace tlas", rays.size(), bench_trace(*tlas, rays), "rays");
+
+        if (count == 1000) {
+            //原来的做法：每个副本一条translate(rotate_y(...))包装链，全部放在一个列表中
+            hittableList chains;
+            for (int i = 0; i < count; i++) {
+                shared_ptr<hittable> copy = make_shared<rotate_y>(mesh, random_double(0, 360));
+                chains.add(make_shared<translate>(copy, vec3::random(0, extent)));
+            }
+            auto chain_rays = bench_rays(chains, 5000);
+            print_bench("    trace translate/rotate_y list", chain_rays.size(), bench_trace(chains, chain_rays), "rays");
+        }
+    }
+
+    //final_scene中的做法：底层BVH是bvh_node（1000个小球），顶层BVH下的实例共享它，
+    //压平顶层BVH时底层BVH也必须被压平，而且只压平一次
+    auto cluster_list = bench_sphere_cluster(1000);
+    shared_ptr<hittable> cluster = make_shared<bvh_node>(cluster_list, 0, 1);
+    hittableList clusters;
+    for (int i = 0; i < 100; i++)
+        clusters.add(make_shared<instance>(cluster, affine3::translation(vec3::random(0, 2000))));
+    auto tlas = flatten_bvh(make_shared<bvh_node>(clusters, 0, 1));
+    auto first = std::dynamic_pointer_cast<instance>(clusters.objects[0]);
+    bench_expect(count_bvh_nodes(*tlas) == 0, "bvh_node left under the instances after flatten_bvh");
+    bench_expect(first && std::dynamic_pointer_cast<qbvh>(first->ptr), "instanced BLAS was not flattened to a qbvh");
+    bool shared = true;
+    for (const auto& object : clusters.objects)
+        shared = shared && first && std::static_pointer_cast<instance>(object)->ptr == first->ptr;
+    bench_expect(shared, "instanced BLAS flattened more than once");
+}
+
+/// <summary>
+/// 变换链：康奈尔盒子里的两个translate(rotate_y(box))，以及每个小球外面各有两层平移加旋转的球团，
+/// 比较原来的嵌套包装和collapse_transforms合并成一个transform之后的求交速度
+/// </summary>
+void bench_transforms() {
+    seed_sampler(2023, 0, 0);
+    auto white = make_shared<lambertian_vec>(vec3(0.73, 0.73, 0.73));
+    hittableList boxes;
+    boxes.add(make_shared<translate>(make_shared<rotate_y>(
+        make_shared<box>(vec3(0, 0, 0), vec3(165, 330, 165), white), 15), vec3(265, 0, 295)));
+    boxes.add(make_shared<translate>(make_shared<rotate_y>(
+        make_shared<box>(vec3(0, 0, 0), vec3(165, 165, 165), white), -18), vec3(130, 0, 65)));
+
+    //每个小球外面两层平移加旋转，再建BVH
+    hittableList cluster;
+    for (int j = 0; j < 1000; j++) {
+        shared_ptr<hittable> ball = make_shared<sphere>(vec3(0, 0, 0), 10, white);
+        ball = make_shared<translate>(make_shared<rotate_y>(ball, random_double(0, 360)), vec3::random(-20, 20));
+        ball = make_shared<translate>(make_shared<rotate_y>(ball, random_double(0, 360)), vec3::random(0, 165));
+        cluster.add(ball);
+    }
+    hittableList chain;
+    chain.add(make_shared<bvh_node>(cluster, 0, 1));
+
+    struct bench_scene {
+        std::string name;
+        hittableList objects;
+    };
+    std::vector<bench_scene> scenes = { { "cornell boxes", boxes }, { "sphere cluster (1000), 2x translate(rotate_y)", chain } };
+    std::cerr << "Transform benchmark\n";
+    for (auto& scene : scenes) {
+        auto rays = bench_rays(scene.objects, 200000);
+        print_bench(scene.name + ", nested", rays.size(), bench_trace(scene.objects, rays), "rays");
+        collapse_transforms(scene.objects);
+        print_bench(scene.name + ", collapsed", rays.size(), bench_trace(scene.objects, rays), "rays");
+    }
+}
+
+/// <summary>
+/// final_scene()的地面：400个盒子，每个盒子是一个slab求交的图元，
+/// 与原来每个盒子由六个矩形（其中三个包着flip_face）组成的列表比较
+/// </summary>
+void bench_boxes() {
+    auto ground = make_shared<lambertian_vec>(vec3(0.48, 0.83, 0.53));
+    auto six_rects = [&](const vec3& p0, const vec3& p1) {
+        auto sides = make_shared<hittableList>();
+        sides->add(make_shared<xy_rect>(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), ground));
+        sides->add(make_shared<flip_face>(make_shared<xy_rect>(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), ground)));
+        sides->add(make_shared<xz_rect>(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), ground));
+        sides->add(make_shared<flip_face>(make_shared<xz_rect>(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), ground)));
+        sides->add(make_shared<yz_rect>(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), ground));
+        sides->add(make_shared<flip_face>(make_shared<yz_rect>(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), ground)));
+        return sides;
+    };
+
+    seed_sampler(2023, 0, 0);
+    auto boxes = bench_box_ground();
+    hittableList rects;
+    for (const auto& object : boxes.objects) {
+        auto b = std::static_pointer_cast<box>(object);
+        rects.add(six_rects(b->box_min, b->box_max));
+    }
+    auto rays = bench_rays(boxes, 500000);
+    std::cerr << "Box benchmark, final_scene ground (400 boxes)\n";
+    print_bench("six rects, flattened bvh", rays.size(), bench_trace(*flatten_bvh(make_shared<bvh_node>(rects, 0, 1)), rays), "rays");
+    print_bench("slab box, flattened bvh", rays.size(), bench_trace(*flatten_bvh(make_shared<bvh_node>(boxes, 0, 1)), rays), "rays");
+
+    //两种做法的交点应该相同
+    bench_compare_hits("slab box vs six rects", rects, boxes, rays, [](const hit_record& a, const hit_record& b) {
+        return (a.p - b.p).length() <= bench_t_tolerance * (1 + a.p.length()) && a.normal[0] == b.normal[0]
+            && a.normal[1] == b.normal[1] && a.normal[2] == b.normal[2] && a.front_face == b.front_face
+            && fabs(a.u - b.u) <= bench_t_tolerance && fabs(a.v - b.v) <= bench_t_tolerance;
+    });
+}
+
+/// <summary>
+/// 编译后的场景与压平的4路BVH比较求交速度，并检查两者的交点是否一致（场景中不能有体积雾，它的交点是随机的）
+/// </summary>
+void bench_compiled_scene(const std::string& name, const hittableList& world) {
+    seed_sampler(2023, 0, 0);
+    auto flat_list = world;
+    auto flat = flatten_bvh(make_shared<bvh_node>(flat_list, 0, 1));
+    bench_timer timer;
+    compiled_scene compiled(world);
+    double build = timer.seconds();
+    std::cerr << "Compiled scene benchmark, " << name << ": " << compiled.spheres.radius.size() << " spheres, "
+        << compiled.rects[0].k.size() + compiled.rects[1].k.size() + compiled.rects[2].k.size() << " rects, "
+        << compiled.boxes.min_x.size() << " boxes, " << compiled.others.size() << " others, build "
+        << build * 1000 << "ms\n";
+
+    //取三次中最快的一次，减少机器负载的影响
+    auto rays = bench_rays(*flat, 200000);
+    double flat_seconds = infinity, compiled_seconds = infinity;
+    for (int run = 0; run < 3; run++) {
+        flat_seconds = std::min(flat_seconds, bench_trace(*flat, rays));
+        compiled_seconds = std::min(compiled_seconds, bench_trace(compiled, rays));
+    }
+    print_bench("flattened 4-wide bvh", rays.size(), flat_seconds, "rays");
+    print_bench("compiled scene", rays.size(), compiled_seconds, "rays");
+
+    bench_compare_hits("compiled scene vs flattened bvh", *flat, compiled, rays, bench_same_hit);
+}
+
+/// <summary>
+/// 球的批量求交：4路BVH中不超过4个球的子树折叠成一个球叶子，与逐个调用球的虚函数比较；
+/// 场景列表中直接有球时，再比较逐个遍历列表和把球换成sphere_batch以后的列表
+/// </summary>
+void bench_sphere_batch(const std::string& name, const hittableList& world) {
+    seed_sampler(2023, 0, 0);
+    auto tree_list = world;
+    auto tree = make_shared<bvh_node>(tree_list, 0, 1);
+    qbvh scalar(tree, 0, 1, 0), batched(tree, 0, 1);
+    auto rays = bench_rays(world, 200000);
+    std::cerr << "Sphere batch benchmark, " << name << ": " << scalar.nodes.size() << " -> " << batched.nodes.size()
+        << " qbvh nodes\n";
+    double scalar_seconds = infinity, batched_seconds = infinity;
+    for (int run = 0; run < 3; run++) {
+        scalar_seconds = std::min(scalar_seconds, bench_trace(scalar, rays));
+        batched_seconds = std::min(batched_seconds, bench_trace(batched, rays));
+    }
+    print_bench("qbvh, one sphere per call", rays.size(), scalar_seconds, "rays");
+    print_bench("qbvh, sphere leaves", rays.size(), batched_seconds, "rays");
+
+    auto list = world;
+    batch_spheres(list);
+    rays.resize(20000);
+    if (list.objects.size() < world.objects.size()) {
+        print_bench("list, one sphere per call", rays.size(), bench_trace(world, rays), "rays");
+        print_bench("list, sphere_batch", rays.size(), bench_trace(list, rays), "rays");
+    }
+
+    //几种做法应该击中同一个球的同一个位置
+    bench_compare_hits("sphere leaves vs one sphere per call", scalar, batched, rays, bench_same_hit);
+    bench_compare_hits("sphere_batch list vs one sphere per call", scalar, list, rays, bench_same_hit);
+}
+
+/// <summary>
+/// 渲染流程中的球叶子：场景经过collapse_transforms和compiled_scene，变换（实例）下面的BVH在编译时压平成带球叶子的4路BVH。
+/// 与这些BVH不用球叶子相比，射向其中第一个变换物体包围盒的光线的求交速度。
+/// 场景中有体积雾时交点是随机的，这里只计时，交点的一致性由bench_sphere_batch检查
+/// </summary>
+void bench_sphere_batch_scene(const std::string& name, hittableList (*make_scene)()) {
+    shared_ptr<hittable> target;
+    auto build = [&](bool sphere_leaves) {
+        auto world = make_scene();
+        collapse_transforms(world);
+        for (const auto& object : world.objects) {
+            auto transformed = std::dynamic_pointer_cast<transform>(object);
+            auto node = transformed ? std::dynamic_pointer_cast<bvh_node>(transformed->ptr) : nullptr;
+            if (!node)
+                continue;
+            if (!target)
+                target = object;
+            if (!sphere_leaves)
+                transformed->ptr = make_shared<qbvh>(node, 0, 1, 0);
+        }
+        return make_shared<compiled_scene>(world);
+    };
+    auto scalar = build(false);
+    auto batched = build(true);
+    if (!target) {
+        std::cerr << "Sphere batch benchmark, " << name << ": no BVH under a transform\n";
+        return;
+    }
+    seed_sampler(2023, 0, 0);
+    auto rays = bench_rays(*target, 200000);
+    std::cerr << "Sphere batch benchmark, " << name << " (compiled scene, rays aimed at the transformed BVH)\n";
+    //先后顺序会影响缓存，两种做法轮流先测，各取五次中最快的一次
+    double scalar_seconds = infinity, batched_seconds = infinity;
+    for (int run = 0; run < 5; run++) {
+        if (run % 2)
+            scalar_seconds = std::min(scalar_seconds, bench_trace(*scalar, rays));
+        batched_seconds = std::min(batched_seconds, bench_trace(*batched, rays));
+        if (run % 2 == 0)
+            scalar_seconds = std::min(scalar_seconds, bench_trace(*scalar, rays));
+    }
+    print_bench("one sphere per call", rays.size(), scalar_seconds, "rays");
+    print_bench("sphere leaves", rays.size(), batched_seconds, "rays");
+}
+
+/// <summary>
+/// 主光线的求交速度：逐条光线遍历线性BVH，以及4/8/16条光线的光线包
+/// </summary>
+template <int N>
+double bench_packet_trace(const linear_bvh& bvh, const camera& cam, int width, int height) {
+    const int packet_width = N == 4 ? 2 : 4;
+    const int packet_height = N / packet_width;
+    ray_packet<N> packet;
+    sampler_rng rng[N];
+    int hits = 0;
+    bench_timer timer;
+    for (int y0 = 0; y0 < height; y0 += packet_height) {
+        for (int x0 = 0; x0 < width; x0 += packet_width) {
+            for (int k = 0; k < N; k++) {
+                int i = x0 + k % packet_width, j = y0 + k / packet_width;
+                packet.active[k] = true;
+                packet.rays[k] = cam.get_ray((i + 0.5) / width, (j + 0.5) / height);
+            }
+            packet.prepare(infinity);
+            trace_packet(bvh, packet, 0.001, rng);
+            for (int k = 0; k < N; k++)
+                hits += packet.hit[k];
+        }
+    }
+    bench_sink = hits;
+    return timer.seconds();
+}
+
+void bench_packets(const std::string& name, hittableList world, const camera& cam) {
+    const int width = 512, height = 512;
+    linear_bvh bvh(make_shared<bvh_node>(world, 0, 1));
+    std::cerr << "Primary ray benchmark, " << name << " (" << width << "x" << height << ")\n";
+
+    bench_timer timer;
+    int hits = 0;
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            hit_record rec;
+            hits += bvh.hit(cam.get_ray((i + 0.5) / width, (j + 0.5) / height), 0.001, infinity, rec);
+        }
+    }
+    bench_sink = hits;
+    double count = double(width) * height;
+    print_bench("single rays", count, timer.seconds(), "rays");
+    print_bench("packets of 4", count, bench_packet_trace<4>(bvh, cam, width, height), "rays");
+    print_bench("packets of 8", count, bench_packet_trace<8>(bvh, cam, width, height), "rays");
+    print_bench("packets of 16", count, bench_packet_trace<16>(bvh, cam, width, height), "rays");
+}
+
+/// <summary>
+/// 俄罗斯轮盘赌的效果：关闭和打开时的渲染时间，以及整幅图像的平均亮度（无偏时两者只差噪声）
+/// </summary>
+/// <param name="radiance">路径追踪积分器，形如 vec3(const ray&amp;, int roulette_depth)</param>
+template <typename Radiance>
+void bench_roulette(const std::string& name, const camera& cam, Radiance radiance) {
+    render_settings settings;
+    settings.image_width = 128;
+    settings.image_height = 128;
+    settings.samples_per_pixel = 64;
+    settings.threads = 1;
+    std::cerr << "Russian roulette benchmark, " << name << "\n";
+
+    double paths = double(settings.image_width) * settings.image_height * settings.samples_per_pixel;
+    for (int roulette_depth : { settings.max_depth, 3, 5, 10 }) {
+        std::vector<float> accum;
+        bench_timer timer;
+        render(settings, cam, [&](const ray& r) { return radiance(r, roulette_depth); }, accum);
+        double seconds = timer.seconds();
+        double mean = 0;
+        for (float value : accum)
+            mean += value;
+        mean /= paths * 3;
+        std::string label = roulette_depth >= settings.max_depth ? std::string("no roulette")
+            : "roulette after " + std::to_string(roulette_depth) + " bounces";
+        print_bench(label, paths, seconds, "paths");
+        std::cerr << "    mean radiance " << mean << "\n";
+    }
+}
+
+/// <summary>
+/// 图像相对参考图像的均方根误差，在film::tonemap输出的伽马校正并截断后的值上计算
+/// </summary>
+/// <param name="counts">每个像素的采样数</param>
+double display_rmse(const std::vector<float>& accum, const std::vector<int>& counts,
+    const std::vector<float>& reference, int reference_samples) {
+    double error = 0;
+    for (size_t i = 0; i < accum.size(); i++) {
+        double difference = clamp(sqrt(accum[i] / counts[i / 3]), 0.0, 0.999)
+            - clamp(sqrt(reference[i] / reference_samples), 0.0, 0.999);
+        error += difference * difference;
+    }
+    return sqrt(error / accum.size());
+}
+
+/// <summary>
+/// 像素误差（三个通道中最大的绝对误差，同样在伽马校正后计算）的分位数，反映图像中最显眼的噪点
+/// </summary>
+double display_error_percentile(const std::vector<float>& accum, const std::vector<int>& counts,
+    const std::vector<float>& reference, int reference_samples, double percentile) {
+    std::vector<double> errors(counts.size(), 0.0);
+    for (size_t i = 0; i < accum.size(); i++) {
+        double difference = clamp(sqrt(accum[i] / counts[i / 3]), 0.0, 0.999)
+            - clamp(sqrt(reference[i] / reference_samples), 0.0, 0.999);
+        errors[i / 3] = std::max(errors[i / 3], fabs(difference));
+    }
+    auto nth = errors.begin() + static_cast<size_t>(percentile * (errors.size() - 1));
+    std::nth_element(errors.begin(), nth, errors.end());
+    return *nth;
+}
+
+/// <summary>
+/// 光源采样的效果：同样的采样数下，只用材质采样和加上光源采样(MIS)两种方式相对参考图像的均方根误差，
+/// 参考图像用光源采样和较多的采样数渲染
+/// </summary>
+/// <param name="radiance">路径追踪积分器，形如 vec3(const ray&amp;, bool sample_lights)</param>
+template <typename Radiance>
+void bench_light_sampling(const std::string& name, const camera& cam, Radiance radiance) {
+    render_settings settings;
+    settings.image_width = 64;
+    settings.image_height = 64;
+    settings.threads = 1;
+    std::cerr << "Light sampling benchmark, " << name << "\n";
+
+    std::vector<float> reference;
+    settings.samples_per_pixel = 1024;
+    settings.seed = 1;
+    render(settings, cam, [&](const ray& r) { return radiance(r, true); }, reference);
+
+    settings.samples_per_pixel = 16;
+    settings.seed = 0;
+    double paths = double(settings.image_width) * settings.image_height * settings.samples_per_pixel;
+    double errors[2];
+    for (int sample_lights = 0; sample_lights < 2; sample_lights++) {
+        std::vector<float> accum;
+        bench_timer timer;
+        render(settings, cam, [&](const ray& r) { return radiance(r, sample_lights != 0); }, accum);
+        double seconds = timer.seconds();
+        std::vector<int> counts(accum.size() / 3, settings.samples_per_pixel);
+        errors[sample_lights] = display_rmse(accum, counts, reference, 1024);
+        print_bench(sample_lights ? "bsdf + light sampling (MIS)" : "bsdf sampling only", paths, seconds, "paths");
+        std::cerr << "    rmse at " << settings.samples_per_pixel << " spp: " << errors[sample_lights] << "\n";
+    }
+    std::cerr << "  error reduction " << errors[0] / errors[1] << "x\n";
+}
+
+/// <summary>
+/// 自适应采样的效果：固定采样数渲染和不同收敛阈值的自适应渲染，比较总采样数和相对参考图像的误差
+/// </summary>
+/// <param name="radiance">计算一条光线颜色的函数，形如 vec3(const ray&amp;)</param>
+template <typename Radiance>
+void bench_adaptive(const std::string& name, const camera& cam, Radiance radiance) {
+    render_settings settings;
+    settings.image_width = 64;
+    settings.image_height = 64;
+    settings.threads = 1;
+    std::cerr << "Adaptive sampling benchmark, " << name << "\n";
+
+    const int reference_samples = 2048;
+    std::vector<float> reference;
+    settings.samples_per_pixel = reference_samples;
+    settings.seed = 1;
+    render(settings, cam, radiance, reference);
+    settings.seed = 0;
+
+    const size_t pixels = size_t(settings.image_width) * settings.image_height;
+    std::vector<float> accum;
+    std::vector<int> counts;
+    for (int samples : { 64, 256 }) {
+        settings.samples_per_pixel = samples;
+        counts.assign(pixels, samples);
+        bench_timer timer;
+        render(settings, cam, radiance, accum);
+        double seconds = timer.seconds();
+        print_bench("fixed " + std::to_string(samples) + " spp", double(pixels) * samples, seconds, "paths");
+        std::cerr << "    " << pixels * samples << " samples, rmse " << display_rmse(accum, counts, reference, reference_samples)
+            << ", 99th percentile error " << display_error_percentile(accum, counts, reference, reference_samples, 0.99) << "\n";
+    }
+
+    settings.samples_per_pixel = 1024;
+    settings.adaptive = true;
+    for (double threshold : { 0.03, 0.015 }) {
+        settings.noise_threshold = threshold;
+        bench_timer timer;
+        render_progressive(settings, cam, radiance, accum, counts);
+        double seconds = timer.seconds();
+        long long total = 0;
+        for (int n : counts)
+            total += n;
+        print_bench("adaptive, threshold " + std::to_string(threshold).substr(0, 5), double(total), seconds, "paths");
+        std::cerr << "    " << total << " samples, rmse " << display_rmse(accum, counts, reference, reference_samples)
+            << ", 99th percentile error " << display_error_percentile(accum, counts, reference, reference_samples, 0.99) << "\n";
+    }
+}
+
+/// <summary>
+/// 标量精度(real)对内存和速度的影响：分别用默认选项和定义RT_SINGLE_PRECISION编译后运行，比较两次的输出。
+/// 渲染结果的平均亮度也一并输出，float版本出现自相交（暗斑）时会明显偏暗
+/// </summary>
+/// <param name="radiance">路径追踪积分器，形如 vec3(const ray&amp;)</param>
+template <typename Radiance>
+void bench_precision(const std::string& name, const camera& cam, Radiance radiance) {
+    std::cerr << "Precision benchmark (" << (sizeof(real) == sizeof(float) ? "float" : "double") << " build"
+        << (std::is_same<vec3, vec3a>::value ? ", SIMD vec3a" : "") << ")\n";
+    std::cerr << "  sizeof: vec3 " << sizeof(vec3) << ", ray " << sizeof(ray) << ", hit_record " << sizeof(hit_record)
+        << ", aabb " << sizeof(aabb) << ", bvh_node " << sizeof(bvh_node) << ", sphere " << sizeof(sphere) << " bytes\n";
+
+    std::vector<vec3> positions;
+    std::vector<mesh_face> faces;
+    bench_sphere_mesh(708, 708, positions, faces);
+    auto white = make_shared<lambertian_vec>(vec3(0.73, 0.73, 0.73));
+    triangle_mesh mesh(positions, positions, std::vector<vec3>(), faces, white);
+    double mesh_bytes = double(sizeof(vec3) * (mesh.positions.size() + mesh.normals.size())
+        + sizeof(mesh_face) * mesh.faces.size() + sizeof(wide_bvh_node<4>) * mesh.bvh.nodes.size());
+    seed_sampler(2023, 0, 0);
+    auto rays = bench_rays(mesh, 200000);
+    std::cerr << "  sphere mesh: " << faces.size() << " triangles, " << mesh_bytes / (1 << 20) << " MiB\n";
+    print_bench("mesh trace", rays.size(), bench_trace(mesh, rays), "rays");
+
+    seed_sampler(2023, 0, 0);
+    auto cluster = bench_sphere_cluster(10000);
+    auto tree = make_shared<bvh_node>(cluster, 0, 1);
+    double tree_bytes = 0;
+    std::vector<const bvh_node*> pending = { tree.get() };
+    while (!pending.empty()) {
+        auto node = pending.back();
+        pending.pop_back();
+        tree_bytes += sizeof(bvh_node);
+        for (auto child : { node->left.get(), node->right.get() }) {
+            if (auto inner = dynamic_cast<const bvh_node*>(child))
+                pending.push_back(inner);
+            else
+                tree_bytes += sizeof(sphere);
+        }
+    }
+    rays = bench_rays(*tree, 200000);
+    std::cerr << "  sphere cluster: 10000 spheres, bvh_node tree " << tree_bytes / (1 <<20) << " MiB\n";
+    print_bench("bvh_node trace", rays.size(), bench_trace(*tree, rays), "rays");
+    qbvh flat(tree);
+    print_bench("qbvh trace", rays.size(), bench_trace(flat, rays), "rays");
+
+    render_settings settings;
+    settings.image_width = 64;
+    settings.image_height = 64;
+    settings.samples_per_pixel = 64;
+    settings.threads = 1;
+    std::vector<float> accum;
+    bench_timer timer;
+    render(settings, cam, radiance, accum);
+    double seconds = timer.seconds();
+    double sum = 0;
+    for (float value : accum)
+        sum += value;
+    print_bench(name + " render", double(settings.image_width) * settings.image_height * settings.samples_per_pixel, seconds, "paths");
+    std::cerr << "    mean radiance " << sum / accum.size() / settings.samples_per_pixel << "\n";
+}
+
+/// <summary>
+/// 材质和相机中典型的向量运算：单位化入射方向、镜面反射加扰动、漫反射方向、相机光线的线性组合
+/// </summary>
+template <typename V>
+double bench_vec3_kernel(const std::vector<V>& a, const std::vector<V>& b, int rounds, V& result) {
+    bench_timer timer;
+    V acc(0, 0, 0);
+    for (int round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < a.size(); i++) {
+            V n = unit_vector(b[i]);
+            V reflected = reflect(unit_vector(a[i]), n) + 0.3 * a[i];
+            V diffuse = unit_vector(n + b[i]);
+            V tangent = cross(n, reflected);
+            acc += dot(reflected, n) * diffuse + 0.5 * tangent - a[i] * b[i];
+        }
+    }
+    result = acc;
+    return timer.seconds();
+}
+
+/// <summary>
+/// 标量的vec3_t&lt;float&gt;与SSE的vec3a执行同样的向量运算，比较速度和结果（rsqrt加一次牛顿迭代、FMA使结果只差最后几位）
+/// </summary>
+void bench_vec3() {
+    const int count = 4096, rounds = 200;
+    seed_sampler(2023, 0, 0);
+    std::vector<vec3_t<float>> scalar_a, scalar_b;
+    std::vector<vec3a> simd_a, simd_b;
+    for (int i = 0; i < count; i++) {
+        auto a = vec3_t<float>::random(-1, 1), b = vec3_t<float>::random(-1, 1);
+        scalar_a.push_back(a);
+        scalar_b.push_back(b);
+        simd_a.push_back(vec3a(a));
+        simd_b.push_back(vec3a(b));
+    }
+#if defined(RT_VEC3A_FMA)
+    const char* backend = "SSE + FMA";
+#elif defined(RT_VEC3A_SSE)
+    const char* backend = "SSE";
+#else
+    const char* backend = "scalar fallback";
+#endif
+    std::cerr << "Vec3 benchmark, " << count << " vector pairs x " << rounds << " rounds (vec3a: " << backend << ")\n";
+    vec3_t<float> scalar_result;
+    vec3a simd_result;
+    double scalar_seconds = infinity, simd_seconds = infinity;
+    for (int run = 0; run < 3; run++) {
+        scalar_seconds = std::min(scalar_seconds, bench_vec3_kernel(scalar_a, scalar_b, rounds, scalar_result));
+        simd_seconds = std::min(simd_seconds, bench_vec3_kernel(simd_a, simd_b, rounds, simd_result));
+    }
+    print_bench("vec3_t<float>", double(count) * rounds, scalar_seconds, "kernels");
+    print_bench("vec3a", double(count) * rounds, simd_seconds, "kernels");
+    auto difference = (vec3_t<float>(simd_result) - scalar_result).length() / scalar_result.length();
+    std::cerr << "  relative difference of the sums " << difference << "\n";
+}
@@ -31,7 +31,7 @@ public:
     /// <param name="u">0，1之间</param>
     /// <param name="v">0，1之间</param>
     /// <returns></returns>
-    ray get_ray(double s, double t) {
+    ray get_ray(double s, double t) const {
         vec3 rd = lens_radius * random_in_unit_disk();
         vec3 offset = u * rd.x() + v * rd.y();
 
@@ -42,6 +42,21 @@ public:
         );
     }
 
+    /// <summary>
+    /// 相机参数的散列：位置、朝向、视场和宽高比、光圈、对焦距离和快门时间都相同时才相同
+    /// </summary>
+    uint64_t fingerprint() const {
+        const vec3 vectors[] = { origin, lower_left_corner, horizontal, vertical, u, v };
+        double values[3 * 6 + 3];
+        for (int i = 0; i < 6; i++)
+            for (int a = 0; a < 3; a++)
+                values[i * 3 + a] = vectors[i][a];
+        values[18] = lens_radius;
+        values[19] = time0;
+        values[20] = time1;
+        return fnv1a(values, sizeof(values));
+    }
+
 private:
     vec3 origin;
     vec3 lower_left_corner;
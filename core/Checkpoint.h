@@ -0,0 +1,196 @@
+﻿#pragma once
+//渲染检查点：渐进式渲染每隔一段时间把状态写进一个二进制文件，进程崩溃或被抢占后用--resume从最后一个检查点继续。
+//每个采样的随机序列只由 (种子, 像素, 采样序号) 决定，所以随机数状态就是种子和每个像素的采样数，
+//继续渲染得到的图像与不中断的渲染逐位相同
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Progressive.h"
+#include "Film.h"
+
+//文件头，后面依次是accum(3N个float)、自适应时的mean和m2(各N个float)、count(N个int32)，都是小端
+struct checkpoint_header {
+    char magic[4] = { 'R', 'T', 'C', 'K' };
+    uint32_t version = 2;
+    int32_t width = 0, height = 0;
+    uint32_t seed = 0;
+    int32_t adaptive = 0;
+    int32_t passes = 0;
+    //这些设置改变了积分器或者自适应采样的进度，换了设置继续渲染得到的图像与不中断的渲染不同
+    int32_t max_depth = 0, roulette_depth = 0;
+    int32_t min_samples = 0, pass_samples = 0;
+    int32_t reserved = 0;
+    double noise_threshold = 0;
+    double elapsed = 0;
+    uint64_t scene = 0;        //场景的指纹，见render_checkpointed
+    uint64_t stream_check = 0; //sample_stream(seed, 0, 0)，采样器的算法变了以后旧的检查点不能继续使用
+
+    checkpoint_header() {}
+    checkpoint_header(const render_settings& settings, uint64_t scene_id)
+        : width(settings.image_width), height(settings.image_height), seed(settings.seed), adaptive(settings.adaptive),
+        max_depth(settings.max_depth), roulette_depth(settings.roulette_depth), min_samples(settings.min_samples),
+        pass_samples(settings.pass_samples), noise_threshold(settings.noise_threshold), scene(scene_id),
+        stream_check(sample_stream(settings.seed, 0, 0)) {}
+};
+
+/// <summary>
+/// 写检查点。先写到临时文件再改名，写到一半被打断时旧的检查点仍然完整
+/// </summary>
+bool save_checkpoint(const std::string& path, const render_settings& settings, uint64_t scene,
+    const progressive_state& state) {
+    checkpoint_header header(settings, scene);
+    header.passes = state.passes;
+    header.elapsed = state.elapsed;
+
+    const std::string temp = path + ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary);
+        if (!out) {
+            std::cerr << "save_checkpoint: cannot open " << temp << "\n";
+            return false;
+        }
+        auto write_vector = [&](const auto& v) {
+            out.write(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(v[0]));
+        };
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        write_vector(state.accum);
+        //固定采样数的渲染不用收敛统计，不保存
+        if (settings.adaptive) {
+            write_vector(state.stats.mean);
+            write_vector(state.stats.m2);
+        }
+        write_vector(state.stats.count);
+        if (!out) {
+            std::cerr << "save_checkpoint: write failed " << temp << "\n";
+            return false;
+        }
+    }
+    //Windows上rename不能覆盖已有的文件
+    if (std::rename(temp.c_str(), path.c_str()) != 0) {
+        std::remove(path.c_str());
+        if (std::rename(temp.c_str(), path.c_str()) != 0) {
+            std::cerr << "save_checkpoint: cannot rename " << temp << " to " << path << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+/// <summary>
+/// 读检查点。场景、分辨率、种子、反弹次数和自适应采样的参数必须与当前设置相同；采样数上限和时间上限可以改，继续往上加采样
+/// </summary>
+bool load_checkpoint(const std::string& path, const render_settings& settings, uint64_t scene,
+    progressive_state& state) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cerr << "load_checkpoint: cannot open " << path << "\n";
+        return false;
+    }
+    checkpoint_header header, expected(settings, scene);
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!in || std::string(header.magic, 4) != std::string(expected.magic, 4) || header.version != expected.version) {
+        std::cerr << "load_checkpoint: " << path << " is not a checkpoint file\n";
+        return false;
+    }
+    //逐项比较，列出所有不同的设置
+    bool same = true;
+    auto check = [&](const char* name, auto saved, auto current) {
+        if (saved != current) {
+            std::cerr << "load_checkpoint: " << path << " was rendered with " << name << " " << saved
+                << ", current " << current << "\n";
+            same = false;
+        }
+    };
+    if (header.scene != expected.scene) {
+        std::cerr << "load_checkpoint: " << path << " was rendered from a different scene\n";
+        same = false;
+    }
+    check("width", header.width, expected.width);
+    check("height", header.height, expected.height);
+    check("seed", header.seed, expected.seed);
+    check("adaptive", header.adaptive, expected.adaptive);
+    check("max_depth", header.max_depth, expected.max_depth);
+    check("roulette_depth", header.roulette_depth, expected.roulette_depth);
+    check("min_samples", header.min_samples, expected.min_samples);
+    check("pass_samples", header.pass_samples, expected.pass_samples);
+    check("noise_threshold", header.noise_threshold, expected.noise_threshold);
+    if (!same)
+        return false;
+    if (header.stream_check != expected.stream_check) {
+        std::cerr << "load_checkpoint: " << path << " was written by a different sampler\n";
+        return false;
+    }
+
+    const size_t pixels = size_t(header.width) * header.height;
+    state.reset(pixels);
+    state.passes = header.passes;
+    state.elapsed = header.elapsed;
+    auto read_vector = [&](auto& v) {
+        in.read(reinterpret_cast<char*>(v.data()), v.size() * sizeof(v[0]));
+    };
+    read_vector(state.accum);
+    if (header.adaptive) {
+        read_vector(state.stats.mean);
+        read_vector(state.stats.m2);
+    }
+    read_vector(state.stats.count);
+    if (!in) {
+        std::cerr << "load_checkpoint: " << path << " is truncated\n";
+        return false;
+    }
+    return true;
+}
+
+inline void request_render_stop(int) {
+    render_stop_requested = 1;
+}
+
+/// <summary>
+/// 收到SIGINT或SIGTERM（批处理节点被抢占前一般会先发SIGTERM）后，渲染在当前这一遍结束时写检查点并停止
+/// </summary>
+void install_render_stop_handler() {
+    std::signal(SIGINT, request_render_stop);
+    std::signal(SIGTERM, request_render_stop);
+}
+
+/// <summary>
+/// 带检查点的渐进式渲染：每隔settings.checkpoint_interval秒以及渲染结束时把状态写入path
+/// </summary>
+/// <param name="radiance">计算一条光线颜色的函数，形如 vec3(const ray&amp;)</param>
+/// <param name="image">输出的胶片</param>
+/// <param name="path">检查点文件，为空时不保存检查点</param>
+/// <param name="resume">为真时从path中的检查点继续</param>
+/// <param name="scene">场景的指纹，保存在检查点中，继续渲染时必须相同</param>
+/// <returns>检查点无法读取时返回false，图像没有渲染</returns>
+template <typename Radiance>
+bool render_checkpointed(const render_settings& settings, const camera& cam, Radiance radiance, film& image,
+    const std::string& path, bool resume, uint64_t scene) {
+    progressive_state state;
+    if (resume) {
+        if (!load_checkpoint(path, settings, scene, state))
+            return false;
+        std::cerr << "Resuming from " << path << ": " << state.passes << " passes, " << state.elapsed << "s rendered\n";
+    }
+    auto last_save = std::chrono::steady_clock::now();
+    render_progressive(settings, cam, radiance, state, [&](const progressive_state& s, bool finished) {
+        double since_save = std::chrono::duration<double>(std::chrono::steady_clock::now() - last_save).count();
+        if (path.empty())
+            return;
+        if (finished || render_stop_requested || since_save >= settings.checkpoint_interval) {
+            save_checkpoint(path, settings, scene, s);
+            last_save = std::chrono::steady_clock::now();
+        }
+    });
+    if (render_stop_requested && !path.empty())
+        std::cerr << "Render stopped, continue with --resume from " << path << "\n";
+
+    image.resize(settings.image_width, settings.image_height);
+    image.accum = std::move(state.accum);
+    image.sample_counts = std::move(state.stats.count);
+    return true;
+}
@@ -0,0 +1,410 @@
+﻿#pragma once
+//编译后的场景：hittable组成的场景树仍然用来描述场景，渲染前编译成按类型分组的结构数组(SoA)：
+//球的球心和半径、矩形的范围、盒子的上下界各自连续存放。所有图元共用一棵宽BVH，每个叶子中只有一种图元，
+//用该类型专门的循环求交，不经过虚函数。不认识的物体（运动的球、体积雾、变换、三角网格等）作为单独的一种类型，
+//叶子中仍然通过虚函数求交
+#include "LinearBVH.h"
+#include "PrimitiveBVH.h"
+#include "SphereBatch.h"
+#include "xyz_rect.h"
+#include "box.h"
+#include <cstdint>
+#include <vector>
+
+//编译后图元的类型，也是BVH叶子的类型，放在hit_record::prim_id的低3位
+enum class compiled_kind { sphere = 0, rect_xy = 1, rect_xz = 2, rect_yz = 3, box = 4, other = 5 };
+
+struct sphere_group : sphere_soa {
+    std::vector<const material*> mats;
+};
+
+//垂直于axis轴的矩形，a、b是另外两个轴上的范围，与xy_rect/xz_rect/yz_rect的u、v方向相同
+struct rect_group {
+    int axis, a_axis, b_axis;
+    std::vector<double> k, a0, a1, b0, b1;
+    std::vector<uint8_t> flipped; //外面包着flip_face
+    std::vector<const material*> mats;
+};
+
+struct box_group {
+    std::vector<double> min_x, min_y, min_z, max_x, max_y, max_z;
+    std::vector<const material*> mats;
+};
+
+class compiled_scene : public hittable {
+public:
+    compiled_scene(const hittableList& scene, double time0 = 0, double time1 = 1);
+
+    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const;
+    virtual bool intersect(const ray& r, double t_min, double t_max, hit_record& rec) const;
+    virtual void finalize(const ray& r, hit_record& rec) const;
+    virtual bool bounding_box(double t0, double t1, aabb& output_box) const {
+        output_box = bbox;
+        return hasbox;
+    }
+
+    size_t primitive_count() const {
+        return spheres.radius.size() + rects[0].k.size() + rects[1].k.size() + rects[2].k.size()
+            + boxes.min_x.size() + others.size();
+    }
+
+    //叶子中最多的图元数量，叶子中的循环越长越适合SIMD
+    static const int leaf_size = 2;
+
+public:
+    sphere_group spheres;
+    rect_group rects[3]; //法线分别为z、y、x轴：xy_rect、xz_rect、yz_rect
+    box_group boxes;
+    std::vector<shared_ptr<hittable>> others; //不能编译的物体
+    primitive_bvh bvh;
+    hittableList source; //持有原来的物体和材质
+    aabb bbox;
+    bool hasbox;
+
+private:
+    void gather(const shared_ptr<hittable>& object, bool flipped);
+    void add_rect(int group, double a0, double a1, double b0, double b1, double k, bool flipped, const material* m);
+
+    bool intersect_spheres(const ray& r, double t_min, int start, int count, double& closest, int& index) const;
+    bool intersect_rects(const rect_group& g, const ray& r, double t_min, int start, int count, double& closest, int& index) const;
+    bool intersect_boxes(const ray& r, double t_min, int start, int count, double& closest, int& index) const;
+
+    double time0, time1;
+};
+
+void compiled_scene::add_rect(int group, double a0, double a1, double b0, double b1, double k, bool flipped,
+    const material* m) {
+    rect_group& g = rects[group];
+    g.a0.push_back(a0);
+    g.a1.push_back(a1);
+    g.b0.push_back(b0);
+    g.b1.push_back(b1);
+    g.k.push_back(k);
+    g.flipped.push_back(flipped);
+    g.mats.push_back(m);
+}
+
+/// <summary>
+/// 展开列表和BVH，认识的图元放进对应的组，其余的放进others
+/// </summary>
+void compiled_scene::gather(const shared_ptr<hittable>& object, bool flipped) {
+    if (auto list = std::dynamic_pointer_cast<hittableList>(object)) {
+        if (flipped)
+            others.push_back(make_shared<flip_face>(object));
+        else
+            for (const auto& child : list->objects)
+                gather(child, false);
+    }
+    else if (auto node = std::dynamic_pointer_cast<bvh_node>(object)) {
+        if (flipped) {
+            others.push_back(make_shared<flip_face>(object));
+            return;
+        }
+        gather(node->left, false);
+        if (node->right != node->left)
+            gather(node->right, false);
+    }
+    else if (auto flip = std::dynamic_pointer_cast<flip_face>(object)) {
+        gather(flip->ptr, !flipped);
+    }
+    else if (auto rect = std::dynamic_pointer_cast<xy_rect>(object)) {
+        add_rect(0, rect->x0, rect->x1, rect->y0, rect->y1, rect->k, flipped, rect->mp.get());
+    }
+    else if (auto rect = std::dynamic_pointer_cast<xz_rect>(object)) {
+        add_rect(1, rect->x0, rect->x1, rect->z0, rect->z1, rect->k, flipped, rect->mp.get());
+    }
+    else if (auto rect = std::dynamic_pointer_cast<yz_rect>(object)) {
+        add_rect(2, rect->y0, rect->y1, rect->z0, rect->z1, rect->k, flipped, rect->mp.get());
+    }
+    else if (flipped) {
+        //球和盒子本身不支持翻转，保留原来的包装
+        others.push_back(make_shared<flip_face>(object));
+    }
+    else if (auto ball = std::dynamic_pointer_cast<sphere>(object)) {
+        spheres.push_back(dvec3(ball->getCenter()), ball->getRadius());
+        spheres.mats.push_back(ball->getMaterial().get());
+    }
+    else if (auto cube = std::dynamic_pointer_cast<box>(object)) {
+        boxes.min_x.push_back(cube->box_min.x());
+        boxes.min_y.push_back(cube->box_min.y());
+        boxes.min_z.push_back(cube->box_min.z());
+        boxes.max_x.push_back(cube->box_max.x());
+        boxes.max_y.push_back(cube->box_max.y());
+        boxes.max_z.push_back(cube->box_max.z());
+        boxes.mats.push_back(cube->mp.get());
+    }
+    else {
+        others.push_back(object);
+    }
+}
+
+/// <summary>
+/// 按BVH叶子的顺序重排一种图元的各个数组，order为该类型的图元按叶子顺序排列的原下标
+/// </summary>
+template <typename T>
+void reorder(std::vector<T>& values, const std::vector<uint32_t>& order) {
+    std::vector<T> ordered(values.size());
+    for (size_t i = 0; i < order.size(); i++)
+        ordered[i] = values[order[i]];
+    values.swap(ordered);
+}
+
+compiled_scene::compiled_scene(const hittableList& scene, double t0, double t1)
+    : source(scene), time0(t0), time1(t1) {
+    static const int rect_axes[3][3] = { { 2, 0, 1 }, { 1, 0, 2 }, { 0, 1, 2 } };
+    for (int g = 0; g < 3; g++) {
+        rects[g].axis = rect_axes[g][0];
+        rects[g].a_axis = rect_axes[g][1];
+        rects[g].b_axis = rect_axes[g][2];
+    }
+    for (const auto& object : source.objects)
+        gather(object, false);
+    //不能编译的物体里还可能包着BVH（例如实例和平移旋转下的球团），同样压平，多个物体共享的只压平一次
+    std::unordered_map<const hittable*, shared_ptr<hittable>> flattened;
+    for (auto& other : others)
+        other = flatten_bvh(other, bvh_layout::wide4, flattened);
+
+    std::vector<primitive_build_item> items;
+    auto add_item = [&](compiled_kind kind, size_t index, const vec3& lo, const vec3& hi) {
+        primitive_build_item item = { static_cast<uint32_t>(index), aabb(lo, hi), 0.5 * (lo + hi) };
+        item.kind = static_cast<uint32_t>(kind);
+        items.push_back(item);
+    };
+    for (size_t i = 0; i < spheres.radius.size(); i++) {
+        vec3 center(spheres.center_x[i], spheres.center_y[i], spheres.center_z[i]);
+        vec3 extent(spheres.radius[i], spheres.radius[i], spheres.radius[i]);
+        add_item(compiled_kind::sphere, i, center - extent, center + extent);
+    }
+    for (int g = 0; g < 3; g++) {
+        const rect_group& group = rects[g];
+        for (size_t i = 0; i < group.k.size(); i++) {
+            //与矩形的bounding_box相同，在法线方向上留一点厚度
+            vec3 lo, hi;
+            lo[group.axis] = group.k[i] - 0.0001;
+            hi[group.axis] = group.k[i] + 0.0001;
+            lo[group.a_axis] = group.a0[i];
+            hi[group.a_axis] = group.a1[i];
+            lo[group.b_axis] = group.b0[i];
+            hi[group.b_axis] = group.b1[i];
+            add_item(static_cast<compiled_kind>(static_cast<int>(compiled_kind::rect_xy) + g), i, lo, hi);
+        }
+    }
+    for (size_t i = 0; i < boxes.min_x.size(); i++) {
+        add_item(compiled_kind::box, i, vec3(boxes.min_x[i], boxes.min_y[i], boxes.min_z[i]),
+            vec3(boxes.max_x[i], boxes.max_y[i], boxes.max_z[i]));
+    }
+    for (size_t i = 0; i < others.size(); i++) {
+        aabb other_box;
+        if (!others[i]->bounding_box(time0, time1, other_box))
+            std::cerr << "No bounding box in compiled_scene constructor.\n";
+        add_item(compiled_kind::other, i, other_box.min(), other_box.max());
+    }
+
+    bvh.build(items, leaf_size);
+    bbox = bvh.box;
+    hasbox = !items.empty();
+
+    //按叶子的顺序把每种图元的数据重排成连续的数组
+    std::vector<uint32_t> order[6];
+    for (const auto& item : items)
+        order[item.kind].push_back(item.index);
+    const auto& sphere_order = order[static_cast<int>(compiled_kind::sphere)];
+    //编译的球都是静止的，运动相关的数组全部相同，不需要重排
+    reorder(spheres.center_x, sphere_order);
+    reorder(spheres.center_y, sphere_order);
+    reorder(spheres.center_z, sphere_order);
+    reorder(spheres.radius, sphere_order);
+    reorder(spheres.mats, sphere_order);
+    for (int g = 0; g < 3; g++) {
+        const auto& rect_order = order[static_cast<int>(compiled_kind::rect_xy) + g];
+        reorder(rects[g].k, rect_order);
+        reorder(rects[g].a0, rect_order);
+        reorder(rects[g].a1, rect_order);
+        reorder(rects[g].b0, rect_order);
+        reorder(rects[g].b1, rect_order);
+        reorder(rects[g].flipped, rect_order);
+        reorder(rects[g].mats, rect_order);
+    }
+    const auto& box_order = order[static_cast<int>(compiled_kind::box)];
+    reorder(boxes.min_x, box_order);
+    reorder(boxes.min_y, box_order);
+    reorder(boxes.min_z, box_order);
+    reorder(boxes.max_x, box_order);
+    reorder(boxes.max_y, box_order);
+    reorder(boxes.max_z, box_order);
+    reorder(boxes.mats, box_order);
+    reorder(others, order[static_cast<int>(compiled_kind::other)]);
+}
+
+/// <summary>
+/// 一个叶子中的球：批量求交，与sphere::intersect的结果相同
+/// </summary>
+bool compiled_scene::intersect_spheres(const ray& r, double t_min, int start, int count, double& closest,
+    int& index) const {
+    int hit = intersect_sphere_batch(spheres, start, count, r, t_min, closest);
+    if (hit < 0)
+        return false;
+    index = hit;
+    return true;
+}
+
+/// <summary>
+/// 一个叶子中的矩形：与xy_rect等的intersect相同的计算
+/// </summary>
+bool compiled_scene::intersect_rects(const rect_group& g, const ray& r, double t_min, int start, int count,
+    double& closest, int& index) const {
+    const double ok = r.origin()[g.axis], dk = r.direction()[g.axis];
+    const double oa = r.origin()[g.a_axis], da = r.direction()[g.a_axis];
+    const double ob = r.origin()[g.b_axis], db = r.direction()[g.b_axis];
+    bool found = false;
+    for (int i = start; i < start + count; i++) {
+        const double t = (g.k[i] - ok) / dk;
+        if (t < t_min || t > closest)
+            continue;
+        const double a = oa + t * da;
+        const double b = ob + t * db;
+        if (a < g.a0[i] || a > g.a1[i] || b < g.b0[i] || b > g.b1[i])
+            continue;
+        closest = t;
+        index = i;
+        found = true;
+    }
+    return found;
+}
+
+/// <summary>
+/// 一个叶子中的盒子：与box::intersect相同的slab求交，index中同时记录击中的面
+/// </summary>
+bool compiled_scene::intersect_boxes(const ray& r, double t_min, int start, int count, double& closest,
+    int& index) const {
+    const double inv_d[3] = { 1.0 / r.direction().x(), 1.0 / r.direction().y(), 1.0 / r.direction().z() };
+    const int side[3] = { inv_d[0] < 0, inv_d[1] < 0, inv_d[2] < 0 };
+    const double* lo[3] = { boxes.min_x.data(), boxes.min_y.data(), boxes.min_z.data() };
+    const double* hi[3] = { boxes.max_x.data(), boxes.max_y.data(), boxes.max_z.data() };
+    bool found = false;
+    for (int i = start; i < start + count; i++) {
+        double t_near = -infinity, t_far = infinity;
+        int near_face = 0, far_face = 0;
+        for (int a = 0; a < 3; a++) {
+            double ta = (lo[a][i] - r.origin()[a]) * inv_d[a];
+            double tb = (hi[a][i] - r.origin()[a]) * inv_d[a];
+            if (side[a])
+                std::swap(ta, tb);
+            if (ta > t_near) {
+                t_near = ta;
+                near_face = a * 2 + side[a];
+            }
+            if (tb < t_far) {
+                t_far = tb;
+                far_face = a * 2 + 1 - side[a];
+            }
+        }
+        if (t_near > t_far)
+            continue;
+        if (t_near >= t_min && t_near <= closest) {
+            closest = t_near;
+            index = i * 8 + near_face;
+            found = true;
+        }
+        else if (t_far >= t_min && t_far <= closest) {
+            closest = t_far;
+            index = i * 8 + far_face;
+            found = true;
+        }
+    }
+    return found;
+}
+
+bool compiled_scene::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    if (!intersect(r, t_min, t_max, rec))
+        return false;
+    finalize_hit(r, rec);
+    return true;
+}
+
+/// <summary>
+/// 遍历BVH，按叶子的类型调用对应的循环；不能编译的物体击中时自己写rec
+/// </summary>
+bool compiled_scene::intersect(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    double closest = t_max;
+    int kind = -1, index = 0;
+    bvh.traverse(r, t_min, closest, [&](int leaf_kind, int start, int count, double& t) {
+        bool found = false;
+        switch (static_cast<compiled_kind>(leaf_kind)) {
+        case compiled_kind::sphere:
+            found = intersect_spheres(r, t_min, start, count, t, index);
+            break;
+        case compiled_kind::rect_xy:
+        case compiled_kind::rect_xz:
+        case compiled_kind::rect_yz:
+            found = intersect_rects(rects[leaf_kind - static_cast<int>(compiled_kind::rect_xy)], r, t_min, start, count, t, index);
+            break;
+        case compiled_kind::box:
+            found = intersect_boxes(r, t_min, start, count, t, index);
+            break;
+        case compiled_kind::other:
+            for (int i = start; i < start + count; i++) {
+                if (others[i]->intersect(r, t_min, t, rec)) {
+                    t = rec.t;
+                    found = true;
+                }
+            }
+            break;
+        }
+        if (found)
+            kind = leaf_kind;
+        return found;
+    });
+
+    if (kind < 0)
+        return false;
+    if (kind != static_cast<int>(compiled_kind::other)) {
+        rec.t = closest;
+        rec.prim_id = index * 8 + kind;
+        rec.prim = this;
+    }
+    return true;
+}
+
+/// <summary>
+/// 与对应的sphere、矩形（包括flip_face）和box的finalize相同
+/// </summary>
+void compiled_scene::finalize(const ray& r, hit_record& rec) const {
+    const int kind = rec.prim_id & 7;
+    const int index = rec.prim_id >> 3;
+    rec.p = r.at(rec.t);
+    if (kind == static_cast<int>(compiled_kind::sphere)) {
+        const vec3 center(spheres.center_x[index], spheres.center_y[index], spheres.center_z[index]);
+        vec3 outward_normal = (rec.p - center) / spheres.radius[index];
+        rec.set_face_normal(r, outward_normal);
+        get_sphere_uv(outward_normal, rec.u, rec.v);
+        rec.mat_ptr = spheres.mats[index];
+        rec.p_error = static_cast<real>(ray_offset_scale_double * (max_abs(center) + spheres.radius[index]));
+    }
+    else if (kind == static_cast<int>(compiled_kind::box)) {
+        const int i = index >> 3, face = index & 7;
+        const vec3 lo(boxes.min_x[i], boxes.min_y[i], boxes.min_z[i]);
+        const vec3 hi(boxes.max_x[i], boxes.max_y[i], boxes.max_z[i]);
+        const int axis = face / 2;
+        const int u_axis = axis == 0 ? 1 : 0;
+        const int v_axis = axis == 2 ? 1 : 2;
+        rec.u = (rec.p[u_axis] - lo[u_axis]) / (hi[u_axis] - lo[u_axis]);
+        rec.v = (rec.p[v_axis] - lo[v_axis]) / (hi[v_axis] - lo[v_axis]);
+        vec3 outward_normal(0, 0, 0);
+        outward_normal[axis] = face & 1 ? 1 : -1;
+        rec.set_face_normal(r, outward_normal);
+        rec.mat_ptr = boxes.mats[i];
+    }
+    else {
+        const rect_group& g = rects[kind - static_cast<int>(compiled_kind::rect_xy)];
+        rec.u = (rec.p[g.a_axis] - g.a0[index]) / (g.a1[index] - g.a0[index]);
+        rec.v = (rec.p[g.b_axis] - g.b0[index]) / (g.b1[index] - g.b0[index]);
+        vec3 outward_normal(0, 0, 0);
+        outward_normal[g.axis] = 1;
+        rec.set_face_normal(r, outward_normal);
+        if (g.flipped[index])
+            rec.front_face = !rec.front_face;
+        rec.mat_ptr = g.mats[index];
+    }
+    rec.prim = nullptr;
+}
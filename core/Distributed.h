@@ -0,0 +1,437 @@
+﻿#pragma once
+//分布式渲染：协调进程把一帧图像切成若干任务（一块像素 x 一段采样序号），通过TCP发给工作进程，
+//工作进程用同样的场景函数渲染后送回浮点采样和，协调进程把结果累加到胶片上，按采样数加权平均。
+//每个采样的随机序列只由 (种子, 像素, 采样序号) 决定，所以图像与哪个工作进程算了哪一块无关；
+//工作进程断开（崩溃、被杀）时它手上的任务重新排队，超时的任务会再发给别的工作进程，先回来的结果有效。
+//只支持POSIX套接字，Windows上这些函数直接返回失败
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Renderer.h"
+#include "Film.h"
+
+struct distributed_settings {
+    int port = 7420;            //协调进程监听的端口，0表示由系统分配
+    int job_size = 32;          //每个任务的像素块边长
+    int samples_per_job = 0;    //每个任务的采样数，0表示一个任务包含像素的全部采样
+    double job_timeout = 0;     //任务发出后超过这么多秒还没有结果就再发给别的工作进程，0表示只在断开时重发
+    uint64_t scene = 0;         //场景的指纹(见scene_fingerprint)，协调进程和工作进程必须相同
+    uint64_t camera = 0;        //相机的指纹(见camera::fingerprint)
+};
+
+//一个任务：像素块[x0,x1) x [y0,y1)的第s0到s1-1个采样
+struct render_job {
+    int32_t id;
+    int32_t x0, y0, x1, y1;
+    int32_t s0, s1;
+};
+
+/// <summary>
+/// 把一帧图像切成任务，先按采样段、再按像素块排列，这样前面的任务完成后整幅图像都有了一些采样
+/// </summary>
+std::vector<render_job> make_render_jobs(const render_settings& settings, const distributed_settings& options) {
+    std::vector<render_job> jobs;
+    const int samples = options.samples_per_job > 0 ? options.samples_per_job : settings.samples_per_pixel;
+    for (int s0 = 0; s0 < settings.samples_per_pixel; s0 += samples) {
+        for (const auto& tile : make_tiles(settings.image_width, settings.image_height, options.job_size)) {
+            render_job job{ static_cast<int32_t>(jobs.size()), tile.x0, tile.y0, tile.x1, tile.y1,
+                s0, std::min(s0 + samples, settings.samples_per_pixel) };
+            jobs.push_back(job);
+        }
+    }
+    return jobs;
+}
+
+/// <summary>
+/// 在工作进程中渲染一个任务，像素块再切成小块交给线程池。
+/// 输出按行存储块内每个像素的RGB采样和；任务包含全部采样时结果与render()逐位相同
+/// </summary>
+template <typename Radiance>
+void render_job_pixels(const render_settings& settings, const camera& cam, Radiance& radiance, const render_job& job,
+    thread_pool& pool, std::vector<float>& out) {
+    const int width = settings.image_width;
+    const int height = settings.image_height;
+    const int job_width = job.x1 - job.x0;
+    out.assign(size_t(job_width) * (job.y1 - job.y0) * 3, 0.0f);
+
+    std::vector<thread_pool::task> tasks;
+    for (const auto& t : make_tiles(job_width, job.y1 - job.y0, settings.tile_size)) {
+        render_tile tile{ job.x0 + t.x0, job.y0 + t.y0, job.x0 + t.x1, job.y0 + t.y1 };
+        tasks.push_back([&, tile](int) {
+            for (int j = tile.y0; j < tile.y1; ++j) {
+                for (int i = tile.x0; i < tile.x1; ++i) {
+                    vec3 color(0, 0, 0);
+                    for (int s = job.s0; s < job.s1; ++s) {
+                        seed_sampler(settings.seed, size_t(j) * width + i, s);
+                        auto u = double(i + random_double()) / width;
+                        auto v = double(j + random_double()) / height;
+                        color += radiance(cam.get_ray(u, v));
+                    }
+                    float* pixel = &out[(size_t(j - job.y0) * job_width + (i - job.x0)) * 3];
+                    pixel[0] = static_cast<float>(color.x());
+                    pixel[1] = static_cast<float>(color.y());
+                    pixel[2] = static_cast<float>(color.z());
+                }
+            }
+        });
+    }
+    pool.run(tasks);
+}
+
+//握手消息：两端的分辨率、采样数、种子、反弹次数、相机和场景必须一致，否则拼起来的图像混合了两种渲染
+struct render_handshake {
+    char magic[4] = { 'R', 'T', 'D', 'W' };
+    uint32_t version = 2;
+    int32_t width = 0, height = 0, samples_per_pixel = 0;
+    uint32_t seed = 0;
+    int32_t max_depth = 0, roulette_depth = 0;
+    uint64_t camera = 0;
+    uint64_t scene = 0;
+
+    render_handshake() {}
+    render_handshake(const render_settings& settings, const distributed_settings& options)
+        : width(settings.image_width), height(settings.image_height), samples_per_pixel(settings.samples_per_pixel),
+        seed(settings.seed), max_depth(settings.max_depth), roulette_depth(settings.roulette_depth),
+        camera(options.camera), scene(options.scene) {}
+
+    bool operator==(const render_handshake& other) const {
+        return memcmp(magic, other.magic, 4) == 0 && version == other.version && width == other.width
+            && height == other.height && samples_per_pixel == other.samples_per_pixel && seed == other.seed
+            && max_depth == other.max_depth && roulette_depth == other.roulette_depth && camera == other.camera
+            && scene == other.scene;
+    }
+};
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <deque>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+//每条消息是4字节类型、4字节长度加上数据，都是小端
+enum class net_message : uint32_t { hello = 1, request = 2, job = 3, result = 4, done = 5 };
+
+inline bool send_all(int fd, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+inline bool recv_all(int fd, void* data, size_t size) {
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+inline bool send_message(int fd, net_message type, const void* data, size_t size) {
+    uint32_t head[2] = { static_cast<uint32_t>(type), static_cast<uint32_t>(size) };
+    return send_all(fd, head, sizeof(head)) && (size == 0 || send_all(fd, data, size));
+}
+
+/// <summary>
+/// 读一条消息，超过max_size的消息视为出错（对方不是本程序或者数据已经乱了）
+/// </summary>
+inline bool recv_message(int fd, net_message& type, std::vector<char>& payload, size_t max_size) {
+    uint32_t head[2];
+    if (!recv_all(fd, head, sizeof(head)) || head[1] > max_size)
+        return false;
+    type = static_cast<net_message>(head[0]);
+    payload.resize(head[1]);
+    return head[1] == 0 || recv_all(fd, payload.data(), payload.size());
+}
+
+/// <summary>
+/// 协调进程：监听端口，把任务分给连上来的工作进程，所有任务完成后通知工作进程退出。
+/// 渲染结果累加到image上，每个像素的采样数等于完成的任务的采样数之和
+/// </summary>
+bool run_coordinator(const render_settings& settings, const distributed_settings& options, film& image) {
+    std::signal(SIGPIPE, SIG_IGN);
+    image.resize(settings.image_width, settings.image_height);
+    const auto jobs = make_render_jobs(settings, options);
+    const render_handshake expected(settings, options);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(static_cast<uint16_t>(options.port));
+    socklen_t address_size = sizeof(address);
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+        || listen(listener, 64) != 0 || getsockname(listener, reinterpret_cast<sockaddr*>(&address), &address_size) != 0) {
+        std::cerr << "run_coordinator: cannot listen on port " << options.port << ": " << strerror(errno) << "\n";
+        if (listener >= 0)
+            close(listener);
+        return false;
+    }
+    std::cerr << "Coordinator listening on port " << ntohs(address.sin_port) << ", " << jobs.size() << " jobs\n";
+
+    struct worker_connection {
+        int fd;
+        bool greeted = false;
+        bool waiting = false;   //没有可发的任务时先挂起，等有任务重新排队或者全部完成
+        int job = -1;           //正在渲染的任务
+        bool reissued = false;  //这个任务已经因为超时发给了别人
+        std::chrono::steady_clock::time_point job_start{};
+    };
+    std::vector<worker_connection> workers;
+    std::deque<int> pending;
+    for (const auto& job : jobs)
+        pending.push_back(job.id);
+    std::vector<uint8_t> finished(jobs.size(), 0);
+    size_t finished_count = 0;
+    int reassigned = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    auto send_job = [&](worker_connection& w) {
+        while (!pending.empty() && finished[pending.front()])
+            pending.pop_front();
+        if (pending.empty()) {
+            w.waiting = true;
+            return true;
+        }
+        w.job = pending.front();
+        pending.pop_front();
+        w.waiting = false;
+        w.reissued = false;
+        w.job_start = std::chrono::steady_clock::now();
+        return send_message(w.fd, net_message::job, &jobs[w.job], sizeof(render_job));
+    };
+    auto drop = [&](size_t k) {
+        worker_connection& w = workers[k];
+        if (w.job >= 0 && !finished[w.job]) {
+            pending.push_front(w.job);
+            reassigned++;
+        }
+        close(w.fd);
+        workers.erase(workers.begin() + k);
+    };
+
+    std::vector<char> payload;
+    while (finished_count < jobs.size()) {
+        std::vector<pollfd> fds = { { listener, POLLIN, 0 } };
+        for (const auto& w : workers)
+            fds.push_back({ w.fd, POLLIN, 0 });
+        if (poll(fds.data(), fds.size(), 500) < 0 && errno != EINTR) {
+            std::cerr << "run_coordinator: poll failed: " << strerror(errno) << "\n";
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd >= 0) {
+                //工作进程在发消息的中途卡住时不要让协调进程一直等下去
+                timeval timeout{ 30, 0 };
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                int no_delay = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+                workers.push_back(worker_connection{ fd });
+            }
+        }
+
+        //倒序处理，断开的连接可以直接删除
+        for (size_t k = fds.size() - 1; k >= 1; k--) {
+            if (!(fds[k].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            const size_t index = k - 1;
+            worker_connection& w = workers[index];
+            net_message type;
+            if (!recv_message(w.fd, type, payload, size_t(options.job_size) * options.job_size * 3 * sizeof(float) + sizeof(int32_t))) {
+                drop(index);
+                continue;
+            }
+            bool ok = true;
+            if (type == net_message::hello) {
+                render_handshake hello;
+                if (payload.size() == sizeof(hello))
+                    memcpy(&hello, payload.data(), sizeof(hello));
+                w.greeted = payload.size() == sizeof(hello) && hello == expected;
+                if (w.greeted) {
+                    ok = send_message(w.fd, net_message::hello, &expected, sizeof(expected));
+                }
+                else {
+                    std::cerr << "\nrun_coordinator: worker with different settings or scene rejected\n";
+                    send_message(w.fd, net_message::done, nullptr, 0);
+                    ok = false;
+                }
+            }
+            else if (type == net_message::request && w.greeted) {
+                ok = send_job(w);
+            }
+            else if (type == net_message::result && w.greeted && w.job >= 0) {
+                const render_job& job = jobs[w.job];
+                const size_t values = size_t(job.x1 - job.x0) * (job.y1 - job.y0) * 3;
+                int32_t id = -1;
+                //先确认长度再读任务编号，空的结果消息不能读到上一条消息留下的内容
+                ok = payload.size() == sizeof(id) + values * sizeof(float);
+                if (ok)
+                    memcpy(&id, payload.data(), sizeof(id));
+                ok = ok && id == job.id;
+                //超时重发的任务可能有两份结果，只用先到的一份
+                if (ok && !finished[job.id]) {
+                    const float* data = reinterpret_cast<const float*>(payload.data() + sizeof(id));
+                    for (int j = job.y0; j < job.y1; j++) {
+                        for (int i = job.x0; i < job.x1; i++) {
+                            const size_t index = size_t(j) * image.width + i;
+                            const float* pixel = data + (size_t(j - job.y0) * (job.x1 - job.x0) + (i - job.x0)) * 3;
+                            for (int a = 0; a < 3; a++)
+                                image.accum[index * 3 + a] += pixel[a];
+                            image.sample_counts[index] += job.s1 - job.s0;
+                        }
+                    }
+                    finished[job.id] = 1;
+                    finished_count++;
+                }
+                //结果有问题时保留任务编号，断开连接时把任务重新排队
+                if (ok)
+                    w.job = -1;
+            }
+            else {
+                ok = false;
+            }
+            if (!ok)
+                drop(index);
+        }
+
+        //超时的任务再发一份，原来的工作进程继续算，谁先算完用谁的
+        if (options.job_timeout > 0) {
+            auto now = std::chrono::steady_clock::now();
+            for (auto& w : workers) {
+                if (w.job >= 0 && !w.reissued && !finished[w.job]
+                    && std::chrono::duration<double>(now - w.job_start).count() > options.job_timeout) {
+                    pending.push_back(w.job);
+                    w.reissued = true;
+                    reassigned++;
+                }
+            }
+        }
+        //有任务重新排队时先发给挂起的工作进程
+        for (size_t k = workers.size(); k-- > 0;)
+            if (workers[k].waiting && !pending.empty() && !send_job(workers[k]))
+                drop(k);
+
+        std::cerr << "\rJobs remaining: " << jobs.size() - finished_count << ", workers " << workers.size() << "    " << std::flush;
+    }
+
+    for (auto& w : workers) {
+        send_message(w.fd, net_message::done, nullptr, 0);
+        close(w.fd);
+    }
+    close(listener);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << "\nDistributed render time: " << seconds << "s, " << jobs.size() << " jobs, " << reassigned << " reassigned\n";
+    return finished_count == jobs.size();
+}
+
+/// <summary>
+/// 工作进程：连接协调进程，反复领取任务、渲染、送回结果，直到协调进程说全部完成
+/// </summary>
+/// <param name="radiance">计算一条光线颜色的函数，形如 vec3(const ray&amp;)</param>
+/// <param name="host">协调进程的地址</param>
+template <typename Radiance>
+bool run_worker(const render_settings& settings, const distributed_settings& options, const camera& cam, Radiance radiance,
+    const std::string& host) {
+    std::signal(SIGPIPE, SIG_IGN);
+    addrinfo hints{}, * found = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    const std::string port = std::to_string(options.port);
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0) {
+        std::cerr << "run_worker: cannot resolve " << host << "\n";
+        return false;
+    }
+    int fd = -1;
+    for (addrinfo* a = found; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    if (fd < 0) {
+        std::cerr << "run_worker: cannot connect to " << host << ":" << port << "\n";
+        return false;
+    }
+    int no_delay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+    const render_handshake hello(settings, options);
+    thread_pool pool(settings.threads);
+    std::vector<float> pixels;
+    std::vector<char> payload;
+    int rendered = 0;
+    //协调进程原样回复握手消息表示接受，设置或场景不同时直接回复done
+    net_message type;
+    bool ok = send_message(fd, net_message::hello, &hello, sizeof(hello))
+        && recv_message(fd, type, payload, sizeof(hello));
+    if (ok && type != net_message::hello) {
+        std::cerr << "run_worker: rejected by the coordinator, check the scene, camera, resolution, samples, depth and seed\n";
+        close(fd);
+        return false;
+    }
+    while (ok) {
+        if (!send_message(fd, net_message::request, nullptr, 0) || !recv_message(fd, type, payload, sizeof(render_job))) {
+            ok = false;
+            break;
+        }
+        if (type == net_message::done)
+            break;
+        render_job job;
+        if (type != net_message::job || payload.size() != sizeof(job)) {
+            ok = false;
+            break;
+        }
+        memcpy(&job, payload.data(), sizeof(job));
+        render_job_pixels(settings, cam, radiance, job, pool, pixels);
+        payload.resize(sizeof(job.id) + pixels.size() * sizeof(float));
+        memcpy(payload.data(), &job.id, sizeof(job.id));
+        memcpy(payload.data() + sizeof(job.id), pixels.data(), pixels.size() * sizeof(float));
+        ok = send_message(fd, net_message::result, payload.data(), payload.size());
+        rendered++;
+        std::cerr << "\rJobs rendered: " << rendered << " " << std::flush;
+    }
+    close(fd);
+    std::cerr << "\n";
+    if (!ok)
+        std::cerr << "run_worker: lost connection to the coordinator\n";
+    return ok;
+}
+#else
+bool run_coordinator(const render_settings&, const distributed_settings&, film&) {
+    std::cerr << "run_coordinator: distributed rendering needs POSIX sockets\n";
+    return false;
+}
+
+template <typename Radiance>
+bool run_worker(const render_settings&, const distributed_settings&, const camera&, Radiance, const std::string&) {
+    std::cerr << "run_worker: distributed rendering needs POSIX sockets\n";
+    return false;
+}
+#endif
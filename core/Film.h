@@ -0,0 +1,221 @@
+﻿#pragma once
+//胶片：每个像素的浮点RGB采样和以及采样数，渲染器只往里累加，输出时才除以采样数。
+//多遍、多线程或多台机器的结果可以直接相加合并，既能写线性HDR图像(PFM/EXR)，也能做伽马校正后输出8位图像
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "utils.h"
+
+class film {
+public:
+    film() {}
+    film(int w, int h) { resize(w, h); }
+
+    /// <summary>
+    /// 改变分辨率并清空所有采样
+    /// </summary>
+    void resize(int w, int h) {
+        width = w;
+        height = h;
+        accum.assign(size_t(w) * h * 3, 0.0f);
+        sample_counts.assign(size_t(w) * h, 0);
+    }
+
+    size_t pixel_count() const { return size_t(width) * height; }
+
+    /// <summary>
+    /// 往一个像素上累加若干个采样的颜色和
+    /// </summary>
+    /// <param name="j">第j行，对应v方向，0是图像底部</param>
+    void add(int i, int j, const vec3& color_sum, int samples = 1) {
+        const size_t index = size_t(j) * width + i;
+        float* pixel = &accum[index * 3];
+        pixel[0] += static_cast<float>(color_sum.x());
+        pixel[1] += static_cast<float>(color_sum.y());
+        pixel[2] += static_cast<float>(color_sum.z());
+        sample_counts[index] += samples;
+    }
+
+    /// <summary>
+    /// 固定采样数的渲染只写accum，之后用它设置所有像素的采样数
+    /// </summary>
+    void set_sample_count(int samples) {
+        sample_counts.assign(pixel_count(), samples);
+    }
+
+    /// <summary>
+    /// 把另一张同样大小的胶片的采样加进来，两者的随机序列应该互不重叠(不同的种子或采样序号)
+    /// </summary>
+    bool merge(const film& other) {
+        if (other.width != width || other.height != height) {
+            std::cerr << "film::merge: size mismatch " << other.width << "x" << other.height << " vs "
+                << width << "x" << height << "\n";
+            return false;
+        }
+        for (size_t k = 0; k < accum.size(); k++)
+            accum[k] += other.accum[k];
+        for (size_t k = 0; k < sample_counts.size(); k++)
+            sample_counts[k] += other.sample_counts[k];
+        return true;
+    }
+
+    /// <summary>
+    /// 像素的线性颜色（采样平均值），没有采样的像素为黑色
+    /// </summary>
+    vec3 pixel(int i, int j) const {
+        const size_t index = size_t(j) * width + i;
+        const int n = sample_counts[index];
+        if (n == 0)
+            return vec3(0, 0, 0);
+        const float* p = &accum[index * 3];
+        const double scale = 1.0 / n;
+        return vec3(scale * p[0], scale * p[1], scale * p[2]);
+    }
+
+    /// <summary>
+    /// 色调映射成8位BGR图像：假设gamma=2，开根号后截断到[0,1)。图像第0行是顶部
+    /// </summary>
+    cv::Mat tonemap() const {
+        cv::Mat image(height, width, CV_8UC3, cv::Scalar(0, 0, 0));
+        for (int j = 0; j < height; ++j) {
+            for (int i = 0; i < width; ++i) {
+                vec3 c = pixel(i, j);
+                image.at<cv::Vec3b>(height - 1 - j, i) = cv::Vec3b(display_byte(c.z()), display_byte(c.y()), display_byte(c.x()));
+            }
+        }
+        return image;
+    }
+
+    static unsigned char display_byte(double linear) {
+        return static_cast<unsigned char>(256 * clamp(sqrt(std::max(linear, 0.0)), 0.0, 0.999));
+    }
+
+    /// <summary>
+    /// 写线性HDR的PFM文件。PFM从底部一行开始存储，正好与accum的行顺序相同；比例因子为负表示小端
+    /// </summary>
+    bool write_pfm(const std::string& filename) const {
+        std::ofstream out(filename, std::ios::binary);
+        if (!out) {
+            std::cerr << "write_pfm: cannot open " << filename << "\n";
+            return false;
+        }
+        out << "PF\n" << width << " " << height << "\n-1.0\n";
+        std::vector<float> row(size_t(width) * 3);
+        for (int j = 0; j < height; ++j) {
+            for (int i = 0; i < width; ++i) {
+                vec3 c = pixel(i, j);
+                for (int a = 0; a < 3; a++)
+                    row[size_t(i) * 3 + a] = static_cast<float>(c[a]);
+            }
+            out.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+        }
+        return bool(out);
+    }
+
+    /// <summary>
+    /// 写线性HDR的OpenEXR文件：单部分、扫描线、不压缩、32位浮点的B,G,R三个通道（EXR要求通道按名称排序），
+    /// 每块一行，从顶部一行开始
+    /// </summary>
+    bool write_exr(const std::string& filename) const {
+        std::ofstream out(filename, std::ios::binary);
+        if (!out) {
+            std::cerr << "write_exr: cannot open " << filename << "\n";
+            return false;
+        }
+        std::vector<char> header;
+        put<int32_t>(header, 20000630); //魔数
+        put<int32_t>(header, 2);        //版本2，单部分扫描线文件
+
+        std::vector<char> channels;
+        for (const char* name : { "B", "G", "R" }) {
+            channels.insert(channels.end(), name, name + 2);
+            put<int32_t>(channels, 2);  //FLOAT
+            put<int32_t>(channels, 0);  //pLinear和保留字节
+            put<int32_t>(channels, 1);  //xSampling
+            put<int32_t>(channels, 1);  //ySampling
+        }
+        channels.push_back(0);
+        put_attribute(header, "channels", "chlist", channels);
+        put_attribute(header, "compression", "compression", std::vector<char>(1, 0));
+        std::vector<char> window;
+        for (int32_t v : { 0, 0, width - 1, height - 1 })
+            put<int32_t>(window, v);
+        put_attribute(header, "dataWindow", "box2i", window);
+        put_attribute(header, "displayWindow", "box2i", window);
+        put_attribute(header, "lineOrder", "lineOrder", std::vector<char>(1, 0));
+        std::vector<char> value;
+        put<float>(value, 1.0f);
+        put_attribute(header, "pixelAspectRatio", "float", value);
+        value.clear();
+        put<float>(value, 0.0f);
+        put<float>(value, 0.0f);
+        put_attribute(header, "screenWindowCenter", "v2f", value);
+        value.clear();
+        put<float>(value, 1.0f);
+        put_attribute(header, "screenWindowWidth", "float", value);
+        header.push_back(0);
+
+        //扫描线偏移表：每行一块，块头是行号和数据字节数
+        const uint64_t block_bytes = 8 + uint64_t(width) * 3 * sizeof(float);
+        uint64_t offset = header.size() + uint64_t(height) * 8;
+        for (int y = 0; y < height; y++) {
+            put<uint64_t>(header, offset);
+            offset += block_bytes;
+        }
+        out.write(header.data(), header.size());
+
+        std::vector<char> block;
+        for (int y = 0; y < height; y++) {
+            const int j = height - 1 - y;
+            block.clear();
+            put<int32_t>(block, y);
+            put<int32_t>(block, static_cast<int32_t>(block_bytes - 8));
+            for (int channel = 2; channel >= 0; channel--)
+                for (int i = 0; i < width; i++)
+                    put<float>(block, static_cast<float>(pixel(i, j)[channel]));
+            out.write(block.data(), block.size());
+        }
+        return bool(out);
+    }
+
+    /// <summary>
+    /// 按扩展名选择输出格式：.pfm和.exr写线性HDR，其他扩展名交给OpenCV写色调映射后的8位图像
+    /// </summary>
+    bool write(const std::string& filename) const {
+        auto ends_with = [&](const char* suffix) {
+            size_t n = strlen(suffix);
+            return filename.size() >= n && filename.compare(filename.size() - n, n, suffix) == 0;
+        };
+        if (ends_with(".pfm"))
+            return write_pfm(filename);
+        if (ends_with(".exr"))
+            return write_exr(filename);
+        return cv::imwrite(filename, tonemap());
+    }
+
+public:
+    int width = 0, height = 0;
+    //按行存储每个像素的RGB采样和，第j行对应v方向的第j个像素，格式与render()的输出相同
+    std::vector<float> accum;
+    std::vector<int> sample_counts;
+
+private:
+    //文件格式都是小端，本机也是小端
+    template <typename T>
+    static void put(std::vector<char>& bytes, T value) {
+        char raw[sizeof(T)];
+        memcpy(raw, &value, sizeof(T));
+        bytes.insert(bytes.end(), raw, raw + sizeof(T));
+    }
+
+    static void put_attribute(std::vector<char>& header, const char* name, const char* type, const std::vector<char>& value) {
+        header.insert(header.end(), name, name + strlen(name) + 1);
+        header.insert(header.end(), type, type + strlen(type) + 1);
+        put<int32_t>(header, static_cast<int32_t>(value.size()));
+        header.insert(header.end(), value.begin(), value.end());
+    }
+};
@@ -1,17 +1,29 @@
 ﻿#pragma once
 #include "Ray.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
 class material;
+class hittable;
 struct hit_record {
     vec3 p;
     vec3 normal;
     //光线会如何与表面交互是由具体的材质所决定的。hit_record在设计上就是为了把一堆要传的参数给打包在了一起。当光线射入一个表面(比如一个球体), hit_record中的材质指针会被球体的材质指针所赋值, 而球体的材质指针是在main()函数中构造时传入的。当color()函数获取到hit_record时, 他可以找到这个材质的指针, 然后由材质的函数来决定光线是否发生散射, 怎么散射。
-    shared_ptr<material> mat_ptr;
-    double t;
+    //不持有所有权的裸指针：材质由场景中的物体用shared_ptr持有，场景存在期间一直有效，
+    //求交时只复制指针，不会对引用计数做原子操作
+    const material* mat_ptr;
+    real t;
     //为了添加纹理需要存储击中的uv信息
-    double u;
-    double v;
+    real u;
+    real v;
 
     bool front_face; //是否正面，外部射入
+    //两阶段求交：intersect只确定t和击中的图元，其余字段等最近交点确定后由prim->finalize填写；
+    //为空表示所有字段都已经填好
+    const hittable* prim = nullptr;
+    int prim_id = -1;     //图元内部的编号，三角网格中为三角形的下标
+    const hittable* local_prim = nullptr; //prim为实例时，实例的物体空间中击中的图元，为空表示物体空间中的字段已经填好
+    real p_error = 0; //交点坐标中与图元自身尺度有关的误差（例如球心很远的大球），由finalize填写，见spawn_ray
     /// <summary>
     /// 判断光线是从外部射入还是内部射入，永远让法相与入射方向相反, 我们就不用去用点乘来判断射入面是内侧还是外侧了, 但相对的, 我们需要用一个变量储存射入面的信息
     /// </summary>
@@ -24,6 +36,33 @@ struct hit_record {
 
 
 };
+//次级光线的起点已经移到表面外侧（见spawn_ray），求交下限不再需要固定的epsilon（原来的0.001）
+const double ray_t_min = 0;
+
+//坐标的浮点误差相对于坐标大小的上限，包括求交、实例变换和p = o + t*d的舍入
+const double ray_offset_scale = 64 * std::numeric_limits<real>::epsilon();
+//总是用double完成的计算（例如球的二次方程）的误差比例
+const double ray_offset_scale_double = 64 * std::numeric_limits<double>::epsilon();
+
+inline double max_abs(const vec3& v) {
+    return std::max(std::fabs(v.x()), std::max(std::fabs(v.y()), std::fabs(v.z())));
+}
+
+/// <summary>
+/// 从交点rec出发沿direction的次级光线：起点沿法线移到direction所在的一侧，移动的距离超过交点坐标的误差范围，
+/// 新光线不会再击中出发的表面。交点由r_in的起点加t倍方向得到，误差与交点和r_in起点坐标的大小成正比，
+/// 再加上图元自己记录的rec.p_error
+/// </summary>
+inline ray spawn_ray(const ray& r_in, const hit_record& rec, const vec3& direction) {
+    const vec3& n = rec.normal;
+    //把误差盒子整个推到切平面外需要沿法线移动 error * (|nx| + |ny| + |nz|)
+    double error = ray_offset_scale * (max_abs(rec.p) + max_abs(r_in.origin())) + rec.p_error;
+    double offset = error * (std::fabs(n.x()) + std::fabs(n.y()) + std::fabs(n.z()));
+    if (dot(direction, n) < 0)
+        offset = -offset;
+    return ray(rec.p + offset * n, direction, r_in.time());
+}
+
 /// <summary>
 /// 任何可能与光线相交的物体都继承这个基类
 /// 加入一个区间tmin,tmax来判断相交是否有效
@@ -32,9 +71,47 @@ struct hit_record {
 class hittable {
 public:
     virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
+
+    /// <summary>
+    /// 遍历阶段的廉价求交：只需要写入rec.t和rec.prim，交点、法线、uv和材质推迟到finalize中计算。
+    /// 默认直接调用hit求出完整的交点信息，平移旋转这类需要变换光线的包装物体使用默认实现
+    /// </summary>
+    virtual bool intersect(const ray& r, double t_min, double t_max, hit_record& rec) const {
+        if (!hit(r, t_min, t_max, rec))
+            return false;
+        rec.prim = nullptr;
+        return true;
+    }
+    /// <summary>
+    /// 对intersect选出的最近交点填写其余字段，r必须是传给intersect的同一条光线
+    /// </summary>
+    virtual void finalize(const ray& r, hit_record& rec) const {}
     virtual bool bounding_box(double t0, double t1, aabb& output_box) const = 0;
+
+    /// <summary>
+    /// 光源采样用：从点o沿方向v能看到这个物体时，该方向关于立体角的概率密度，不能作为光源的物体返回0
+    /// </summary>
+    virtual double pdf_value(const vec3& o, const vec3& v) const {
+        return 0.0;
+    }
+    /// <summary>
+    /// 光源采样用：从点o出发随机生成一个指向物体表面的方向（不需要是单位向量）
+    /// </summary>
+    virtual vec3 random(const vec3& o) const {
+        return vec3(1, 0, 0);
+    }
 };
 
+/// <summary>
+/// intersect之后调用：如果最近交点的字段还没有填写，交给击中的图元填写
+/// </summary>
+inline void finalize_hit(const ray& r, hit_record& rec) {
+    if (rec.prim) {
+        rec.p_error = 0;
+        rec.prim->finalize(r, rec);
+    }
+}
+
 class flip_face : public hittable {
 public:
     flip_face(shared_ptr<hittable> p) : ptr(p) {}
@@ -47,10 +124,38 @@ public:
         return true;
     }
 
+    //包装的是图元时推迟到finalize中一起翻转，否则立即填好交点信息再翻转
+    virtual bool intersect(const ray& r, double t_min, double t_max, hit_record& rec) const {
+        if (!ptr->intersect(r, t_min, t_max, rec))
+            return false;
+
+        if (rec.prim == ptr.get()) {
+            rec.prim = this;
+            return true;
+        }
+        finalize_hit(r, rec);
+        rec.front_face = !rec.front_face;
+        rec.prim = nullptr;
+        return true;
+    }
+
+    virtual void finalize(const ray& r, hit_record& rec) const {
+        ptr->finalize(r, rec);
+        rec.front_face = !rec.front_face;
+    }
+
     virtual bool bounding_box(double t0, double t1, aabb& output_box) const {
         return ptr->bounding_box(t0, t1, output_box);
     }
 
+    virtual double pdf_value(const vec3& o, const vec3& v) const {
+        return ptr->pdf_value(o, v);
+    }
+
+    virtual vec3 random(const vec3& o) const {
+        return ptr->random(o);
+    }
+
 public:
     shared_ptr<hittable> ptr;
 };
\ No newline at end of file
@@ -18,7 +18,10 @@ public:
     void add(shared_ptr<hittable> object) { objects.push_back(object); }
 
     virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const;
+    virtual bool intersect(const ray& r, double tmin, double tmax, hit_record& rec) const;
     virtual bool bounding_box(double t0, double t1, aabb& output_box) const;
+    virtual double pdf_value(const vec3& o, const vec3& v) const;
+    virtual vec3 random(const vec3& o) const;
     auto getObjects() {
         return this->objects;
     }
@@ -26,7 +29,7 @@ public:
     std::vector<shared_ptr<hittable>> objects;
 };
 /// <summary>
-/// 寻找最近的交点，记录相交信息
+/// 寻找最近的交点，记录相交信息：先用intersect找出最近的图元，再只对它计算交点信息
 /// </summary>
 /// <param name="r">ray</param>
 /// <param name="t_min">tmin</param>
@@ -34,15 +37,21 @@ public:
 /// <param name="rec">hit_record结构体</param>
 /// <returns>是否有交点</returns>
 bool hittableList::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    hit_record temp_rec;
+    if (!intersect(r, t_min, t_max, rec))
+        return false;
+    finalize_hit(r, rec);
+    return true;
+}
+
+bool hittableList::intersect(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    //物体只在击中更近的交点时才写rec，所以直接写入rec，不再经过临时记录复制
     bool hit_anything = false;
     auto closest_so_far = t_max;
 
     for (const auto& object : objects) {
-        if (object->hit(r, t_min, closest_so_far, temp_rec)) {
+        if (object->intersect(r, t_min, closest_so_far, rec)) {
             hit_anything = true;
-            closest_so_far = temp_rec.t;
-            rec = temp_rec;
+            closest_so_far = rec.t;
         }
     }
 
@@ -63,4 +72,22 @@ bool hittableList::bounding_box(double t0, double t1, aabb& output_box) const {
     }
 
     return true;
-}
\ No newline at end of file
+}
+
+/// <summary>
+/// 作为光源列表使用时，等概率地选择其中一个物体采样，概率密度是各个物体的平均
+/// </summary>
+double hittableList::pdf_value(const vec3& o, const vec3& v) const {
+    if (objects.empty()) return 0.0;
+
+    auto weight = 1.0 / objects.size();
+    auto sum = 0.0;
+    for (const auto& object : objects)
+        sum += weight * object->pdf_value(o, v);
+    return sum;
+}
+
+vec3 hittableList::random(const vec3& o) const {
+    auto index = random_int(0, static_cast<int>(objects.size()));
+    return objects[index]->random(o);
+}
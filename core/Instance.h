@@ -0,0 +1,7 @@
+﻿#pragma once
+//实例：同一份几何体（底层BVH，BLAS）配上一个仿射变换放进场景，多个实例共享几何体，内存只与不同几何体的数量有关。
+//场景中所有实例再用bvh_node组成顶层BVH（TLAS），flatten_bvh压平时共享的底层BVH只会压平一次。
+//实例就是一个transform节点，ptr指向共享的几何体
+#include "transform.h"
+
+using instance = transform;
@@ -0,0 +1,301 @@
+﻿#pragma once
+//JSON：场景文件使用的JSON解析器。只接受标准JSON，对象的成员保持文件中的顺序，
+//每个值记录所在的行号，场景文件写错时能指出是哪一行
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+struct json_value {
+    enum class kind { null, boolean, number, string, array, object };
+
+    kind type = kind::null;
+    bool boolean = false;
+    double number = 0;
+    std::string text;               //字符串的内容
+    std::vector<std::string> keys;  //对象成员的名字，与items一一对应
+    std::vector<json_value> items;  //数组的元素或对象成员的值
+    int line = 0;
+
+    bool is_number() const { return type == kind::number; }
+    bool is_string() const { return type == kind::string; }
+    bool is_array() const { return type == kind::array; }
+    bool is_object() const { return type == kind::object; }
+
+    /// <summary>
+    /// 对象中名为key的成员，没有时返回nullptr
+    /// </summary>
+    const json_value* find(const std::string& key) const {
+        for (size_t i = 0; i < keys.size(); i++)
+            if (keys[i] == key)
+                return &items[i];
+        return nullptr;
+    }
+
+    const char* type_name() const {
+        static const char* names[] = { "null", "boolean", "number", "string", "array", "object" };
+        return names[static_cast<int>(type)];
+    }
+};
+
+class json_parser {
+public:
+    json_parser(const char* text, size_t size) : s(text), end(text + size) {}
+
+    /// <summary>
+    /// 解析整个文本，出错时error为"line N: 原因"
+    /// </summary>
+    bool parse(json_value& value, std::string& error) {
+        skip_space();
+        if (!parse_value(value, 0)) {
+            error = "line " + std::to_string(line) + ": " + message;
+            return false;
+        }
+        skip_space();
+        if (s != end) {
+            error = "line " + std::to_string(line) + ": unexpected text after the end of the document";
+            return false;
+        }
+        return true;
+    }
+
+private:
+    //嵌套太深的文件直接拒绝，不让递归耗尽栈
+    static const int max_depth = 256;
+
+    bool fail(const char* reason) {
+        message = reason;
+        return false;
+    }
+
+    void skip_space() {
+        while (s < end && (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n')) {
+            if (*s == '\n')
+                line++;
+            s++;
+        }
+    }
+
+    bool literal(const char* word) {
+        const char* p = s;
+        for (; *word; word++, p++)
+            if (p >= end || *p != *word)
+                return false;
+        s = p;
+        return true;
+    }
+
+    bool parse_value(json_value& value, int depth) {
+        if (depth > max_depth)
+            return fail("nesting too deep");
+        if (s >= end)
+            return fail("unexpected end of file");
+        value.line = line;
+        switch (*s) {
+        case '{':
+            return parse_object(value, depth);
+        case '[':
+            return parse_array(value, depth);
+        case '"':
+            value.type = json_value::kind::string;
+            return parse_string(value.text);
+        case 't':
+        case 'f':
+            value.type = json_value::kind::boolean;
+            value.boolean = *s == 't';
+            return literal(value.boolean ? "true" : "false") || fail("invalid literal");
+        case 'n':
+            value.type = json_value::kind::null;
+            return literal("null") || fail("invalid literal");
+        default:
+            return parse_number(value);
+        }
+    }
+
+    bool parse_object(json_value& value, int depth) {
+        value.type = json_value::kind::object;
+        s++;
+        skip_space();
+        if (s < end && *s == '}') {
+            s++;
+            return true;
+        }
+        while (true) {
+            skip_space();
+            if (s >= end || *s != '"')
+                return fail("expected a member name");
+            std::string key;
+            if (!parse_string(key))
+                return false;
+            skip_space();
+            if (s >= end || *s != ':')
+                return fail("expected ':' after the member name");
+            s++;
+            skip_space();
+            value.keys.push_back(key);
+            value.items.emplace_back();
+            if (!parse_value(value.items.back(), depth + 1))
+                return false;
+            skip_space();
+            if (s < end && *s == ',') {
+                s++;
+                continue;
+            }
+            if (s < end && *s == '}') {
+                s++;
+                return true;
+            }
+            return fail("expected ',' or '}' in object");
+        }
+    }
+
+    bool parse_array(json_value& value, int depth) {
+        value.type = json_value::kind::array;
+        s++;
+        skip_space();
+        if (s < end && *s == ']') {
+            s++;
+            return true;
+        }
+        while (true) {
+            skip_space();
+            value.items.emplace_back();
+            if (!parse_value(value.items.back(), depth + 1))
+                return false;
+            skip_space();
+            if (s < end && *s == ',') {
+                s++;
+                continue;
+            }
+            if (s < end && *s == ']') {
+                s++;
+                return true;
+            }
+            return fail("expected ',' or ']' in array");
+        }
+    }
+
+    bool parse_number(json_value& value) {
+        //strtod还接受inf、nan和十六进制，先按JSON的语法检查
+        const char* p = s;
+        if (p < end && *p == '-')
+            p++;
+        if (p >= end || *p < '0' || *p > '9')
+            return fail("invalid value");
+        while (p < end && ((*p >= '0' && *p <= '9') || *p == '.' || *p == 'e' || *p == 'E' || *p == '+' || *p == '-'))
+            p++;
+        const std::string digits(s, p);
+        char* parsed = nullptr;
+        value.type = json_value::kind::number;
+        value.number = strtod(digits.c_str(), &parsed);
+        if (parsed != digits.c_str() + digits.size())
+            return fail("invalid number");
+        s = p;
+        return true;
+    }
+
+    static int hex_digit(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    bool parse_code_unit(uint32_t& unit) {
+        if (end - s < 4)
+            return fail("invalid \\u escape");
+        unit = 0;
+        for (int i = 0; i < 4; i++) {
+            int digit = hex_digit(*s++);
+            if (digit < 0)
+                return fail("invalid \\u escape");
+            unit = unit * 16 + digit;
+        }
+        return true;
+    }
+
+    static void append_utf8(std::string& out, uint32_t code) {
+        if (code < 0x80) {
+            out += static_cast<char>(code);
+        }
+        else if (code < 0x800) {
+            out += static_cast<char>(0xc0 | (code >> 6));
+            out += static_cast<char>(0x80 | (code & 0x3f));
+        }
+        else if (code < 0x10000) {
+            out += static_cast<char>(0xe0 | (code >> 12));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (code & 0x3f));
+        }
+        else {
+            out += static_cast<char>(0xf0 | (code >> 18));
+            out += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (code & 0x3f));
+        }
+    }
+
+    bool parse_string(std::string& out) {
+        s++;
+        while (true) {
+            if (s >= end)
+                return fail("unterminated string");
+            const char c = *s++;
+            if (c == '"')
+                return true;
+            if (static_cast<unsigned char>(c) < 0x20)
+                return fail("control character in string");
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (s >= end)
+                return fail("unterminated string");
+            const char escape = *s++;
+            switch (escape) {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                uint32_t code;
+                if (!parse_code_unit(code))
+                    return false;
+                //UTF-16代理对
+                if (code >= 0xd800 && code < 0xdc00) {
+                    uint32_t low;
+                    if (end - s < 2 || s[0] != '\\' || s[1] != 'u')
+                        return fail("unpaired surrogate in \\u escape");
+                    s += 2;
+                    if (!parse_code_unit(low))
+                        return false;
+                    if (low < 0xdc00 || low >= 0xe000)
+                        return fail("unpaired surrogate in \\u escape");
+                    code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                }
+                append_utf8(out, code);
+                break;
+            }
+            default:
+                return fail("invalid escape in string");
+            }
+        }
+    }
+
+    const char* s;
+    const char* end;
+    int line = 1;
+    const char* message = "";
+};
+
+/// <summary>
+/// 解析JSON文本，出错时返回false，error中是行号和原因
+/// </summary>
+inline bool parse_json(const std::string& text, json_value& value, std::string& error) {
+    json_parser parser(text.data(), text.size());
+    return parser.parse(value, error);
+}
@@ -0,0 +1,101 @@
+﻿#pragma once
+//光源采样(next event estimation)：在每个非镜面交点直接朝光源采样一个方向，
+//再和材质采样击中光源的情况用多重重要性采样(MIS)的幂启发式组合，小光源不再只能靠反弹碰运气击中
+#include "HittableList.h"
+#include "Material.h"
+#include "Sphere.h"
+#include "xyz_rect.h"
+#include "BVH.h"
+
+/// <summary>
+/// 材质是否为发光材质
+/// </summary>
+inline bool is_light_material(const shared_ptr<material>& m) {
+    return dynamic_cast<const diffuse_light*>(m.get()) != nullptr;
+}
+
+/// <summary>
+/// 递归地在列表、翻转面和BVH中寻找使用发光材质的矩形和球，加入光源列表
+/// 平移旋转过的物体不会被当作光源，它们仍然可以被反弹光线击中
+/// </summary>
+void collect_lights(const shared_ptr<hittable>& object, hittableList& lights) {
+    if (auto list = dynamic_cast<const hittableList*>(object.get())) {
+        for (const auto& child : list->objects)
+            collect_lights(child, lights);
+    }
+    else if (auto node = dynamic_cast<const bvh_node*>(object.get())) {
+        collect_lights(node->left, lights);
+        if (node->right != node->left)
+            collect_lights(node->right, lights);
+    }
+    else if (auto flipped = dynamic_cast<const flip_face*>(object.get())) {
+        collect_lights(flipped->ptr, lights);
+    }
+    else if (auto rect = dynamic_cast<const xy_rect*>(object.get())) {
+        if (is_light_material(rect->mp)) lights.add(object);
+    }
+    else if (auto rect = dynamic_cast<const xz_rect*>(object.get())) {
+        if (is_light_material(rect->mp)) lights.add(object);
+    }
+    else if (auto rect = dynamic_cast<const yz_rect*>(object.get())) {
+        if (is_light_material(rect->mp)) lights.add(object);
+    }
+    else if (auto ball = dynamic_cast<const sphere*>(object.get())) {
+        if (is_light_material(ball->getMaterial())) lights.add(object);
+    }
+}
+
+/// <summary>
+/// 场景构建完成、压平BVH之前调用，返回场景中所有可以直接采样的光源
+/// </summary>
+hittableList collect_lights(const hittableList& world) {
+    hittableList lights;
+    for (const auto& object : world.objects)
+        collect_lights(object, lights);
+    return lights;
+}
+
+/// <summary>
+/// 幂启发式(beta=2)：用概率密度为pdf的策略得到的样本的MIS权重
+/// </summary>
+inline double power_heuristic(double pdf, double other_pdf) {
+    auto a = pdf * pdf;
+    auto b = other_pdf * other_pdf;
+    return a + b > 0 ? a / (a + b) : 0;
+}
+
+/// <summary>
+/// 材质采样的光线r击中发光物体时，自发光的MIS权重
+/// </summary>
+/// <param name="scattering_pdf">上一个交点材质生成r方向的概率密度，0表示主光线或镜面反射，此时权重为1</param>
+double emission_weight(const hittableList& lights, const ray& r, double scattering_pdf) {
+    if (scattering_pdf <= 0)
+        return 1;
+    return power_heuristic(scattering_pdf, lights.pdf_value(r.origin(), r.direction()));
+}
+
+/// <summary>
+/// 在交点rec处朝光源采样一个方向，返回该方向带来的直接光照（已乘MIS权重，未乘路径的衰减率）
+/// 光源采样的方向用普通的最近交点求交判断遮挡，被其它物体挡住时取挡住它的物体的自发光
+/// </summary>
+/// <param name="attenuation">材质scatter得到的衰减率，对朗伯和各向同性材质与方向无关</param>
+vec3 sample_lights(const hittable& world, const hittableList& lights, const ray& r_in, const hit_record& rec,
+    const vec3& attenuation, double t_min) {
+    if (lights.objects.empty())
+        return vec3(0, 0, 0);
+
+    ray to_light = spawn_ray(r_in, rec, lights.random(rec.p));
+    auto light_pdf = lights.pdf_value(to_light.origin(), to_light.direction());
+    if (light_pdf <= 0)
+        return vec3(0, 0, 0);
+    auto scattering_pdf = rec.mat_ptr->scattering_pdf(r_in, rec, to_light);
+    if (scattering_pdf <= 0)
+        return vec3(0, 0, 0);
+
+    hit_record light_rec;
+    if (!world.hit(to_light, t_min, infinity, light_rec))
+        return vec3(0, 0, 0);
+    vec3 emitted = light_rec.mat_ptr->emitted(light_rec.u, light_rec.v, light_rec.p);
+    //材质的 f*cos 等于 attenuation*scattering_pdf
+    return attenuation * emitted * (scattering_pdf / light_pdf * power_heuristic(light_pdf, scattering_pdf));
+}
@@ -0,0 +1,388 @@
+﻿#pragma once
+//线性BVH：场景构建完成后把bvh_node树压平成一块连续的32字节对齐的节点数组，
+//遍历时用栈迭代代替递归，按光线方向先访问近处的子节点，只有到了叶子才调用图元的虚函数
+#include "BVH.h"
+#include "WideBVH.h"
+#include "transform.h"
+#include "volume.h"
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct alignas(32) linear_bvh_node {
+    float bounds_min[3];
+    float bounds_max[3];
+    int32_t offset;   //叶子：第一个图元的下标；内部节点：第二个子节点的下标，第一个子节点紧跟在自己后面
+    uint16_t count;   //叶子中图元的数量，0表示内部节点
+    uint8_t axis;     //内部节点两个子节点分开最明显的轴，用来决定先访问哪个子节点
+    uint8_t pad;
+};
+
+class linear_bvh : public hittable {
+public:
+    linear_bvh(shared_ptr<bvh_node> root, double time0 = 0, double time1 = 1);
+
+    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const;
+    virtual bool intersect(const ray& r, double t_min, double t_max, hit_record& rec) const;
+    virtual bool bounding_box(double t0, double t1, aabb& output_box) const {
+        output_box = box;
+        return true;
+    }
+
+public:
+    std::vector<linear_bvh_node> nodes;
+    std::vector<const hittable*> primitives; //不持有所有权，图元的生命周期由root和subtrees保证
+    std::vector<shared_ptr<linear_bvh>> subtrees; //超过遍历栈深度的子树单独压平，作为叶子中的图元
+    shared_ptr<bvh_node> root;
+    aabb box;
+    int depth = 0;
+
+    //遍历栈的大小，压平后的深度不会超过这个值
+    static const int max_depth = bvh_max_depth;
+
+private:
+    int flatten(const hittable* object, const aabb& object_box, int level);
+    int add_leaf(const aabb& leaf_box, const hittable* a, const hittable* b);
+
+    double time0, time1;
+};
+
+/// <summary>
+/// 把double的包围盒保守地转成float：最小值向下取整，最大值向上取整，保证不会漏掉交点
+/// </summary>
+inline void store_bounds(linear_bvh_node& node, const aabb& b) {
+    for (int a = 0; a < 3; a++) {
+        float lo = static_cast<float>(b.min()[a]);
+        float hi = static_cast<float>(b.max()[a]);
+        if (lo > b.min()[a]) lo = std::nextafter(lo, -std::numeric_limits<float>::infinity());
+        if (hi < b.max()[a]) hi = std::nextafter(hi, std::numeric_limits<float>::infinity());
+        node.bounds_min[a] = lo;
+        node.bounds_max[a] = hi;
+    }
+}
+
+linear_bvh::linear_bvh(shared_ptr<bvh_node> tree, double t0, double t1)
+    : root(tree), box(tree->box), time0(t0), time1(t1) {
+    flatten(root.get(), root->box, 1);
+}
+
+int linear_bvh::add_leaf(const aabb& leaf_box, const hittable* a, const hittable* b) {
+    int index = static_cast<int>(nodes.size());
+    nodes.push_back(linear_bvh_node());
+    store_bounds(nodes[index], leaf_box);
+    nodes[index].offset = static_cast<int32_t>(primitives.size());
+    nodes[index].count = a == b ? 1 : 2;
+    nodes[index].axis = 0;
+    primitives.push_back(a);
+    if (a != b)
+        primitives.push_back(b);
+    return index;
+}
+
+/// <summary>
+/// 深度优先地压平一棵子树，返回子树根节点在数组中的下标
+/// </summary>
+int linear_bvh::flatten(const hittable* object, const aabb& object_box, int level) {
+    depth = std::max(depth, level);
+    auto node = dynamic_cast<const bvh_node*>(object);
+    if (!node)
+        return add_leaf(object_box, object, object);
+    //只包含一个物体的节点，该物体本身又是一棵BVH时直接展开，避免同一棵子树被压平两次
+    if (node->left == node->right && dynamic_cast<const bvh_node*>(node->left.get()))
+        return flatten(node->left.get(), object_box, level);
+
+    auto left = dynamic_cast<const bvh_node*>(node->left.get());
+    auto right = dynamic_cast<const bvh_node*>(node->right.get());
+    //两个子节点都是图元时作为叶子
+    if (!left && !right)
+        return add_leaf(node->box, node->left.get(), node->right.get());
+    //单棵bvh_node的深度在构建时已经限制住了，但叶子中嵌套的bvh_node也会展开到同一个数组里，深度会叠加。
+    //到了栈的深度上限时剩下的子树单独压平，和root共享所有权
+    if (level == max_depth) {
+        subtrees.push_back(make_shared<linear_bvh>(shared_ptr<bvh_node>(root, const_cast<bvh_node*>(node)), time0, time1));
+        return add_leaf(object_box, subtrees.back().get(), subtrees.back().get());
+    }
+
+    aabb left_box, right_box;
+    if (left) left_box = left->box;
+    else node->left->bounding_box(time0, time1, left_box);
+    if (right) right_box = right->box;
+    else node->right->bounding_box(time0, time1, right_box);
+
+    int index = static_cast<int>(nodes.size());
+    nodes.push_back(linear_bvh_node());
+    store_bounds(nodes[index], node->box);
+    nodes[index].count = 0;
+
+    auto separation = right_box.centroid() - left_box.centroid();
+    int axis = 0;
+    for (int a = 1; a < 3; a++)
+        if (fabs(separation[a]) > fabs(separation[axis]))
+            axis = a;
+    //交换子节点使得第一个子节点在分离轴的负方向上
+    const hittable* first = node->left.get();
+    const hittable* second = node->right.get();
+    aabb first_box = left_box, second_box = right_box;
+    if (separation[axis] < 0) {
+        std::swap(first, second);
+        std::swap(first_box, second_box);
+    }
+    nodes[index].axis = static_cast<uint8_t>(axis);
+
+    flatten(first, first_box, level + 1);
+    int second_index = flatten(second, second_box, level + 1);
+    nodes[index].offset = second_index;
+    return index;
+}
+
+bool linear_bvh::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    if (!intersect(r, t_min, t_max, rec))
+        return false;
+    finalize_hit(r, rec);
+    return true;
+}
+
+bool linear_bvh::intersect(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    //每条光线只计算一次方向的倒数和符号
+    const vec3 origin = r.origin();
+    const vec3 direction = r.direction();
+    const double inv_dir[3] = { 1.0 / direction.x(), 1.0 / direction.y(), 1.0 / direction.z() };
+    const bool dir_negative[3] = { inv_dir[0] < 0, inv_dir[1] < 0, inv_dir[2] < 0 };
+
+    bool hit_anything = false;
+    double closest_so_far = t_max;
+    int stack[max_depth];
+    int stack_size = 0;
+    int current = 0;
+
+    while (true) {
+        const linear_bvh_node& node = nodes[current];
+        double t0 = t_min;
+        double t1 = closest_so_far;
+        for (int a = 0; a < 3; a++) {
+            double near_plane = dir_negative[a] ? node.bounds_max[a] : node.bounds_min[a];
+            double far_plane = dir_negative[a] ? node.bounds_min[a] : node.bounds_max[a];
+            double tn = (near_plane - origin[a]) * inv_dir[a];
+            double tf = (far_plane - origin[a]) * inv_dir[a];
+            //写成比较的形式，0*inf产生的NaN不会影响结果
+            t0 = tn > t0 ? tn : t0;
+            t1 = tf < t1 ? tf : t1;
+        }
+
+        if (t0 <= t1) {
+            if (node.count > 0) {
+                for (int i = 0; i < node.count; i++) {
+                    if (primitives[node.offset + i]->intersect(r, t_min, closest_so_far, rec)) {
+                        hit_anything = true;
+                        closest_so_far = rec.t;
+                    }
+                }
+            }
+            else {
+                //光线沿分离轴的负方向前进时，第二个子节点离得更近
+                if (dir_negative[node.axis]) {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                }
+                else {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+
+        if (stack_size == 0)
+            break;
+        current = stack[--stack_size];
+    }
+
+    return hit_anything;
+}
+
+//压平后的BVH布局：二叉线性数组，或者4路/8路的宽BVH
+enum class bvh_layout { binary, wide4, wide8 };
+
+shared_ptr<hittable> flatten_bvh(shared_ptr<hittable> object, bvh_layout layout,
+    std::unordered_map<const hittable*, shared_ptr<hittable>>& flattened);
+
+/// <summary>
+/// 压平一棵bvh_node之前先处理它叶子中的图元：实例、变换和体积雾边界里还可能包着别的bvh_node，
+/// 例如顶层BVH下面的实例的底层BVH
+/// </summary>
+void flatten_bvh_leaves(bvh_node& node, bvh_layout layout,
+    std::unordered_map<const hittable*, shared_ptr<hittable>>& flattened) {
+    //只有一个物体的节点左右指向同一个物体
+    const bool single = node.right == node.left;
+    for (auto* child : { &node.left, &node.right }) {
+        if (auto inner = std::dynamic_pointer_cast<bvh_node>(*child))
+            flatten_bvh_leaves(*inner, layout, flattened);
+        else
+            *child = flatten_bvh(*child, layout, flattened);
+        if (single) {
+            node.right = node.left;
+            break;
+        }
+    }
+}
+
+/// <summary>
+/// 场景构建完成后调用：把物体中所有的bvh_node替换成压平后的BVH，
+/// 包括列表里、平移旋转和一般变换（实例）里、体积雾边界里以及另一棵BVH的叶子里的BVH。
+/// 多个实例共享的同一棵BVH只压平一次，压平后仍然共享
+/// </summary>
+shared_ptr<hittable> flatten_bvh(shared_ptr<hittable> object, bvh_layout layout,
+    std::unordered_map<const hittable*, shared_ptr<hittable>>& flattened) {
+    if (auto node = std::dynamic_pointer_cast<bvh_node>(object)) {
+        auto& result = flattened[node.get()];
+        if (!result) {
+            flatten_bvh_leaves(*node, layout, flattened);
+            if (layout == bvh_layout::wide4)
+                result = make_shared<qbvh>(node);
+            else if (layout == bvh_layout::wide8)
+                result = make_shared<obvh>(node);
+            else
+                result = make_shared<linear_bvh>(node);
+        }
+        return result;
+    }
+    if (auto list = std::dynamic_pointer_cast<hittableList>(object)) {
+        for (auto& child : list->objects)
+            child = flatten_bvh(child, layout, flattened);
+    }
+    else if (auto moved = std::dynamic_pointer_cast<translate>(object))
+        moved->ptr = flatten_bvh(moved->ptr, layout, flattened);
+    else if (auto rotated = std::dynamic_pointer_cast<rotate_y>(object))
+        rotated->ptr = flatten_bvh(rotated->ptr, layout, flattened);
+    else if (auto transformed = std::dynamic_pointer_cast<transform>(object))
+        transformed->ptr = flatten_bvh(transformed->ptr, layout, flattened);
+    else if (auto flipped = std::dynamic_pointer_cast<flip_face>(object))
+        flipped->ptr = flatten_bvh(flipped->ptr, layout, flattened);
+    else if (auto medium = std::dynamic_pointer_cast<constant_medium>(object))
+        medium->boundary = flatten_bvh(medium->boundary, layout, flattened);
+    return object;
+}
+
+shared_ptr<hittable> flatten_bvh(shared_ptr<hittable> object, bvh_layout layout = bvh_layout::wide4) {
+    std::unordered_map<const hittable*, shared_ptr<hittable>> flattened;
+    return flatten_bvh(object, layout, flattened);
+}
+
+/// <summary>
+/// 统计物体中还剩多少个没有压平的bvh_node：沿着列表、压平后BVH的图元、变换和体积雾边界往下找，
+/// 共享的几何体只看一次。flatten_bvh之后应该为0，不为0说明有一种包装没有被压平处理到
+/// </summary>
+size_t count_bvh_nodes(const hittable* object, std::unordered_set<const hittable*>& visited) {
+    if (!object || !visited.insert(object).second)
+        return 0;
+    if (auto node = dynamic_cast<const bvh_node*>(object))
+        return 1 + count_bvh_nodes(node->left.get(), visited) + count_bvh_nodes(node->right.get(), visited);
+    size_t count = 0;
+    if (auto list = dynamic_cast<const hittableList*>(object)) {
+        for (const auto& child : list->objects)
+            count += count_bvh_nodes(child.get(), visited);
+    }
+    else if (auto linear = dynamic_cast<const linear_bvh*>(object)) {
+        for (auto primitive : linear->primitives)
+            count += count_bvh_nodes(primitive, visited);
+    }
+    else if (auto wide = dynamic_cast<const qbvh*>(object)) {
+        for (auto primitive : wide->primitives)
+            count += count_bvh_nodes(primitive, visited);
+    }
+    else if (auto wide = dynamic_cast<const obvh*>(object)) {
+        for (auto primitive : wide->primitives)
+            count += count_bvh_nodes(primitive, visited);
+    }
+    else if (auto moved = dynamic_cast<const translate*>(object))
+        count += count_bvh_nodes(moved->ptr.get(), visited);
+    else if (auto rotated = dynamic_cast<const rotate_y*>(object))
+        count += count_bvh_nodes(rotated->ptr.get(), visited);
+    else if (auto transformed = dynamic_cast<const transform*>(object))
+        count += count_bvh_nodes(transformed->ptr.get(), visited);
+    else if (auto flipped = dynamic_cast<const flip_face*>(object))
+        count += count_bvh_nodes(flipped->ptr.get(), visited);
+    else if (auto medium = dynamic_cast<const constant_medium*>(object))
+        count += count_bvh_nodes(medium->boundary.get(), visited);
+    return count;
+}
+
+size_t count_bvh_nodes(const hittable& object) {
+    std::unordered_set<const hittable*> visited;
+    return count_bvh_nodes(&object, visited);
+}
+
+/// <summary>
+/// 场景构建完成后、建BVH之前调用：把translate、rotate_y和transform的嵌套链合并成一个transform，
+/// 每条光线在一串变换中只需要一次虚函数调用、一次光线变换和一次法线变换。
+/// 列表、BVH、翻转和体积雾边界中的变换链原地替换，被多个实例共享的几何体只处理一次
+/// </summary>
+shared_ptr<hittable> collapse_transforms(shared_ptr<hittable> object,
+    std::unordered_map<const hittable*, shared_ptr<hittable>>& collapsed) {
+    auto& done = collapsed[object.get()];
+    if (done)
+        return done;
+
+    affine3 matrix;
+    shared_ptr<hittable> inner;
+    if (auto moved = std::dynamic_pointer_cast<translate>(object)) {
+        matrix = affine3::translation(moved->offset);
+        inner = moved->ptr;
+    }
+    else if (auto rotated = std::dynamic_pointer_cast<rotate_y>(object)) {
+        matrix = affine3::identity();
+        matrix.m[0][0] = rotated->cos_theta;
+        matrix.m[0][2] = rotated->sin_theta;
+        matrix.m[2][0] = -rotated->sin_theta;
+        matrix.m[2][2] = rotated->cos_theta;
+        inner = rotated->ptr;
+    }
+    else if (auto transformed = std::dynamic_pointer_cast<transform>(object)) {
+        matrix = transformed->to_world;
+        inner = transformed->ptr;
+    }
+    else {
+        if (auto list = std::dynamic_pointer_cast<hittableList>(object)) {
+            for (auto& child : list->objects)
+                child = collapse_transforms(child, collapsed);
+        }
+        else if (auto node = std::dynamic_pointer_cast<bvh_node>(object)) {
+            //合并后的包围盒不会比原来的嵌套包围盒大，节点中保存的包围盒仍然有效
+            node->left = collapse_transforms(node->left, collapsed);
+            node->right = collapse_transforms(node->right, collapsed);
+        }
+        else if (auto flipped = std::dynamic_pointer_cast<flip_face>(object))
+            flipped->ptr = collapse_transforms(flipped->ptr, collapsed);
+        else if (auto medium = std::dynamic_pointer_cast<constant_medium>(object))
+            medium->boundary = collapse_transforms(medium->boundary, collapsed);
+        return collapsed[object.get()] = object;
+    }
+
+    inner = collapse_transforms(inner, collapsed);
+    shared_ptr<hittable> result;
+    if (auto nested = std::dynamic_pointer_cast<transform>(inner))
+        result = make_shared<transform>(nested->ptr, matrix * nested->to_world);
+    else if (auto transformed = std::dynamic_pointer_cast<transform>(object)) {
+        transformed->ptr = inner;
+        result = object;
+    }
+    else
+        result = make_shared<transform>(inner, matrix);
+    return collapsed[object.get()] = result;
+}
+
+shared_ptr<hittable> collapse_transforms(shared_ptr<hittable> object) {
+    std::unordered_map<const hittable*, shared_ptr<hittable>> collapsed;
+    return collapse_transforms(object, collapsed);
+}
+
+/// <summary>
+/// 对场景列表中的每个物体合并变换链
+/// </summary>
+void collapse_transforms(hittableList& world) {
+    std::unordered_map<const hittable*, shared_ptr<hittable>> collapsed;
+    for (auto& object : world.objects)
+        object = collapse_transforms(object, collapsed);
+}
@@ -0,0 +1,139 @@
+﻿#pragma once
+//内存映射文件以及可以指向映射内存的只读数组。
+//编译后的场景文件整个映射进内存，网格的顶点、三角形和BVH节点直接使用文件中的数据，读取时只有缺页，没有解析和构建。
+//Windows上没有mmap，退回到把整个文件读进一块对齐的内存
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+class mapped_file {
+public:
+    mapped_file() {}
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    ~mapped_file() {
+#ifndef _WIN32
+        if (bytes)
+            munmap(const_cast<char*>(bytes), length);
+#endif
+    }
+
+    /// <summary>
+    /// 只读地映射整个文件，起始地址按页对齐
+    /// </summary>
+    bool open(const std::string& path) {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "mapped_file: cannot open " << path << "\n";
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            std::cerr << "mapped_file: " << path << " is empty\n";
+            ::close(fd);
+            return false;
+        }
+        void* address = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (address == MAP_FAILED) {
+            std::cerr << "mapped_file: cannot map " << path << "\n";
+            return false;
+        }
+        bytes = static_cast<const char*>(address);
+        length = size_t(info.st_size);
+        return true;
+#else
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in) {
+            std::cerr << "mapped_file: cannot open " << path << "\n";
+            return false;
+        }
+        length = size_t(in.tellg());
+        buffer.resize((length + sizeof(cache_line) - 1) / sizeof(cache_line));
+        in.seekg(0);
+        in.read(reinterpret_cast<char*>(buffer.data()), length);
+        if (!in || length == 0) {
+            std::cerr << "mapped_file: cannot read " << path << "\n";
+            return false;
+        }
+        bytes = reinterpret_cast<const char*>(buffer.data());
+        return true;
+#endif
+    }
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    struct alignas(64) cache_line {
+        char raw[64];
+    };
+    std::vector<cache_line> buffer;
+#endif
+};
+
+/// <summary>
+/// 只读数组：要么自己持有一个vector，要么指向别人的内存（例如映射的文件）并持有它的所有者，
+/// 使用者只通过下标、size()和迭代器访问，不关心数据来自哪里
+/// </summary>
+template <typename T>
+class mapped_array {
+public:
+    mapped_array() {}
+    mapped_array(std::vector<T> values) : owned(std::move(values)), first(owned.data()), count(owned.size()) {}
+    /// <param name="owner">保证data在数组的生命周期内有效</param>
+    mapped_array(const T* data, size_t n, std::shared_ptr<const void> owner)
+        : first(data), count(n), keep_alive(std::move(owner)) {}
+
+    mapped_array(const mapped_array& other) { *this = other; }
+    mapped_array(mapped_array&& other) noexcept { *this = std::move(other); }
+
+    mapped_array& operator=(const mapped_array& other) {
+        owned = other.owned;
+        keep_alive = other.keep_alive;
+        first = keep_alive ? other.first : owned.data();
+        count = other.count;
+        return *this;
+    }
+
+    mapped_array& operator=(mapped_array&& other) noexcept {
+        owned = std::move(other.owned);
+        keep_alive = std::move(other.keep_alive);
+        first = keep_alive ? other.first : owned.data();
+        count = other.count;
+        other.first = nullptr;
+        other.count = 0;
+        return *this;
+    }
+
+    const T& operator[](size_t i) const { return first[i]; }
+    const T* data() const { return first; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T* begin() const { return first; }
+    const T* end() const { return first + count; }
+
+    //数据是否来自映射的文件
+    bool mapped() const { return keep_alive != nullptr; }
+
+private:
+    std::vector<T> owned;
+    const T* first = nullptr;
+    size_t count = 0;
+    std::shared_ptr<const void> keep_alive;
+};
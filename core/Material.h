@@ -11,8 +11,23 @@ public:
     virtual bool scatter(
         const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered
     ) const = 0;
+    /// <summary>
+    /// scatter按什么概率密度（关于立体角）生成scattered方向，光源采样和MIS需要用到。
+    /// 返回0表示镜面一类无法对给定方向求值的材质，这类交点不做光源采样
+    /// </summary>
+    virtual double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const {
+        return 0;
+    }
 };
 
+/// <summary>
+/// 朗伯材质按余弦分布采样反射方向，概率密度为 cos/pi
+/// </summary>
+inline double cosine_pdf(const vec3& normal, const vec3& direction) {
+    auto cosine = dot(normal, unit_vector(direction));
+    return cosine < 0 ? 0 : cosine / pi;
+}
+
 class lambertian:public material{
 public:
     //lambertian(const vec3&a):albedo(a){}
@@ -36,6 +51,9 @@ public:
         attenuation = albedo->value(rec.u, rec.v, rec.p);
         return true;
     }
+    virtual double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const {
+        return cosine_pdf(rec.normal, scattered.direction());
+    }
 public: 
     shared_ptr<texture> albedo;
 //private:
@@ -58,6 +76,9 @@ public:
         attenuation = albedo; //光线的衰减率
         return true;
     }
+    virtual double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const {
+        return cosine_pdf(rec.normal, scattered.direction());
+    }
     private:
         vec3 albedo;
 };
@@ -74,7 +95,7 @@ public:
         const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered
     ) const {
         vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-        scattered = ray(rec.p, reflected+fuzz*random_in_unit_sphere());
+        scattered = ray(rec.p, reflected+fuzz*random_in_unit_sphere(), r_in.time());
         attenuation = albedo;
         return (dot(scattered.direction(), rec.normal) > 0);
     }
@@ -111,18 +132,18 @@ public:
         double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
         if (etai_over_etat * sin_theta > 1.0) {
             vec3 reflected = reflect(unit_direction, rec.normal);
-            scattered = ray(rec.p, reflected);
+            scattered = ray(rec.p, reflected, r_in.time());
             return true;
         }
         double reflect_prob = schlick(cos_theta, etai_over_etat);
         if (random_double() < reflect_prob)
         {
             vec3 reflected = reflect(unit_direction, rec.normal);
-            scattered = ray(rec.p, reflected);
+            scattered = ray(rec.p, reflected, r_in.time());
             return true;
         }
         vec3 refracted = refract(unit_direction, rec.normal, etai_over_etat);
-        scattered = ray(rec.p, refracted);
+        scattered = ray(rec.p, refracted, r_in.time());
         return true;
     }
 
@@ -0,0 +1,231 @@
+﻿#pragma once
+//三角网格：顶点位置、法线和纹理坐标保存在共享的数组中，每个三角形只保存下标，
+//网格内部有自己的BVH（primitive_bvh，分箱SAH构建的linear_bvh_node数组），整个网格在场景中只是一个图元。
+//这些数组也可以直接指向编译后的场景文件映射进来的内存
+//三角形求交使用Woop等人的watertight算法，光线穿过共享的边和顶点时不会漏掉
+#include "PrimitiveBVH.h"
+#include <cstdint>
+#include <vector>
+
+//一个三角形的三个顶点在各个数组中的下标，-1表示没有对应的法线或纹理坐标
+struct mesh_face {
+    uint32_t v[3];
+    int32_t n[3];
+    int32_t t[3];
+};
+
+//共享边的两个三角形算出的边函数必须恰好互为相反数，编译器把cx * by - cy * bx合并成FMA以后就不再对称，
+//-mfma或-march=native下会有光线从缝隙漏出去。GCC不支持STDC FP_CONTRACT，只能给求交函数加属性；
+//MSVC的fp_contract不能只作用于一个函数，关掉以后与VS2022的默认行为相同
+#if defined(__GNUC__) && !defined(__clang__)
+#define RT_NO_FP_CONTRACT __attribute__((optimize("fp-contract=off")))
+#else
+#define RT_NO_FP_CONTRACT
+#endif
+#if defined(_MSC_VER) && !defined(__clang__)
+#pragma fp_contract(off)
+#endif
+
+//Woop算法的光线预计算：把光线方向最大的分量作为z轴，并求出把光线方向变成(0,0,1)的剪切变换
+struct watertight_ray {
+    int kx, ky, kz;
+    double sx, sy, sz;
+
+    watertight_ray(const ray& r) {
+        const vec3 d = r.direction();
+        kz = fabs(d.x()) > fabs(d.y()) ? (fabs(d.x()) > fabs(d.z()) ? 0 : 2) : (fabs(d.y()) > fabs(d.z()) ? 1 : 2);
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+        //保持三角形的环绕方向不变
+        if (d[kz] < 0)
+            std::swap(kx, ky);
+        sx = d[kx] / d[kz];
+        sy = d[ky] / d[kz];
+        sz = 1.0 / d[kz];
+    }
+};
+
+class triangle_mesh : public hittable {
+public:
+    triangle_mesh(std::vector<vec3> positions, std::vector<vec3> normals, std::vector<vec3> uvs,
+        std::vector<mesh_face> faces, shared_ptr<material> m);
+    /// <summary>
+    /// 使用已经构建好的BVH，faces必须已经按BVH叶子的顺序排列，例如编译后的场景文件中保存的网格
+    /// </summary>
+    triangle_mesh(mapped_array<vec3> positions, mapped_array<vec3> normals, mapped_array<vec3> uvs,
+        mapped_array<mesh_face> faces, primitive_bvh bvh, shared_ptr<material> m);
+
+    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const;
+    virtual bool intersect(const ray& r, double t_min, double t_max, hit_record& rec) const;
+    virtual void finalize(const ray& r, hit_record& rec) const;
+    virtual bool bounding_box(double t0, double t1, aabb& output_box) const {
+        output_box = box;
+        return true;
+    }
+
+    size_t triangle_count() const {
+        return faces.size();
+    }
+
+public:
+    mapped_array<vec3> positions;
+    mapped_array<vec3> normals;
+    mapped_array<vec3> uvs;    //只使用x和y分量
+    mapped_array<mesh_face> faces; //构建完成后按BVH叶子的顺序排列
+    primitive_bvh bvh;
+    shared_ptr<material> mat_ptr;
+    aabb box;
+
+    //叶子中最多的三角形数量
+    static const int leaf_size = 4;
+
+private:
+    bool intersect_triangle(const mesh_face& face, const ray& r, const watertight_ray& wr,
+        double t_min, double t_max, double& t, double& b1, double& b2) const;
+};
+
+triangle_mesh::triangle_mesh(std::vector<vec3> positions_, std::vector<vec3> normals_, std::vector<vec3> uvs_,
+    std::vector<mesh_face> faces_, shared_ptr<material> m)
+    : normals(std::move(normals_)), uvs(std::move(uvs_)), mat_ptr(m) {
+    if (faces_.empty()) {
+        positions = std::move(positions_);
+        box = aabb(vec3(0, 0, 0), vec3(0, 0, 0));
+        return;
+    }
+
+    std::vector<primitive_build_item> items(faces_.size());
+    for (size_t i = 0; i < faces_.size(); i++) {
+        const vec3& a = positions_[faces_[i].v[0]];
+        const vec3& b = positions_[faces_[i].v[1]];
+        const vec3& c = positions_[faces_[i].v[2]];
+        vec3 lo(ffmin(a.x(), ffmin(b.x(), c.x())), ffmin(a.y(), ffmin(b.y(), c.y())), ffmin(a.z(), ffmin(b.z(), c.z())));
+        vec3 hi(ffmax(a.x(), ffmax(b.x(), c.x())), ffmax(a.y(), ffmax(b.y(), c.y())), ffmax(a.z(), ffmax(b.z(), c.z())));
+        items[i] = { static_cast<uint32_t>(i), aabb(lo, hi), 0.5 * (lo + hi) };
+    }
+    bvh.build(items, leaf_size);
+    box = bvh.box;
+
+    //按叶子的顺序重排三角形，遍历时每个叶子访问一段连续的内存
+    std::vector<mesh_face> ordered(faces_.size());
+    for (size_t i = 0; i < items.size(); i++)
+        ordered[i] = faces_[items[i].index];
+    positions = std::move(positions_);
+    faces = std::move(ordered);
+}
+
+triangle_mesh::triangle_mesh(mapped_array<vec3> positions_, mapped_array<vec3> normals_, mapped_array<vec3> uvs_,
+    mapped_array<mesh_face> faces_, primitive_bvh bvh_, shared_ptr<material> m)
+    : positions(std::move(positions_)), normals(std::move(normals_)), uvs(std::move(uvs_)),
+    faces(std::move(faces_)), bvh(std::move(bvh_)), mat_ptr(m) {
+    box = faces.empty() ? aabb(vec3(0, 0, 0), vec3(0, 0, 0)) : bvh.box;
+}
+
+/// <summary>
+/// Watertight光线-三角形求交：把顶点变换到光线坐标系后用二维边函数判断，
+/// 相邻三角形在共享边上计算的边函数完全相同，不会出现裂缝
+/// </summary>
+/// <param name="b1">第二个顶点的重心坐标</param>
+/// <param name="b2">第三个顶点的重心坐标</param>
+RT_NO_FP_CONTRACT bool triangle_mesh::intersect_triangle(const mesh_face& face, const ray& r, const watertight_ray& wr,
+    double t_min, double t_max, double& t, double& b1, double& b2) const {
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#endif
+    const vec3 origin = r.origin();
+    const vec3 a = positions[face.v[0]] - origin;
+    const vec3 b = positions[face.v[1]] - origin;
+    const vec3 c = positions[face.v[2]] - origin;
+
+    const double ax = a[wr.kx] - wr.sx * a[wr.kz];
+    const double ay = a[wr.ky] - wr.sy * a[wr.kz];
+    const double bx = b[wr.kx] - wr.sx * b[wr.kz];
+    const double by = b[wr.ky] - wr.sy * b[wr.kz];
+    const double cx = c[wr.kx] - wr.sx * c[wr.kz];
+    const double cy = c[wr.ky] - wr.sy * c[wr.kz];
+
+    const double u = cx * by - cy * bx;
+    const double v = ax * cy - ay * cx;
+    const double w = bx * ay - by * ax;
+    if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+        return false;
+    const double det = u + v + w;
+    if (det == 0)
+        return false;
+
+    const double az = wr.sz * a[wr.kz];
+    const double bz = wr.sz * b[wr.kz];
+    const double cz = wr.sz * c[wr.kz];
+    const double scaled_t = u * az + v * bz + w * cz;
+    const double inv_det = 1.0 / det;
+    t = scaled_t * inv_det;
+    //光线方向没有归一化，t的区间仍然以原始方向为单位
+    if (t <= t_min || t >= t_max)
+        return false;
+    b1 = v * inv_det;
+    b2 = w * inv_det;
+    return true;
+}
+
+bool triangle_mesh::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    if (!intersect(r, t_min, t_max, rec))
+        return false;
+    finalize(r, rec);
+    return true;
+}
+
+bool triangle_mesh::intersect(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    const watertight_ray wr(r);
+    int closest_face = -1;
+    double closest_so_far = t_max, closest_b1 = 0, closest_b2 = 0;
+    bvh.traverse(r, t_min, closest_so_far, [&](int, int start, int count, double& closest) {
+        bool found = false;
+        for (int i = start; i < start + count; i++) {
+            double t, b1, b2;
+            if (intersect_triangle(faces[i], r, wr, t_min, closest, t, b1, b2)) {
+                closest = t;
+                closest_face = i;
+                closest_b1 = b1;
+                closest_b2 = b2;
+                found = true;
+            }
+        }
+        return found;
+    });
+
+    if (closest_face < 0)
+        return false;
+    //重心坐标先借用u，v保存，finalize时换成纹理坐标
+    rec.t = closest_so_far;
+    rec.u = closest_b1;
+    rec.v = closest_b2;
+    rec.prim_id = closest_face;
+    rec.prim = this;
+    return true;
+}
+
+void triangle_mesh::finalize(const ray& r, hit_record& rec) const {
+    const mesh_face& face = faces[rec.prim_id];
+    const double b1 = rec.u, b2 = rec.v, b0 = 1 - b1 - b2;
+    const vec3& p0 = positions[face.v[0]];
+    const vec3& p1 = positions[face.v[1]];
+    const vec3& p2 = positions[face.v[2]];
+
+    rec.p = b0 * p0 + b1 * p1 + b2 * p2;
+    //有顶点法线时使用插值的法线，否则使用按顶点环绕方向得到的几何法线
+    vec3 normal = face.n[0] >= 0 && face.n[1] >= 0 && face.n[2] >= 0
+        ? b0 * normals[face.n[0]] + b1 * normals[face.n[1]] + b2 * normals[face.n[2]]
+        : cross(p1 - p0, p2 - p0);
+    rec.set_face_normal(r, unit_vector(normal));
+
+    if (face.t[0] >= 0 && face.t[1] >= 0 && face.t[2] >= 0) {
+        vec3 uv = b0 * uvs[face.t[0]] + b1 * uvs[face.t[1]] + b2 * uvs[face.t[2]];
+        rec.u = uv.x();
+        rec.v = uv.y();
+    }
+    else {
+        rec.u = b1;
+        rec.v = b2;
+    }
+    rec.mat_ptr = mat_ptr.get();
+    rec.prim = nullptr;
+}
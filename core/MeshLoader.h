@@ -0,0 +1,341 @@
+﻿#pragma once
+//网格文件读取：OBJ和PLY(ascii/二进制)，逐行或逐条记录流式读取，
+//顶点和三角形直接追加到triangle_mesh的数组中，不为每个三角形分配对象；多边形按扇形拆成三角形
+#include "Mesh.h"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// 解析OBJ面中的一个顶点"v"、"v/vt"、"v//vn"或"v/vt/vn"，下标转成从0开始，负数表示相对于当前数组末尾；
+/// 没有给出的vt、vn下标为-1。缺少位置下标或者任何一个下标超出已读到的数组时返回nullptr
+/// </summary>
+inline const char* parse_obj_vertex(const char* s, size_t positions, size_t uvs, size_t normals, int32_t index[3]) {
+    const size_t counts[3] = { positions, uvs, normals };
+    index[0] = index[1] = index[2] = -1;
+    for (int k = 0; k < 3; k++) {
+        char* end;
+        long value = strtol(s, &end, 10);
+        if (end != s) {
+            long resolved = value < 0 ? static_cast<long>(counts[k]) + value : value - 1;
+            if (resolved < 0 || resolved >= static_cast<long>(counts[k]))
+                return nullptr;
+            index[k] = static_cast<int32_t>(resolved);
+        }
+        else if (k == 0)
+            return nullptr;
+        s = end;
+        if (*s != '/')
+            break;
+        s++;
+    }
+    return s;
+}
+
+/// <summary>
+/// 读取OBJ文件中的v、vt、vn和f，其余内容（材质库、分组等）忽略
+/// </summary>
+shared_ptr<triangle_mesh> load_obj(const std::string& filename, shared_ptr<material> m) {
+    std::ifstream file(filename);
+    if (!file) {
+        std::cerr << "load_obj: cannot open " << filename << "\n";
+        return nullptr;
+    }
+
+    std::vector<vec3> positions, normals, uvs;
+    std::vector<mesh_face> faces;
+    std::vector<int32_t> polygon; //当前多边形每个顶点的 位置/纹理/法线 下标
+    std::string line;
+    while (std::getline(file, line)) {
+        const char* s = line.c_str();
+        while (*s == ' ' || *s == '\t') s++;
+        if (s[0] == 'v' && (s[1] == ' ' || s[1] == '\t')) {
+            char* end;
+            double x = strtod(s + 2, &end);
+            double y = strtod(end, &end);
+            double z = strtod(end, &end);
+            positions.push_back(vec3(x, y, z));
+        }
+        else if (s[0] == 'v' && s[1] == 'n') {
+            char* end;
+            double x = strtod(s + 3, &end);
+            double y = strtod(end, &end);
+            double z = strtod(end, &end);
+            normals.push_back(vec3(x, y, z));
+        }
+        else if (s[0] == 'v' && s[1] == 't') {
+            char* end;
+            double u = strtod(s + 3, &end);
+            double v = strtod(end, &end);
+            uvs.push_back(vec3(u, v, 0));
+        }
+        else if (s[0] == 'f' && (s[1] == ' ' || s[1] == '\t')) {
+            polygon.clear();
+            s += 2;
+            while (true) {
+                while (*s == ' ' || *s == '\t' || *s == '\r') s++;
+                if (*s == '\0')
+                    break;
+                int32_t index[3];
+                const char* next = parse_obj_vertex(s, positions.size(), uvs.size(), normals.size(), index);
+                if (!next) {
+                    std::cerr << "load_obj: bad face in " << filename << ": " << line << "\n";
+                    polygon.clear();
+                    break;
+                }
+                polygon.insert(polygon.end(), index, index + 3);
+                s = next;
+                while (*s && *s != ' ' && *s != '\t') s++;
+            }
+            for (size_t k = 2; k < polygon.size() / 3; k++) {
+                mesh_face face;
+                const size_t corners[3] = { 0, k - 1, k };
+                for (int c = 0; c < 3; c++) {
+                    face.v[c] = static_cast<uint32_t>(polygon[corners[c] * 3]);
+                    face.t[c] = polygon[corners[c] * 3 + 1];
+                    face.n[c] = polygon[corners[c] * 3 + 2];
+                }
+                faces.push_back(face);
+            }
+        }
+    }
+
+    return make_shared<triangle_mesh>(std::move(positions), std::move(normals), std::move(uvs), std::move(faces), m);
+}
+
+//PLY属性的数据类型
+enum class ply_type { int8, uint8, int16, uint16, int32, uint32, float32, float64, invalid };
+
+inline ply_type parse_ply_type(const std::string& name) {
+    if (name == "char" || name == "int8") return ply_type::int8;
+    if (name == "uchar" || name == "uint8") return ply_type::uint8;
+    if (name == "short" || name == "int16") return ply_type::int16;
+    if (name == "ushort" || name == "uint16") return ply_type::uint16;
+    if (name == "int" || name == "int32") return ply_type::int32;
+    if (name == "uint" || name == "uint32") return ply_type::uint32;
+    if (name == "float" || name == "float32") return ply_type::float32;
+    if (name == "double" || name == "float64") return ply_type::float64;
+    return ply_type::invalid;
+}
+
+struct ply_property {
+    std::string name;
+    ply_type type;
+    ply_type count_type; //列表属性中元素个数的类型，不是列表时为invalid
+};
+
+struct ply_element {
+    std::string name;
+    size_t count;
+    std::vector<ply_property> properties;
+};
+
+/// <summary>
+/// 按PLY的存储格式读取一个值
+/// </summary>
+class ply_reader {
+public:
+    ply_reader(std::istream& in, bool ascii, bool big_endian) : in(in), ascii(ascii), big_endian(big_endian) {}
+
+    double read(ply_type type) {
+        if (ascii) {
+            double value = 0;
+            in >> value;
+            return value;
+        }
+        switch (type) {
+        case ply_type::int8: return read_binary<int8_t>();
+        case ply_type::uint8: return read_binary<uint8_t>();
+        case ply_type::int16: return read_binary<int16_t>();
+        case ply_type::uint16: return read_binary<uint16_t>();
+        case ply_type::int32: return read_binary<int32_t>();
+        case ply_type::uint32: return read_binary<uint32_t>();
+        case ply_type::float32: return read_binary<float>();
+        case ply_type::float64: return read_binary<double>();
+        default: return 0;
+        }
+    }
+
+    bool good() const {
+        return static_cast<bool>(in);
+    }
+
+private:
+    template <typename T>
+    T read_binary() {
+        char bytes[sizeof(T)];
+        in.read(bytes, sizeof(T));
+        //文件的字节序与本机(小端)不同时翻转
+        if (big_endian)
+            for (size_t i = 0; i < sizeof(T) / 2; i++)
+                std::swap(bytes[i], bytes[sizeof(T) - 1 - i]);
+        T value;
+        memcpy(&value, bytes, sizeof(T));
+        return value;
+    }
+
+    std::istream& in;
+    bool ascii;
+    bool big_endian;
+};
+
+/// <summary>
+/// 读取PLY文件的vertex元素（x/y/z，可选nx/ny/nz和u/v或s/t）和face元素（vertex_indices列表），其余元素跳过
+/// </summary>
+shared_ptr<triangle_mesh> load_ply(const std::string& filename, shared_ptr<material> m) {
+    std::ifstream file(filename, std::ios::binary);
+    std::string line;
+    if (!file || !std::getline(file, line) || line.compare(0, 3, "ply") != 0) {
+        std::cerr << "load_ply: cannot open " << filename << "\n";
+        return nullptr;
+    }
+
+    bool ascii = true, big_endian = false;
+    std::vector<ply_element> elements;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        std::istringstream words(line);
+        std::string keyword;
+        words >> keyword;
+        if (keyword == "format") {
+            std::string format;
+            words >> format;
+            ascii = format == "ascii";
+            big_endian = format == "binary_big_endian";
+        }
+        else if (keyword == "element") {
+            ply_element element;
+            words >> element.name >> element.count;
+            elements.push_back(element);
+        }
+        else if (keyword == "property" && !elements.empty()) {
+            ply_property property;
+            std::string type;
+            words >> type;
+            if (type == "list") {
+                std::string count_type, item_type;
+                words >> count_type >> item_type;
+                property.count_type = parse_ply_type(count_type);
+                property.type = parse_ply_type(item_type);
+            }
+            else {
+                property.count_type = ply_type::invalid;
+                property.type = parse_ply_type(type);
+            }
+            words >> property.name;
+            if (property.type == ply_type::invalid) {
+                std::cerr << "load_ply: unknown property type in " << filename << ": " << line << "\n";
+                return nullptr;
+            }
+            elements.back().properties.push_back(property);
+        }
+        else if (keyword == "end_header") {
+            break;
+        }
+    }
+
+    std::vector<vec3> positions, normals, uvs;
+    std::vector<mesh_face> faces;
+    std::vector<uint32_t> polygon;
+    ply_reader reader(file, ascii, big_endian);
+    for (const auto& element : elements) {
+        const bool is_vertex = element.name == "vertex";
+        const bool is_face = element.name == "face";
+        //vertex属性在一条记录中的位置：x y z nx ny nz u v
+        int slots[8] = { -1, -1, -1, -1, -1, -1, -1, -1 };
+        const char* names[8][3] = { { "x" }, { "y" }, { "z" }, { "nx" }, { "ny" }, { "nz" },
+            { "u", "s", "texture_u" }, { "v", "t", "texture_v" } };
+        for (size_t p = 0; p < element.properties.size(); p++)
+            for (int k = 0; k < 8; k++)
+                for (const char* name : names[k])
+                    if (name && element.properties[p].name == name)
+                        slots[k] = static_cast<int>(p);
+        if (is_vertex) {
+            //缺少坐标时values[0..2]不会被写入，直接拒绝这样的文件头
+            for (int k = 0; k < 3; k++) {
+                if (slots[k] < 0 || element.properties[slots[k]].count_type != ply_type::invalid) {
+                    std::cerr << "load_ply: vertex element without scalar x, y and z in " << filename << "\n";
+                    return nullptr;
+                }
+            }
+        }
+        const bool has_normals = is_vertex && slots[3] >= 0 && slots[4] >= 0 && slots[5] >= 0;
+        const bool has_uvs = is_vertex && slots[6] >= 0 && slots[7] >= 0;
+        if (is_vertex) {
+            positions.reserve(element.count);
+            if (has_normals) normals.reserve(element.count);
+            if (has_uvs) uvs.reserve(element.count);
+        }
+
+        double values[8];
+        for (size_t i = 0; i < element.count; i++) {
+            for (size_t p = 0; p < element.properties.size(); p++) {
+                const ply_property& property = element.properties[p];
+                if (property.count_type == ply_type::invalid) {
+                    double value = reader.read(property.type);
+                    for (int k = 0; k < 8; k++)
+                        if (slots[k] == static_cast<int>(p))
+                            values[k] = value;
+                    continue;
+                }
+                size_t count = static_cast<size_t>(reader.read(property.count_type));
+                polygon.clear();
+                for (size_t k = 0; k < count; k++)
+                    polygon.push_back(static_cast<uint32_t>(reader.read(property.type)));
+                if (!is_face || (property.name != "vertex_indices" && property.name != "vertex_index"))
+                    continue;
+                for (size_t k = 2; k < count; k++) {
+                    mesh_face face;
+                    face.v[0] = polygon[0];
+                    face.v[1] = polygon[k - 1];
+                    face.v[2] = polygon[k];
+                    for (int c = 0; c < 3; c++) {
+                        //PLY的法线和纹理坐标与顶点一一对应
+                        face.n[c] = !normals.empty() ? static_cast<int32_t>(face.v[c]) : -1;
+                        face.t[c] = !uvs.empty() ? static_cast<int32_t>(face.v[c]) : -1;
+                    }
+                    faces.push_back(face);
+                }
+            }
+            if (is_vertex) {
+                positions.push_back(vec3(values[0], values[1], values[2]));
+                if (has_normals) normals.push_back(vec3(values[3], values[4], values[5]));
+                if (has_uvs) uvs.push_back(vec3(values[6], values[7], 0));
+            }
+            if (!reader.good()) {
+                std::cerr << "load_ply: unexpected end of file in " << filename << "\n";
+                return nullptr;
+            }
+        }
+    }
+
+    for (const auto& face : faces) {
+        if (face.v[0] >= positions.size() || face.v[1] >= positions.size() || face.v[2] >= positions.size()) {
+            std::cerr << "load_ply: vertex index out of range in " << filename << "\n";
+            return nullptr;
+        }
+    }
+    return make_shared<triangle_mesh>(std::move(positions), std::move(normals), std::move(uvs), std::move(faces), m);
+}
+
+/// <summary>
+/// 按扩展名选择OBJ或PLY读取器
+/// </summary>
+shared_ptr<triangle_mesh> load_mesh(const std::string& filename, shared_ptr<material> m) {
+    auto dot = filename.find_last_of('.');
+    std::string extension = dot == std::string::npos ? "" : filename.substr(dot + 1);
+    for (auto& c : extension)
+        c = static_cast<char>(tolower(c));
+    if (extension == "ply")
+        return load_ply(filename, m);
+    if (extension == "obj")
+        return load_obj(filename, m);
+    std::cerr << "load_mesh: unsupported file type " << filename << "\n";
+    return nullptr;
+}
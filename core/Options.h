@@ -0,0 +1,251 @@
+﻿#pragma once
+//命令行参数：分辨率、采样数、反弹次数、线程数、种子、场景和输出文件都从命令行读取，不用为每种配置重新编译
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "Renderer.h"
+#include "Distributed.h"
+
+struct render_options {
+    render_settings settings;
+    std::string scene = "final_scene"; //注册的场景名，或者.json/.rtscene场景文件
+    std::string compile_output;         //非空时把JSON场景编译到这个文件后退出
+    std::vector<std::string> outputs;   //为空时写image.exr和image.jpg
+    bool show = false;                  //渲染完在窗口中显示，批处理时不要打开
+    bool list_scenes = false;
+    bool bench = false;
+    bool help = false;
+
+    std::string checkpoint_path;        //为空时不保存检查点
+    bool resume = false;
+    bool coordinator = false;
+    std::string coordinator_host;       //非空时作为工作进程连接这个地址
+    distributed_settings distributed;
+
+    render_options() {
+        settings.image_width = 200;
+        settings.image_height = 100;
+        //有了光源采样，同样的噪声水平需要的采样数少了一个数量级以上
+        settings.samples_per_pixel = 500;
+        //自适应采样时samples_per_pixel只是上限，平坦区域的像素很快就会收敛
+        settings.adaptive = true;
+    }
+};
+
+void print_usage(const char* program, const std::vector<std::string>& scene_names) {
+    std::cerr << "usage: " << program << " [options]\n"
+        "  --scene NAME|FILE       registered scene or a .json/.rtscene scene file (default final_scene)\n"
+        "  --list-scenes           print the registered scenes and exit\n"
+        "  --compile-scene FILE    compile the .json scene given by --scene into FILE (.rtscene) and exit\n"
+        "  --width N, --height N   image size in pixels (default 200x100)\n"
+        "  --spp N                 samples per pixel, the upper limit when adaptive (default 500)\n"
+        "  --depth N               maximum number of bounces (default 50)\n"
+        "  --roulette-depth N      bounce after which Russian roulette starts (default 5)\n"
+        "  --threads N             render threads, 0 uses all hardware threads (default 0)\n"
+        "  --seed N                random seed (default 0)\n"
+        "  --mode MODE             single or packet (default single)\n"
+        "  --packet-size N         rays per packet in packet mode: 4, 8 or 16 (default 8)\n"
+        "  --adaptive, --no-adaptive\n"
+        "                          adaptive sampling in single mode (default on)\n"
+        "  --noise-threshold X     adaptive convergence threshold (default 0.004)\n"
+        "  --time-budget SECONDS   stop adaptive rendering after this long, 0 for no limit\n"
+        "  --output FILE           .exr/.pfm for linear HDR, anything else for 8-bit; may repeat\n"
+        "                          (default image.exr and image.jpg)\n"
+        "  --show                  display the image in a window when done\n"
+        "  --checkpoint FILE       save checkpoints of a single-mode render to FILE (default none)\n"
+        "  --checkpoint-interval S seconds between checkpoints (default 300)\n"
+        "  --resume                continue from the --checkpoint file\n"
+        "  --coordinator           hand out jobs to workers instead of rendering\n"
+        "  --worker HOST           render jobs for the coordinator at HOST\n"
+        "  --port N                coordinator port (default 7420)\n"
+        "  --bench                 run the benchmarks and exit\n"
+        "  --help                  print this message\n"
+        "scenes:";
+    for (const auto& name : scene_names)
+        std::cerr << " " << name;
+    std::cerr << "\n";
+}
+
+/// <summary>
+/// 解析一个数值参数，整个字符串都必须是合法的数字
+/// </summary>
+template <typename T>
+bool parse_number(const std::string& flag, const char* text, T& value) {
+    char* end = nullptr;
+    errno = 0;
+    double parsed = strtod(text, &end);
+    bool valid = errno == 0 && end != text && *end == '\0';
+    //整数参数不能有小数部分，也不能超出类型的范围
+    if (valid && std::is_integral<T>::value)
+        valid = parsed == std::floor(parsed) && parsed >= double(std::numeric_limits<T>::min())
+            && parsed <= double(std::numeric_limits<T>::max());
+    if (!valid) {
+        std::cerr << flag << ": invalid number " << text << "\n";
+        return false;
+    }
+    value = static_cast<T>(parsed);
+    return true;
+}
+
+/// <summary>
+/// 解析命令行，遇到未知参数或者非法的值时打印原因并返回false
+/// </summary>
+bool parse_options(int argc, char** argv, render_options& options) {
+    render_settings& settings = options.settings;
+    for (int k = 1; k < argc; k++) {
+        const std::string arg = argv[k];
+        //需要一个值的参数
+        auto value = [&]() -> const char* {
+            if (k + 1 >= argc) {
+                std::cerr << arg << ": missing value\n";
+                return nullptr;
+            }
+            return argv[++k];
+        };
+        auto positive = [&](int& target) {
+            const char* text = value();
+            if (!text || !parse_number(arg, text, target))
+                return false;
+            if (target <= 0) {
+                std::cerr << arg << ": must be positive\n";
+                return false;
+            }
+            return true;
+        };
+        auto non_negative = [&](double& target) {
+            const char* text = value();
+            if (!text || !parse_number(arg, text, target))
+                return false;
+            if (target < 0) {
+                std::cerr << arg << ": must not be negative\n";
+                return false;
+            }
+            return true;
+        };
+        bool ok = true;
+        if (arg == "--scene") {
+            const char* text = value();
+            ok = text != nullptr;
+            if (ok)
+                options.scene = text;
+        }
+        else if (arg == "--list-scenes")
+            options.list_scenes = true;
+        else if (arg == "--compile-scene") {
+            const char* text = value();
+            ok = text != nullptr;
+            if (ok)
+                options.compile_output = text;
+        }
+        else if (arg == "--width")
+            ok = positive(settings.image_width);
+        else if (arg == "--height")
+            ok = positive(settings.image_height);
+        else if (arg == "--spp")
+            ok = positive(settings.samples_per_pixel);
+        else if (arg == "--depth")
+            ok = positive(settings.max_depth);
+        else if (arg == "--roulette-depth")
+            ok = positive(settings.roulette_depth);
+        else if (arg == "--threads") {
+            const char* text = value();
+            ok = text && parse_number(arg, text, settings.threads) && settings.threads >= 0;
+        }
+        else if (arg == "--seed") {
+            const char* text = value();
+            ok = text && parse_number(arg, text, settings.seed);
+        }
+        else if (arg == "--mode") {
+            const char* text = value();
+            std::string mode = text ? text : "";
+            if (mode == "single")
+                settings.mode = render_mode::single;
+            else if (mode == "packet")
+                settings.mode = render_mode::packet;
+            else {
+                if (text)
+                    std::cerr << "--mode: unknown mode " << mode << "\n";
+                ok = false;
+            }
+        }
+        else if (arg == "--packet-size") {
+            ok = positive(settings.packet_size);
+            if (ok && settings.packet_size != 4 && settings.packet_size != 8 && settings.packet_size != 16) {
+                std::cerr << "--packet-size: must be 4, 8 or 16\n";
+                ok = false;
+            }
+        }
+        else if (arg == "--adaptive")
+            settings.adaptive = true;
+        else if (arg == "--no-adaptive")
+            settings.adaptive = false;
+        else if (arg == "--noise-threshold")
+            ok = non_negative(settings.noise_threshold);
+        else if (arg == "--time-budget")
+            ok = non_negative(settings.time_budget);
+        else if (arg == "--output") {
+            const char* text = value();
+            ok = text != nullptr;
+            if (ok)
+                options.outputs.push_back(text);
+        }
+        else if (arg == "--show")
+            options.show = true;
+        else if (arg == "--checkpoint") {
+            const char* text = value();
+            ok = text != nullptr;
+            if (ok)
+                options.checkpoint_path = text;
+        }
+        else if (arg == "--checkpoint-interval")
+            ok = non_negative(settings.checkpoint_interval);
+        else if (arg == "--resume")
+            options.resume = true;
+        else if (arg == "--coordinator")
+            options.coordinator = true;
+        else if (arg == "--worker") {
+            const char* text = value();
+            ok = text != nullptr;
+            if (ok)
+                options.coordinator_host = text;
+        }
+        else if (arg == "--port") {
+            const char* text = value();
+            ok = text && parse_number(arg, text, options.distributed.port);
+            //0(由系统分配端口)只对协调进程有意义，工作进程无法知道实际端口，命令行上不允许
+            if (ok && (options.distributed.port < 1 || options.distributed.port > 65535)) {
+                std::cerr << "--port: must be between 1 and 65535\n";
+                ok = false;
+            }
+        }
+        else if (arg == "--bench")
+            options.bench = true;
+        else if (arg == "--help" || arg == "-h")
+            options.help = true;
+        else {
+            std::cerr << "unknown option " << arg << "\n";
+            ok = false;
+        }
+        if (!ok)
+            return false;
+    }
+    if (options.resume && options.checkpoint_path.empty()) {
+        std::cerr << "--resume needs --checkpoint FILE\n";
+        return false;
+    }
+    //分组光线模式一次渲染整幅图像，没有可以保存的中间状态
+    if (settings.mode == render_mode::packet && !options.checkpoint_path.empty()) {
+        std::cerr << "--checkpoint and --resume cannot be used with --mode packet\n";
+        return false;
+    }
+    if (options.coordinator && !options.coordinator_host.empty()) {
+        std::cerr << "--coordinator and --worker cannot be used together\n";
+        return false;
+    }
+    return true;
+}
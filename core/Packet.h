@@ -0,0 +1,254 @@
+﻿#pragma once
+//光线包：相邻像素的主光线方向几乎相同，把4/8/16条光线打包一起遍历线性BVH，
+//节点包围盒用SSE每次测试4条光线；只有主光线使用光线包，之后的反弹各自分散，退回单条光线追踪
+#include "LinearBVH.h"
+#include "Renderer.h"
+#include <cmath>
+#include <limits>
+#ifdef RT_WIDE_BVH_SSE
+#include <immintrin.h>
+#endif
+
+template <int N>
+struct ray_packet {
+    static_assert(N % 4 == 0 && N <= 16, "ray packets hold 4, 8 or 16 rays");
+
+    ray rays[N];
+    hit_record recs[N];
+    bool hit[N];
+    bool active[N];
+    double closest[N];
+
+    //遍历使用的单精度SoA数据，每4条光线一组送进SSE
+    alignas(16) float origin[3][N];
+    alignas(16) float inv_dir[3][N];
+    alignas(16) float t_far[N];
+
+    /// <summary>
+    /// 光线填好以后调用，计算方向的倒数并清空求交结果
+    /// </summary>
+    void prepare(double t_max) {
+        for (int k = 0; k < N; k++) {
+            hit[k] = false;
+            closest[k] = t_max;
+            for (int a = 0; a < 3; a++) {
+                origin[a][k] = static_cast<float>(rays[k].origin()[a]);
+                inv_dir[a][k] = static_cast<float>(1.0 / rays[k].direction()[a]);
+            }
+            //不活跃的光线远端距离为负，永远不会击中任何包围盒
+            t_far[k] = active[k] ? static_cast<float>(t_max) : -1.0f;
+        }
+    }
+};
+
+/// <summary>
+/// 用包里的所有光线测试一个节点的包围盒，返回击中该盒子的光线的位掩码
+/// </summary>
+template <int N>
+inline int packet_box_mask(const linear_bvh_node& node, const ray_packet<N>& p, float t_min) {
+    int mask = 0;
+#ifdef RT_WIDE_BVH_SSE
+    const __m128 scale = _mm_set1_ps(wide_bvh_far_scale);
+    for (int g = 0; g < N; g += 4) {
+        __m128 t0 = _mm_set1_ps(t_min);
+        __m128 t1 = _mm_load_ps(&p.t_far[g]);
+        for (int a = 0; a < 3; a++) {
+            const __m128 o = _mm_load_ps(&p.origin[a][g]);
+            const __m128 inv = _mm_load_ps(&p.inv_dir[a][g]);
+            __m128 ta = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bounds_min[a]), o), inv);
+            __m128 tb = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bounds_max[a]), o), inv);
+            //包内光线的方向符号可能不同，用min/max代替按符号选近远平面
+            t0 = _mm_max_ps(_mm_min_ps(ta, tb), t0);
+            t1 = _mm_min_ps(_mm_mul_ps(_mm_max_ps(ta, tb), scale), t1);
+        }
+        mask |= _mm_movemask_ps(_mm_cmple_ps(t0, t1)) << g;
+    }
+#else
+    for (int k = 0; k < N; k++) {
+        float t0 = t_min, t1 = p.t_far[k];
+        for (int a = 0; a < 3; a++) {
+            float ta = (node.bounds_min[a] - p.origin[a][k]) * p.inv_dir[a][k];
+            float tb = (node.bounds_max[a] - p.origin[a][k]) * p.inv_dir[a][k];
+            float tn = ta < tb ? ta : tb;
+            float tf = (ta < tb ? tb : ta) * wide_bvh_far_scale;
+            t0 = tn > t0 ? tn : t0;
+            t1 = tf < t1 ? tf : t1;
+        }
+        if (t0 <= t1)
+            mask |= 1 << k;
+    }
+#endif
+    return mask;
+}
+
+/// <summary>
+/// 遍历线性BVH求包里每条光线的最近交点，结束时交点信息已经填好。
+/// 体积雾在求交时会用到随机数，所以叶子中对每条光线求交前先切换到该光线自己的随机序列
+/// </summary>
+/// <param name="rng">每条光线的随机数状态，求交后写回</param>
+template <int N>
+void trace_packet(const linear_bvh& bvh, ray_packet<N>& p, double t_min, sampler_rng* rng) {
+    int first_active = -1;
+    for (int k = 0; k < N && first_active < 0; k++)
+        if (p.active[k])
+            first_active = k;
+    if (first_active < 0)
+        return;
+
+    //以第一条活跃光线的方向决定子节点的访问顺序，主光线足够一致
+    bool dir_negative[3];
+    for (int a = 0; a < 3; a++)
+        dir_negative[a] = p.rays[first_active].direction()[a] < 0;
+
+    const float t_min_f = static_cast<float>(t_min);
+    int stack[linear_bvh::max_depth];
+    int stack_size = 0;
+    int current = 0;
+    sampler_rng& thread_rng = thread_sampler();
+
+    while (true) {
+        const linear_bvh_node& node = bvh.nodes[current];
+        int mask = packet_box_mask(node, p, t_min_f);
+        if (mask) {
+            if (node.count > 0) {
+                for (int k = 0; k < N; k++) {
+                    if (!(mask & (1 << k)))
+                        continue;
+                    thread_rng = rng[k];
+                    for (int i = 0; i < node.count; i++) {
+                        if (bvh.primitives[node.offset + i]->intersect(p.rays[k], t_min, p.closest[k], p.recs[k])) {
+                            p.hit[k] = true;
+                            p.closest[k] = p.recs[k].t;
+                            p.t_far[k] = static_cast<float>(p.closest[k]);
+                        }
+                    }
+                    rng[k] = thread_rng;
+                }
+            }
+            else {
+                if (dir_negative[node.axis]) {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                }
+                else {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+
+        if (stack_size == 0)
+            break;
+        current = stack[--stack_size];
+    }
+
+    //遍历结束后只对每条光线的最近交点计算交点信息
+    for (int k = 0; k < N; k++)
+        if (p.hit[k])
+            finalize_hit(p.rays[k], p.recs[k]);
+}
+
+/// <summary>
+/// 找到场景最外层的线性BVH，光线包只能遍历这种结构
+/// </summary>
+const linear_bvh* find_packet_bvh(const hittable& world) {
+    if (auto bvh = dynamic_cast<const linear_bvh*>(&world))
+        return bvh;
+    auto list = dynamic_cast<const hittableList*>(&world);
+    if (list && list->objects.size() == 1)
+        return find_packet_bvh(*list->objects[0]);
+    return nullptr;
+}
+
+/// <summary>
+/// 光线包模式渲染一个分块：块内像素按 packet_width x packet_height 分组，每组像素的同一个采样的主光线组成一个包
+/// </summary>
+/// <param name="shade">根据主光线的求交结果计算颜色，形如 vec3(const ray&amp;, bool hit, const hit_record&amp;)</param>
+template <int N, typename Shade>
+void render_packet_tile(const render_settings& settings, const camera& cam, const linear_bvh& bvh, double t_min,
+    Shade& shade, const render_tile& tile, std::vector<float>& accum) {
+    const int packet_width = N == 4 ? 2 : 4;
+    const int packet_height = N / packet_width;
+    const int width = settings.image_width;
+    const int height = settings.image_height;
+
+    ray_packet<N> packet;
+    sampler_rng rng[N];
+    int px[N], py[N];
+    vec3 color[N];
+
+    for (int y0 = tile.y0; y0 < tile.y1; y0 += packet_height) {
+        for (int x0 = tile.x0; x0 < tile.x1; x0 += packet_width) {
+            for (int k = 0; k < N; k++) {
+                px[k] = x0 + k % packet_width;
+                py[k] = y0 + k / packet_width;
+                packet.active[k] = px[k] < tile.x1 && py[k] < tile.y1;
+                color[k] = vec3(0, 0, 0);
+            }
+
+            for (int s = 0; s < settings.samples_per_pixel; ++s) {
+                //与逐条光线模式使用相同的随机序列，生成完主光线后保存各自的状态
+                for (int k = 0; k < N; k++) {
+                    if (!packet.active[k])
+                        continue;
+                    seed_sampler(settings.seed, size_t(py[k]) * width + px[k], s);
+                    auto u = double(px[k] + random_double()) / width;
+                    auto v = double(py[k] + random_double()) / height;
+                    packet.rays[k] = cam.get_ray(u, v);
+                    rng[k] = thread_sampler();
+                }
+                packet.prepare(infinity);
+                trace_packet(bvh, packet, t_min, rng);
+
+                for (int k = 0; k < N; k++) {
+                    if (!packet.active[k])
+                        continue;
+                    thread_sampler() = rng[k];
+                    color[k] += shade(packet.rays[k], packet.hit[k], packet.recs[k]);
+                }
+            }
+
+            for (int k = 0; k < N; k++) {
+                if (!packet.active[k])
+                    continue;
+                float* pixel = &accum[(size_t(py[k]) * width + px[k]) * 3];
+                pixel[0] = static_cast<float>(color[k].x());
+                pixel[1] = static_cast<float>(color[k].y());
+                pixel[2] = static_cast<float>(color[k].z());
+            }
+        }
+    }
+}
+
+/// <summary>
+/// 光线包模式渲染整幅图像，主光线的求交下限为t_min，packet_size为4、8或16
+/// </summary>
+template <typename Shade>
+void render_packets(const render_settings& settings, const camera& cam, const linear_bvh& bvh, double t_min,
+    Shade shade, std::vector<float>& accum) {
+    accum.assign(size_t(settings.image_width) * settings.image_height * 3, 0.0f);
+
+    auto tiles = make_tiles(settings.image_width, settings.image_height, settings.tile_size);
+    std::atomic<int> tiles_left(static_cast<int>(tiles.size()));
+    std::mutex print_lock;
+
+    std::vector<thread_pool::task> tasks;
+    for (const auto& tile : tiles) {
+        tasks.push_back([&, tile](int) {
+            if (settings.packet_size == 4)
+                render_packet_tile<4>(settings, cam, bvh, t_min, shade, tile, accum);
+            else if (settings.packet_size == 8)
+                render_packet_tile<8>(settings, cam, bvh, t_min, shade, tile, accum);
+            else
+                render_packet_tile<16>(settings, cam, bvh, t_min, shade, tile, accum);
+            int left = --tiles_left;
+            std::lock_guard<std::mutex> guard(print_lock);
+            std::cerr << "\rTiles remaining: " << left << ' ' << std::flush;
+        });
+    }
+
+    thread_pool pool(settings.threads);
+    pool.run(tasks);
+    print_render_stats(pool);
+}
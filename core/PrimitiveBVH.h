@@ -0,0 +1,236 @@
+﻿#pragma once
+//图元数组上的BVH：只保存节点，叶子对应图元数组中连续的一段，由使用者按构建后的顺序重排自己的数据。
+//先用分箱SAH建二叉树，再折叠成4路宽节点，遍历时用SSE一次测试4个子节点。
+//图元可以分成多种类型，每个叶子中只有一种类型，叶子中的循环由使用者按类型提供。
+//三角网格和编译后的场景都用它
+#include "LinearBVH.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+//构建时使用的图元信息
+struct primitive_build_item {
+    uint32_t index;  //图元在使用者数组中原来的下标
+    aabb box;
+    vec3 centroid;
+    uint32_t kind = 0; //图元的类型，不超过255
+};
+
+class primitive_bvh {
+public:
+    /// <summary>
+    /// 分箱SAH构建，完成后items按叶子的顺序排列。
+    /// 叶子的起点是该叶子的第一个图元在同类型图元中的序号，使用者按这个顺序把每种类型的数据分别连续存放
+    /// </summary>
+    void build(std::vector<primitive_build_item>& items, int leaf_size);
+
+    /// <summary>
+    /// 按光线方向先近后远地遍历，对每个被击中的叶子调用 bool leaf(int kind, int start, int count, double&amp; closest)，
+    /// leaf找到更近的交点时更新closest并返回true
+    /// </summary>
+    template <typename Leaf>
+    bool traverse(const ray& r, double t_min, double& closest, Leaf&& leaf) const;
+
+public:
+    //叶子的count低8位为图元数量，高8位为类型。从编译后的场景文件读取时直接指向映射的内存
+    mapped_array<wide_bvh_node<4>> nodes;
+    aabb box;
+    int depth = 0; //二叉树的深度，不超过bvh_max_depth
+
+    //与wide_bvh相同：深度不超过bvh_max_depth时栈中最多有3*bvh_max_depth+1项
+    static const int stack_size = 64 * 4;
+    static_assert(3 * bvh_max_depth + 1 <= stack_size, "primitive_bvh traversal stack too small");
+
+private:
+    int build(std::vector<linear_bvh_node>& binary, std::vector<primitive_build_item>& items,
+        size_t start, size_t end, int leaf_size, int level);
+    int collapse(const std::vector<linear_bvh_node>& binary, const std::vector<int32_t>& local, int index,
+        std::vector<wide_bvh_node<4>>& wide);
+};
+
+void primitive_bvh::build(std::vector<primitive_build_item>& items, int leaf_size) {
+    nodes = mapped_array<wide_bvh_node<4>>();
+    depth = 0;
+    if (items.empty()) {
+        box = aabb(vec3(0, 0, 0), vec3(0, 0, 0));
+        return;
+    }
+    //SAH部分的深度由bvh_sah_split限制；不超过leaf_size个图元但类型不止一种时每层只分出一种类型，
+    //最多再多leaf_size - 1层，要落在bvh_depth_reserve之内
+    leaf_size = std::max(1, std::min(leaf_size, bvh_depth_reserve + 1));
+    std::vector<linear_bvh_node> binary;
+    binary.reserve(2 * items.size() / leaf_size + 1);
+    build(binary, items, 0, items.size(), leaf_size, 1);
+
+    //每个图元在同类型图元中的序号
+    std::vector<int32_t> local(items.size());
+    std::vector<int32_t> kind_count(256, 0);
+    for (size_t i = 0; i < items.size(); i++)
+        local[i] = kind_count[items[i].kind]++;
+
+    std::vector<wide_bvh_node<4>> wide;
+    wide.reserve(binary.size() / 2 + 1);
+    collapse(binary, local, 0, wide);
+    nodes = std::move(wide);
+}
+
+/// <summary>
+/// 递归构建[start,end)范围的二叉子树，节点按深度优先的顺序写入binary，第一个子节点紧跟在父节点后面。
+/// 图元足够少但类型不止一种时，按类型再分开
+/// </summary>
+int primitive_bvh::build(std::vector<linear_bvh_node>& binary, std::vector<primitive_build_item>& items,
+    size_t start, size_t end, int leaf_size, int level) {
+    depth = std::max(depth, level);
+    aabb bounds = items[start].box;
+    bool single_kind = true;
+    for (size_t i = start + 1; i < end; i++) {
+        bounds = surrounding_box(bounds, items[i].box);
+        single_kind = single_kind && items[i].kind == items[start].kind;
+    }
+    if (level == 1)
+        box = bounds;
+
+    int index = static_cast<int>(binary.size());
+    binary.push_back(linear_bvh_node());
+    store_bounds(binary[index], bounds);
+    binary[index].axis = 0;
+    if (end - start <= size_t(leaf_size) && single_kind) {
+        binary[index].offset = static_cast<int32_t>(start);
+        binary[index].count = static_cast<uint16_t>(end - start);
+        binary[index].pad = static_cast<uint8_t>(items[start].kind);
+        return index;
+    }
+
+    size_t mid;
+    if (end - start <= size_t(leaf_size)) {
+        const uint32_t kind = items[start].kind;
+        mid = std::stable_partition(items.begin() + start, items.begin() + end,
+            [kind](const primitive_build_item& item) { return item.kind == kind; }) - items.begin();
+    }
+    else {
+        mid = bvh_sah_split(items, start, end, level);
+    }
+    build(binary, items, start, mid, leaf_size, level + 1);
+    binary[index].offset = build(binary, items, mid, end, leaf_size, level + 1);
+    binary[index].count = 0;
+    return index;
+}
+
+/// <summary>
+/// 与wide_bvh相同的折叠方式：反复展开面积最大的内部子节点，直到凑满4个子节点
+/// </summary>
+int primitive_bvh::collapse(const std::vector<linear_bvh_node>& binary, const std::vector<int32_t>& local, int index,
+    std::vector<wide_bvh_node<4>>& wide) {
+    auto area = [&](int i) {
+        const linear_bvh_node& n = binary[i];
+        float dx = n.bounds_max[0] - n.bounds_min[0];
+        float dy = n.bounds_max[1] - n.bounds_min[1];
+        float dz = n.bounds_max[2] - n.bounds_min[2];
+        return dx * dy + dy * dz + dz * dx;
+    };
+
+    int slots[4];
+    int slot_count = 0;
+    if (binary[index].count > 0) {
+        //整棵树只有一个叶子
+        slots[slot_count++] = index;
+    }
+    else {
+        slots[slot_count++] = index + 1;
+        slots[slot_count++] = binary[index].offset;
+    }
+    while (slot_count < 4) {
+        int widest = -1;
+        for (int i = 0; i < slot_count; i++)
+            if (binary[slots[i]].count == 0 && (widest < 0 || area(slots[i]) > area(slots[widest])))
+                widest = i;
+        if (widest < 0)
+            break;
+        int expanded = slots[widest];
+        slots[widest] = expanded + 1;
+        slots[slot_count++] = binary[expanded].offset;
+    }
+
+    int result = static_cast<int>(wide.size());
+    wide.push_back(wide_bvh_node<4>());
+    int32_t child[4];
+    uint16_t count[4];
+    for (int i = 0; i < 4; i++) {
+        child[i] = -1;
+        count[i] = 0;
+        if (i >= slot_count)
+            continue;
+        const linear_bvh_node& n = binary[slots[i]];
+        if (n.count > 0) {
+            child[i] = local[n.offset];
+            count[i] = static_cast<uint16_t>(n.count | (n.pad << 8));
+        }
+        else {
+            child[i] = collapse(binary, local, slots[i], wide);
+        }
+    }
+
+    //递归过程中数组可能扩容，最后再通过下标写入
+    auto& node = wide[result];
+    for (int i = 0; i < 4; i++) {
+        node.child[i] = child[i];
+        node.count[i] = count[i];
+        for (int a = 0; a < 3; a++) {
+            node.bounds[a][i] = i < slot_count ? binary[slots[i]].bounds_min[a] : std::numeric_limits<float>::infinity();
+            node.bounds[a + 3][i] = i < slot_count ? binary[slots[i]].bounds_max[a] : -std::numeric_limits<float>::infinity();
+        }
+    }
+    return result;
+}
+
+template <typename Leaf>
+bool primitive_bvh::traverse(const ray& r, double t_min, double& closest, Leaf&& leaf) const {
+    struct entry {
+        int32_t child;
+        uint16_t count;
+        float t_near;
+    };
+    if (nodes.empty())
+        return false;
+
+    const wide_ray wr(r);
+    bool hit_anything = false;
+    entry stack[stack_size];
+    int top = 0;
+    stack[top++] = { 0, 0, static_cast<float>(t_min) };
+
+    while (top > 0) {
+        const entry e = stack[--top];
+        if (e.t_near > closest)
+            continue;
+
+        if (e.count > 0) {
+            if (leaf(e.count >> 8, e.child, e.count & 0xff, closest))
+                hit_anything = true;
+            continue;
+        }
+
+        const auto& node = nodes[e.child];
+        alignas(32) float t_near[4];
+        int mask = intersect_children<4>(node, wr, static_cast<float>(t_min), static_cast<float>(closest), t_near);
+
+        //按进入距离从远到近压栈，近的子节点先出栈
+        int first = top;
+        while (mask) {
+            int i = 0;
+            while (!(mask & (1 << i))) i++;
+            mask &= mask - 1;
+            entry child = { node.child[i], node.count[i], t_near[i] };
+            int j = top++;
+            while (j > first && stack[j - 1].t_near < child.t_near) {
+                stack[j] = stack[j - 1];
+                j--;
+            }
+            stack[j] = child;
+        }
+    }
+
+    return hit_anything;
+}
@@ -0,0 +1,178 @@
+﻿#pragma once
+//渐进式自适应采样：整幅图像分多遍渲染，每个像素用Welford算法在线统计亮度的均值和方差，
+//第一遍之后只给估计误差仍高于阈值的像素追加采样，所有像素收敛、达到采样数上限或者超过时间预算时停止
+#include "Renderer.h"
+#include <chrono>
+#include <csignal>
+#include <cmath>
+#include <cstdint>
+
+//每个像素的收敛统计，全部保存为float以节省内存
+struct convergence_buffer {
+    std::vector<float> mean; //亮度的均值
+    std::vector<float> m2;   //亮度与均值之差的平方和
+    std::vector<int> count;  //已经完成的采样数
+
+    void resize(size_t pixels) {
+        mean.assign(pixels, 0.0f);
+        m2.assign(pixels, 0.0f);
+        count.assign(pixels, 0);
+    }
+
+    void add(size_t pixel, double value) {
+        int n = ++count[pixel];
+        double delta = value - mean[pixel];
+        double new_mean = mean[pixel] + delta / n;
+        m2[pixel] += static_cast<float>(delta * (value - new_mean));
+        mean[pixel] = static_cast<float>(new_mean);
+    }
+
+    /// <summary>
+    /// 像素值的标准误差换算到film::tonemap的伽马校正(开平方)以后的大小：d(sqrt(x)) = dx / (2 sqrt(x))
+    /// </summary>
+    double error(size_t pixel) const {
+        int n = count[pixel];
+        if (n < 2)
+            return infinity;
+        double variance = m2[pixel] / (n - 1);
+        double standard_error = sqrt(variance / n);
+        return standard_error / (2 * sqrt(std::max(double(mean[pixel]), 1e-4)));
+    }
+};
+
+inline double luminance(const vec3& c) {
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
+//渐进式渲染在两遍之间的全部状态。采样的随机序列只由 (种子, 像素, 采样序号) 决定，
+//所以保存累加缓冲区和收敛统计就能从任意一遍结束处继续，结果与不中断的渲染完全相同(见Checkpoint.h)
+struct progressive_state {
+    std::vector<float> accum;   //格式与render()的输出相同
+    convergence_buffer stats;   //stats.count就是每个像素已经完成的采样数
+    int passes = 0;             //已经完成的遍数
+    double elapsed = 0;         //之前各次运行已经用掉的时间（秒），计入时间预算
+
+    void reset(size_t pixels) {
+        accum.assign(pixels * 3, 0.0f);
+        stats.resize(pixels);
+        passes = 0;
+        elapsed = 0;
+    }
+};
+
+//为真时渲染在当前这一遍结束后停止，由信号处理函数设置，用于被抢占前保存检查点
+static volatile std::sig_atomic_t render_stop_requested = 0;
+
+/// <summary>
+/// 渐进式渲染整幅图像，从state中已经完成的遍数继续（state为空时从头开始）。
+/// 开启settings.adaptive时第一遍之后只给未收敛的像素追加采样，否则所有像素都渲染到samples_per_pixel为止。
+/// 每个像素的第s个采样使用与render()相同的随机序列，与固定采样数的渲染只差分多遍累加带来的浮点舍入
+/// </summary>
+/// <param name="radiance">计算一条光线颜色的函数，形如 vec3(const ray&amp;)</param>
+/// <param name="on_pass">每一遍结束后调用，形如 void(const progressive_state&amp;, bool finished)</param>
+template <typename Radiance, typename PassCallback>
+void render_progressive(const render_settings& settings, const camera& cam, Radiance radiance,
+    progressive_state& state, PassCallback on_pass) {
+    const int width = settings.image_width;
+    const int height = settings.image_height;
+    const size_t pixels = size_t(width) * height;
+    if (state.accum.size() != pixels * 3)
+        state.reset(pixels);
+
+    convergence_buffer& stats = state.stats;
+    std::vector<float>& accum = state.accum;
+    auto still_active = [&](size_t p) {
+        return stats.count[p] < settings.samples_per_pixel && (!settings.adaptive || stats.error(p) > settings.noise_threshold);
+    };
+    std::vector<uint8_t> active(pixels);
+    size_t remaining = 0;
+    for (size_t p = 0; p < pixels; p++) {
+        active[p] = state.passes == 0 || still_active(p);
+        remaining += active[p];
+    }
+    auto tiles = make_tiles(width, height, settings.tile_size);
+    thread_pool pool(settings.threads);
+    auto start = std::chrono::steady_clock::now();
+    auto seconds_since = [](std::chrono::steady_clock::time_point t) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+    };
+    //on_pass可能要写检查点，它用掉的时间不计入渲染时间
+    const double previous_seconds = state.elapsed;
+    double callback_seconds = 0;
+    double busy_seconds = 0;
+    int passes = 0;
+
+    while (remaining > 0) {
+        const int pass_samples = state.passes == 0 ? settings.min_samples : settings.pass_samples;
+        std::vector<thread_pool::task> tasks;
+        for (const auto& tile : tiles) {
+            tasks.push_back([&, tile](int) {
+                for (int j = tile.y0; j < tile.y1; ++j) {
+                    for (int i = tile.x0; i < tile.x1; ++i) {
+                        const size_t index = size_t(j) * width + i;
+                        if (!active[index])
+                            continue;
+                        vec3 color(0, 0, 0);
+                        const int end = std::min(settings.samples_per_pixel, stats.count[index] + pass_samples);
+                        for (int s = stats.count[index]; s < end; ++s) {
+                            seed_sampler(settings.seed, index, s);
+                            auto u = double(i + random_double()) / width;
+                            auto v = double(j + random_double()) / height;
+                            vec3 sample = radiance(cam.get_ray(u, v));
+                            stats.add(index, luminance(sample));
+                            color += sample;
+                        }
+                        float* pixel = &accum[index * 3];
+                        pixel[0] += static_cast<float>(color.x());
+                        pixel[1] += static_cast<float>(color.y());
+                        pixel[2] += static_cast<float>(color.z());
+                    }
+                }
+            });
+        }
+        pool.run(tasks);
+        for (int t = 0; t < pool.size(); t++)
+            busy_seconds += pool.busy_seconds[t];
+        passes++;
+        state.passes++;
+
+        //重新挑出还需要采样的像素
+        remaining = 0;
+        for (size_t p = 0; p < pixels; p++) {
+            active[p] = still_active(p);
+            remaining += active[p];
+        }
+        std::cerr << "\rPass " << state.passes << ": " << remaining << " pixels not converged    " << std::flush;
+        state.elapsed = previous_seconds + seconds_since(start) - callback_seconds;
+        const bool out_of_time = settings.time_budget > 0 && state.elapsed >= settings.time_budget;
+        const bool finished = remaining == 0 || out_of_time;
+        auto callback_start = std::chrono::steady_clock::now();
+        on_pass(static_cast<const progressive_state&>(state), finished);
+        callback_seconds += seconds_since(callback_start);
+        if (finished || render_stop_requested)
+            break;
+    }
+
+    long long total = 0;
+    for (int n : stats.count)
+        total += n;
+    double seconds = seconds_since(start);
+    std::cerr << "\nRender time: " << seconds << "s on " << pool.size() << " threads, " << passes << " passes\n";
+    std::cerr << "Average utilization: " << 100 * busy_seconds / (std::max(seconds, 1e-9) * pool.size()) << "%\n";
+    std::cerr << "Samples: " << total << " (" << double(total) / pixels << " per pixel on average, "
+        << settings.samples_per_pixel << " max)\n";
+}
+
+/// <summary>
+/// 一次渲染完的渐进式渲染，输出累加缓冲区和每个像素实际使用的采样数
+/// </summary>
+/// <param name="accum">输出的浮点缓冲区，格式与render()相同</param>
+/// <param name="sample_counts">输出每个像素实际使用的采样数</param>
+template <typename Radiance>
+void render_progressive(const render_settings& settings, const camera& cam, Radiance radiance,
+    std::vector<float>& accum, std::vector<int>& sample_counts) {
+    progressive_state state;
+    render_progressive(settings, cam, radiance, state, [](const progressive_state&, bool) {});
+    accum = std::move(state.accum);
+    sample_counts = std::move(state.stats.count);
+}
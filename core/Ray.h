@@ -28,6 +28,13 @@ public:
     vec3 min() const { return _min; }
     vec3 max() const { return _max; }
 
+    //表面积，SAH用它估计光线穿过包围盒的概率
+    double area() const {
+        auto d = _max - _min;
+        return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+    }
+    vec3 centroid() const { return 0.5 * (_min + _max); }
+
     bool hit(const ray& r, double tmin, double tmax) const;
     vec3 _min;
     vec3 _max;
@@ -0,0 +1,113 @@
+﻿#pragma once
+//分块多线程渲染：把画面切成小块(tile)交给工作窃取线程池，每个像素的结果写入共享的浮点累加缓冲区
+#include "Camera.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+//渲染模式：single为逐条光线追踪，packet为主光线使用光线包(见Packet.h)
+enum class render_mode { single, packet };
+
+struct render_settings {
+    int image_width = 200;
+    int image_height = 100;
+    int samples_per_pixel = 100;
+    int max_depth = 50;
+    int roulette_depth = 5; //从第几次反弹开始用俄罗斯轮盘赌终止路径，不小于max_depth时关闭
+    int tile_size = 16;
+    int threads = 0; //0表示使用全部硬件线程
+    unsigned int seed = 0;
+    render_mode mode = render_mode::single;
+    int packet_size = 8; //光线包中的光线数：4、8或16
+
+    //渐进式自适应采样(见Progressive.h)，samples_per_pixel为每个像素的采样数上限
+    bool adaptive = false;
+    int min_samples = 32;           //第一遍每个像素的采样数
+    int pass_samples = 16;          //之后每一遍给未收敛的像素追加的采样数
+    double noise_threshold = 0.004; //伽马校正后像素值的标准误差低于这个值时认为已经收敛
+    double time_budget = 0;         //渲染的时间上限（秒），0表示不限时
+    double checkpoint_interval = 300; //带检查点渲染时(见Checkpoint.h)两次保存之间的间隔（秒）
+};
+
+/// <summary>
+/// 俄罗斯轮盘赌的存活概率：衰减率的最大分量，衰减率越小的路径越容易被终止
+/// </summary>
+inline double roulette_survival(const vec3& throughput) {
+    return std::min(1.0, static_cast<double>(std::max(throughput.x(), std::max(throughput.y(), throughput.z()))));
+}
+
+struct render_tile {
+    int x0, y0, x1, y1; //左闭右开
+};
+
+std::vector<render_tile> make_tiles(int width, int height, int tile_size) {
+    std::vector<render_tile> tiles;
+    for (int y = 0; y < height; y += tile_size)
+        for (int x = 0; x < width; x += tile_size)
+            tiles.push_back({ x, y, std::min(x + tile_size, width), std::min(y + tile_size, height) });
+    return tiles;
+}
+
+/// <summary>
+/// 打印每个线程的利用率 = 执行任务的时间 / 整批任务的墙钟时间
+/// </summary>
+void print_render_stats(const thread_pool& pool) {
+    double total = 0;
+    std::cerr << "\nRender time: " << pool.wall_seconds << "s on " << pool.size() << " threads\n";
+    for (int t = 0; t < pool.size(); t++) {
+        double utilization = pool.wall_seconds > 0 ? pool.busy_seconds[t] / pool.wall_seconds : 0;
+        total += utilization;
+        std::cerr << "  thread " << t << " utilization: " << 100 * utilization << "%\n";
+    }
+    std::cerr << "Average utilization: " << 100 * total / pool.size() << "%\n";
+}
+
+/// <summary>
+/// 多线程渲染整幅图像
+/// </summary>
+/// <param name="settings">分辨率、采样数、分块大小、线程数和随机种子</param>
+/// <param name="cam">相机</param>
+/// <param name="radiance">计算一条光线颜色的函数，形如 vec3(const ray&amp;)</param>
+/// <param name="accum">输出的浮点缓冲区，按行存储每个像素的RGB采样和，第j行对应v方向的第j个像素</param>
+template <typename Radiance>
+void render(const render_settings& settings, const camera& cam, Radiance radiance, std::vector<float>& accum) {
+    const int width = settings.image_width;
+    const int height = settings.image_height;
+    accum.assign(size_t(width) * height * 3, 0.0f);
+
+    auto tiles = make_tiles(width, height, settings.tile_size);
+    std::atomic<int> tiles_left(static_cast<int>(tiles.size()));
+    std::mutex print_lock;
+
+    std::vector<thread_pool::task> tasks;
+    for (const auto& tile : tiles) {
+        tasks.push_back([&, tile](int) {
+            for (int j = tile.y0; j < tile.y1; ++j) {
+                for (int i = tile.x0; i < tile.x1; ++i) {
+                    vec3 color(0, 0, 0);
+                    for (int s = 0; s < settings.samples_per_pixel; ++s) {
+                        //每个采样使用独立的随机序列，结果与线程数和渲染顺序无关
+                        seed_sampler(settings.seed, size_t(j) * width + i, s);
+                        auto u = double(i + random_double()) / width;
+                        auto v = double(j + random_double()) / height;
+                        color += radiance(cam.get_ray(u, v));
+                    }
+                    float* pixel = &accum[(size_t(j) * width + i) * 3];
+                    pixel[0] = static_cast<float>(color.x());
+                    pixel[1] = static_cast<float>(color.y());
+                    pixel[2] = static_cast<float>(color.z());
+                }
+            }
+            int left = --tiles_left;
+            std::lock_guard<std::mutex> guard(print_lock);
+            std::cerr << "\rTiles remaining: " << left << ' ' << std::flush;
+        });
+    }
+
+    thread_pool pool(settings.threads);
+    pool.run(tasks);
+    print_render_stats(pool);
+}
@@ -0,0 +1,72 @@
+﻿#pragma once
+//采样器：线程私有的xoshiro256++随机数发生器，可以按 (种子, 像素, 采样序号) 直接定位到一条独立的随机序列
+//并行渲染时各线程互不争用，同一个采样无论由哪个线程、在第几遍计算，得到的随机数都相同
+#include <cstdint>
+
+/// <summary>
+/// splitmix64，用来把任意的64位输入打散成高质量的种子
+/// </summary>
+inline uint64_t splitmix64(uint64_t& x) {
+    uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+class sampler_rng {
+public:
+    sampler_rng() { seed(0); }
+    sampler_rng(uint64_t seed_value) { seed(seed_value); }
+
+    void seed(uint64_t seed_value) {
+        for (int i = 0; i < 4; i++)
+            s[i] = splitmix64(seed_value);
+    }
+
+    uint64_t next() {
+        const uint64_t result = rotl(s[0] + s[3], 23) + s[0];
+        const uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    // Returns a random real in [0,1) with 53 bits of resolution.
+    double next_double() {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+public:
+    uint64_t s[4];
+
+private:
+    static uint64_t rotl(const uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+};
+
+inline sampler_rng& thread_sampler() {
+    thread_local sampler_rng rng;
+    return rng;
+}
+
+/// <summary>
+/// 由全局种子、像素编号和采样序号得到一条随机序列的起点
+/// </summary>
+inline uint64_t sample_stream(uint64_t seed, uint64_t pixel, uint64_t sample) {
+    uint64_t x = seed;
+    uint64_t h = splitmix64(x) ^ pixel;
+    h = splitmix64(h) ^ sample;
+    return splitmix64(h);
+}
+
+/// <summary>
+/// 把当前线程的随机数发生器定位到某个像素的某个采样
+/// </summary>
+inline void seed_sampler(uint64_t seed, uint64_t pixel, uint64_t sample) {
+    thread_sampler().seed(sample_stream(seed, pixel, sample));
+}
@@ -0,0 +1,36 @@
+﻿#pragma once
+//场景注册表：场景名对应构建场景的函数以及这个场景默认的相机和背景色，命令行用--scene按名字选择场景
+#include <functional>
+#include <string>
+#include <vector>
+#include "HittableList.h"
+#include "Camera.h"
+
+struct scene_description {
+    std::string name;
+    std::string summary;
+    std::function<hittableList()> build;
+    vec3 lookfrom = vec3(0, 0, 0);
+    vec3 lookat = vec3(0, 0, -1);
+    double vfov = 40;
+    double aperture = 0;
+    double focus_dist = 10;
+    vec3 background = vec3(0, 0, 0); //没有击中任何物体的光线的颜色，场景中没有光源时用天空色
+
+    /// <summary>
+    /// 场景默认的相机，快门从0到1打开，运动的物体会有运动模糊
+    /// </summary>
+    camera make_camera(double aspect) const {
+        return camera(lookfrom, lookat, vec3(0, 1, 0), vfov, aspect, aperture, focus_dist, 0.0, 1.0);
+    }
+};
+
+/// <summary>
+/// 按名字查找场景，找不到时返回nullptr
+/// </summary>
+const scene_description* find_scene(const std::vector<scene_description>& scenes, const std::string& name) {
+    for (const auto& scene : scenes)
+        if (scene.name == name)
+            return &scene;
+    return nullptr;
+}
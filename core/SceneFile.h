@@ -0,0 +1,936 @@
+﻿#pragma once
+//场景文件：用JSON描述纹理、材质、物体、变换、相机和背景色，不用改C++代码重新编译就能修改场景，格式见README。
+//场景还可以用--compile-scene编译成二进制文件(.rtscene)：文件头之后是JSON文本，然后是每个三角网格的顶点、三角形
+//和已经构建好的BVH节点。读取时整个文件映射进内存，网格直接使用映射的数组，不再解析OBJ/PLY也不再构建网格的BVH，
+//读取百万三角形的场景基本上只剩缺页。球、矩形、盒子这些解析式的物体数据量很小，仍然按JSON构建
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Json.h"
+#include "MappedFile.h"
+#include "Scene.h"
+#include "Sphere.h"
+#include "Material.h"
+#include "Texture.h"
+#include "xyz_rect.h"
+#include "box.h"
+#include "transform.h"
+#include "volume.h"
+#include "BVH.h"
+#include "Mesh.h"
+#include "MeshLoader.h"
+//main.cpp定义STB_IMAGE_IMPLEMENTATION后已经包含过时不能再包含一次
+#ifndef STBI_INCLUDE_STB_IMAGE_H
+#include "stb_image.h"
+#endif
+
+//编译后的场景文件头。后面依次是JSON文本、网格表(mesh_count个scene_cache_mesh)和各个数组，
+//网格表和数组按64字节对齐，都是小端
+struct scene_cache_header {
+    char magic[4] = { 'R', 'T', 'S', 'C' };
+    uint32_t version = 1;
+    //数组按内存布局直接使用，这些大小与编译时不同（比如切换了RT_SINGLE_PRECISION）就不能读
+    uint32_t vec3_size = sizeof(vec3);
+    uint32_t face_size = sizeof(mesh_face);
+    uint32_t node_size = sizeof(wide_bvh_node<4>);
+    uint32_t mesh_count = 0;
+    uint64_t json_offset = 0, json_size = 0;
+    uint64_t mesh_table_offset = 0;
+};
+
+//文件中的一个数组：从文件开头算起的字节偏移和元素个数
+struct scene_cache_array {
+    uint64_t offset = 0, count = 0;
+};
+
+struct scene_cache_mesh {
+    scene_cache_array positions, normals, uvs, faces, nodes;
+    double box_min[3] = { 0, 0, 0 };
+    double box_max[3] = { 0, 0, 0 };
+    int32_t depth = 0, reserved = 0;
+};
+
+const uint64_t scene_cache_alignment = 64;
+
+/// <summary>
+/// 读取场景文件并构建物体。网格按构建的顺序编号，编译时按这个顺序写入，读取编译后的文件时按同样的顺序取回
+/// </summary>
+class scene_loader {
+public:
+    /// <summary>
+    /// 读取JSON场景文件，出错时打印文件名、行号和原因并返回false
+    /// </summary>
+    bool load_json(const std::string& path, scene_description& scene);
+
+    /// <summary>
+    /// 读取编译后的场景文件：映射整个文件，按其中的JSON构建物体，网格使用映射的数组
+    /// </summary>
+    bool load_compiled(const std::string& path, scene_description& scene);
+
+public:
+    std::string source; //JSON文本
+    std::vector<shared_ptr<triangle_mesh>> meshes;
+
+private:
+    bool parse_and_build(const std::string& path, scene_description& scene);
+    bool build(const json_value& document, scene_description& scene);
+
+    bool error(const json_value& value, const std::string& message) const;
+    void check_members(const json_value& spec, std::initializer_list<const char*> allowed) const;
+    bool number(const json_value& spec, const char* key, double& value, bool required = true) const;
+    bool point(const json_value& spec, const char* key, vec3& value, bool required = true) const;
+    bool interval(const json_value& spec, const char* key, double& lo, double& hi) const;
+    bool read_vec3(const json_value& value, vec3& result) const;
+    std::string resolve(const std::string& filename) const;
+
+    shared_ptr<texture> make_texture(const json_value& spec);
+    shared_ptr<material> make_material(const json_value& spec);
+    shared_ptr<hittable> make_object(const json_value& spec);
+    shared_ptr<triangle_mesh> make_mesh(const json_value& spec, shared_ptr<material> m);
+    bool make_transform(const json_value& spec, affine3& matrix) const;
+
+    template <typename T>
+    mapped_array<T> cached_array(const scene_cache_array& a) const {
+        return mapped_array<T>(reinterpret_cast<const T*>(cache->data() + a.offset), size_t(a.count), cache);
+    }
+
+    std::string file, directory;
+    std::map<std::string, shared_ptr<texture>> textures;
+    std::map<std::string, shared_ptr<material>> materials;
+    std::map<std::string, shared_ptr<hittable>> shapes;
+
+    shared_ptr<mapped_file> cache;
+    const scene_cache_mesh* cache_meshes = nullptr;
+    size_t cache_mesh_count = 0;
+};
+
+bool scene_loader::error(const json_value& value, const std::string& message) const {
+    std::cerr << file << ": line " << value.line << ": " << message << "\n";
+    return false;
+}
+
+/// <summary>
+/// 拼错的成员名不会被用到，给出警告而不是悄悄忽略
+/// </summary>
+void scene_loader::check_members(const json_value& spec, std::initializer_list<const char*> allowed) const {
+    for (size_t i = 0; i < spec.keys.size(); i++) {
+        bool known = false;
+        for (const char* name : allowed)
+            known = known || spec.keys[i] == name;
+        if (!known)
+            std::cerr << file << ": line " << spec.items[i].line << ": warning: unknown member \"" << spec.keys[i]
+                << "\" ignored\n";
+    }
+}
+
+bool scene_loader::number(const json_value& spec, const char* key, double& value, bool required) const {
+    const json_value* member = spec.find(key);
+    if (!member)
+        return !required || error(spec, std::string("missing \"") + key + "\"");
+    if (!member->is_number())
+        return error(*member, std::string("\"") + key + "\" must be a number, not " + member->type_name());
+    value = member->number;
+    return true;
+}
+
+bool scene_loader::read_vec3(const json_value& value, vec3& result) const {
+    if (!value.is_array() || value.items.size() != 3)
+        return false;
+    for (int i = 0; i < 3; i++) {
+        if (!value.items[i].is_number())
+            return false;
+        result[i] = value.items[i].number;
+    }
+    return true;
+}
+
+bool scene_loader::point(const json_value& spec, const char* key, vec3& value, bool required) const {
+    const json_value* member = spec.find(key);
+    if (!member)
+        return !required || error(spec, std::string("missing \"") + key + "\"");
+    if (!read_vec3(*member, value))
+        return error(*member, std::string("\"") + key + "\" must be an array of 3 numbers");
+    return true;
+}
+
+bool scene_loader::interval(const json_value& spec, const char* key, double& lo, double& hi) const {
+    const json_value* member = spec.find(key);
+    if (!member)
+        return error(spec, std::string("missing \"") + key + "\"");
+    if (!member->is_array() || member->items.size() != 2 || !member->items[0].is_number() || !member->items[1].is_number())
+        return error(*member, std::string("\"") + key + "\" must be an array of 2 numbers");
+    lo = member->items[0].number;
+    hi = member->items[1].number;
+    return true;
+}
+
+/// <summary>
+/// 相对路径相对于场景文件所在的目录
+/// </summary>
+std::string scene_loader::resolve(const std::string& filename) const {
+    const bool absolute = !filename.empty() && (filename[0] == '/' || filename[0] == '\\'
+        || (filename.size() > 1 && filename[1] == ':'));
+    return absolute ? filename : directory + filename;
+}
+
+/// <summary>
+/// 纹理可以是textures中的名字、[r,g,b]形式的常量颜色，或者一个带type的对象
+/// </summary>
+shared_ptr<texture> scene_loader::make_texture(const json_value& spec) {
+    if (spec.is_string()) {
+        auto found = textures.find(spec.text);
+        if (found == textures.end()) {
+            error(spec, "unknown texture \"" + spec.text + "\"");
+            return nullptr;
+        }
+        return found->second;
+    }
+    vec3 color;
+    if (read_vec3(spec, color))
+        return make_shared<constant_texture>(color);
+    const json_value* type = spec.find("type");
+    if (!spec.is_object() || !type || !type->is_string()) {
+        error(spec, "a texture must be a name, an [r, g, b] color or an object with a \"type\"");
+        return nullptr;
+    }
+
+    if (type->text == "constant") {
+        check_members(spec, { "type", "color" });
+        if (!point(spec, "color", color))
+            return nullptr;
+        return make_shared<constant_texture>(color);
+    }
+    if (type->text == "checker") {
+        check_members(spec, { "type", "even", "odd" });
+        const json_value* even = spec.find("even");
+        const json_value* odd = spec.find("odd");
+        if (!even || !odd) {
+            error(spec, "checker needs \"even\" and \"odd\"");
+            return nullptr;
+        }
+        auto even_texture = make_texture(*even);
+        auto odd_texture = even_texture ? make_texture(*odd) : nullptr;
+        if (!odd_texture)
+            return nullptr;
+        return make_shared<checker_texture>(even_texture, odd_texture);
+    }
+    if (type->text == "noise") {
+        check_members(spec, { "type", "scale" });
+        double scale = 1;
+        if (!number(spec, "scale", scale, false))
+            return nullptr;
+        return make_shared<noise_texture>(scale);
+    }
+    if (type->text == "image") {
+        check_members(spec, { "type", "file" });
+        const json_value* name = spec.find("file");
+        if (!name || !name->is_string()) {
+            error(spec, "image needs a \"file\"");
+            return nullptr;
+        }
+        //与C++中的场景一样，图片读不到时仍然渲染，image_texture显示为红色
+        int nx = 0, ny = 0, nn = 0;
+        unsigned char* pixels = stbi_load(resolve(name->text).c_str(), &nx, &ny, &nn, 3);
+        if (!pixels)
+            std::cerr << file << ": line " << name->line << ": warning: cannot load image " << resolve(name->text) << "\n";
+        return make_shared<image_texture>(pixels, nx, ny);
+    }
+    error(*type, "unknown texture type \"" + type->text + "\"");
+    return nullptr;
+}
+
+/// <summary>
+/// 材质可以是materials中的名字，或者一个带type的对象
+/// </summary>
+shared_ptr<material> scene_loader::make_material(const json_value& spec) {
+    if (spec.is_string()) {
+        auto found = materials.find(spec.text);
+        if (found == materials.end()) {
+            error(spec, "unknown material \"" + spec.text + "\"");
+            return nullptr;
+        }
+        return found->second;
+    }
+    const json_value* type = spec.find("type");
+    if (!spec.is_object() || !type || !type->is_string()) {
+        error(spec, "a material must be a name or an object with a \"type\"");
+        return nullptr;
+    }
+    auto texture_member = [&](const char* key) -> shared_ptr<texture> {
+        const json_value* member = spec.find(key);
+        if (!member) {
+            error(spec, type->text + " needs \"" + key + "\"");
+            return nullptr;
+        }
+        return make_texture(*member);
+    };
+
+    if (type->text == "lambertian") {
+        check_members(spec, { "type", "albedo" });
+        auto albedo = texture_member("albedo");
+        return albedo ? make_shared<lambertian>(albedo) : nullptr;
+    }
+    if (type->text == "metal") {
+        check_members(spec, { "type", "albedo", "fuzz" });
+        vec3 albedo;
+        double fuzz = 0;
+        if (!point(spec, "albedo", albedo) || !number(spec, "fuzz", fuzz, false))
+            return nullptr;
+        return make_shared<metal>(albedo, fuzz);
+    }
+    if (type->text == "dielectric") {
+        check_members(spec, { "type", "ior" });
+        double ior;
+        if (!number(spec, "ior", ior))
+            return nullptr;
+        return make_shared<dielectric>(ior);
+    }
+    if (type->text == "diffuse_light") {
+        check_members(spec, { "type", "emit" });
+        auto emit = texture_member("emit");
+        return emit ? make_shared<diffuse_light>(emit) : nullptr;
+    }
+    if (type->text == "isotropic") {
+        check_members(spec, { "type", "albedo" });
+        auto albedo = texture_member("albedo");
+        return albedo ? make_shared<isotropic>(albedo) : nullptr;
+    }
+    error(*type, "unknown material type \"" + type->text + "\"");
+    return nullptr;
+}
+
+/// <summary>
+/// 变换是一个操作的数组，按顺序作用在物体上：translate、rotate_x/rotate_y/rotate_z（角度）、
+/// rotate（axis和angle）、scale（一个数或三个轴分别缩放）、matrix（3行4列）
+/// </summary>
+bool scene_loader::make_transform(const json_value& spec, affine3& matrix) const {
+    if (!spec.is_array())
+        return error(spec, "\"transform\" must be an array of operations");
+    matrix = affine3::identity();
+    for (const auto& op : spec.items) {
+        if (!op.is_object() || op.keys.size() != 1)
+            return error(op, "a transform operation must be an object with one member, e.g. {\"translate\": [0, 1, 0]}");
+        const std::string& name = op.keys[0];
+        const json_value& value = op.items[0];
+        affine3 step;
+        vec3 v;
+        if (name == "translate") {
+            if (!read_vec3(value, v))
+                return error(value, "translate needs [x, y, z]");
+            step = affine3::translation(v);
+        }
+        else if (name == "rotate_x" || name == "rotate_y" || name == "rotate_z") {
+            if (!value.is_number())
+                return error(value, name + " needs an angle in degrees");
+            if (name == "rotate_y")
+                step = affine3::rotation_y(value.number);
+            else
+                step = affine3::rotation(name == "rotate_x" ? vec3(1, 0, 0) : vec3(0, 0, 1), value.number);
+        }
+        else if (name == "rotate") {
+            const json_value* angle = value.find("angle");
+            const json_value* axis = value.find("axis");
+            if (!value.is_object() || !angle || !angle->is_number() || !axis || !read_vec3(*axis, v) || v.length_squared() == 0)
+                return error(value, "rotate needs {\"axis\": [x, y, z], \"angle\": degrees}");
+            step = affine3::rotation(v, angle->number);
+        }
+        else if (name == "scale") {
+            if (value.is_number())
+                v = vec3(value.number, value.number, value.number);
+            else if (!read_vec3(value, v))
+                return error(value, "scale needs a number or [x, y, z]");
+            if (v.x() == 0 || v.y() == 0 || v.z() == 0)
+                return error(value, "scale must not be zero");
+            step = affine3::scaling(v);
+        }
+        else if (name == "matrix") {
+            bool valid = value.is_array() && value.items.size() == 3;
+            for (int i = 0; valid && i < 3; i++) {
+                const json_value& row = value.items[i];
+                valid = row.is_array() && row.items.size() == 4;
+                for (int j = 0; valid && j < 4; j++) {
+                    valid = row.items[j].is_number();
+                    if (valid)
+                        step.m[i][j] = row.items[j].number;
+                }
+            }
+            if (!valid)
+                return error(value, "matrix needs 3 rows of 4 numbers");
+        }
+        else {
+            return error(op, "unknown transform operation \"" + name + "\"");
+        }
+        matrix = step * matrix;
+    }
+    return true;
+}
+
+/// <summary>
+/// 三角网格：从OBJ/PLY文件读入，或者直接在JSON中给出positions和faces（normals、uvs与positions一一对应，可以省略）。
+/// 读取编译后的文件时使用映射的数组
+/// </summary>
+shared_ptr<triangle_mesh> scene_loader::make_mesh(const json_value& spec, shared_ptr<material> m) {
+    shared_ptr<triangle_mesh> mesh;
+    if (cache) {
+        if (meshes.size() >= cache_mesh_count) {
+            error(spec, "the compiled file has only " + std::to_string(cache_mesh_count) + " meshes");
+            return nullptr;
+        }
+        const scene_cache_mesh& entry = cache_meshes[meshes.size()];
+        primitive_bvh bvh;
+        bvh.nodes = cached_array<wide_bvh_node<4>>(entry.nodes);
+        bvh.box = aabb(vec3(entry.box_min[0], entry.box_min[1], entry.box_min[2]),
+            vec3(entry.box_max[0], entry.box_max[1], entry.box_max[2]));
+        bvh.depth = entry.depth;
+        mesh = make_shared<triangle_mesh>(cached_array<vec3>(entry.positions), cached_array<vec3>(entry.normals),
+            cached_array<vec3>(entry.uvs), cached_array<mesh_face>(entry.faces), std::move(bvh), m);
+    }
+    else if (const json_value* name = spec.find("file")) {
+        if (!name->is_string()) {
+            error(*name, "\"file\" must be a string");
+            return nullptr;
+        }
+        mesh = load_mesh(resolve(name->text), m);
+        if (!mesh) {
+            error(*name, "cannot load mesh " + resolve(name->text));
+            return nullptr;
+        }
+    }
+    else {
+        const json_value* positions = spec.find("positions");
+        const json_value* faces = spec.find("faces");
+        if (!positions || !faces || !positions->is_array() || !faces->is_array()) {
+            error(spec, "mesh needs a \"file\", or \"positions\" and \"faces\" arrays");
+            return nullptr;
+        }
+        std::vector<vec3> points(positions->items.size());
+        for (size_t i = 0; i < points.size(); i++) {
+            if (!read_vec3(positions->items[i], points[i])) {
+                error(positions->items[i], "a position must be an array of 3 numbers");
+                return nullptr;
+            }
+        }
+        //逐顶点的属性，个数必须与positions相同
+        auto attribute = [&](const char* key, int components, std::vector<vec3>& values) {
+            const json_value* member = spec.find(key);
+            if (!member)
+                return true;
+            if (!member->is_array() || member->items.size() != points.size())
+                return error(*member, std::string("\"") + key + "\" must have one entry per position");
+            values.resize(points.size(), vec3(0, 0, 0));
+            for (size_t i = 0; i < values.size(); i++) {
+                const json_value& item = member->items[i];
+                bool valid = item.is_array() && item.items.size() == size_t(components);
+                for (int c = 0; valid && c < components; c++) {
+                    valid = item.items[c].is_number();
+                    if (valid)
+                        values[i][c] = item.items[c].number;
+                }
+                if (!valid)
+                    return error(item, std::string("each entry of \"") + key + "\" needs " + std::to_string(components) + " numbers");
+            }
+            return true;
+        };
+        std::vector<vec3> normals, uvs;
+        if (!attribute("normals", 3, normals) || !attribute("uvs", 2, uvs))
+            return nullptr;
+        std::vector<mesh_face> triangles(faces->items.size());
+        for (size_t i = 0; i < triangles.size(); i++) {
+            const json_value& item = faces->items[i];
+            bool valid = item.is_array() && item.items.size() == 3;
+            for (int c = 0; valid && c < 3; c++) {
+                const double index = item.items[c].number;
+                valid = item.items[c].is_number() && index >= 0 && index < double(points.size()) && index == std::floor(index);
+                triangles[i].v[c] = valid ? static_cast<uint32_t>(index) : 0;
+                triangles[i].n[c] = normals.empty() ? -1 : static_cast<int32_t>(triangles[i].v[c]);
+                triangles[i].t[c] = uvs.empty() ? -1 : static_cast<int32_t>(triangles[i].v[c]);
+            }
+            if (!valid) {
+                error(item, "a face must be 3 indices into \"positions\"");
+                return nullptr;
+            }
+        }
+        mesh = make_shared<triangle_mesh>(std::move(points), std::move(normals), std::move(uvs), std::move(triangles), m);
+    }
+    meshes.push_back(mesh);
+    return mesh;
+}
+
+/// <summary>
+/// 构建一个物体。所有物体都可以带flip（翻转法线朝向）和transform，先翻转再变换
+/// </summary>
+shared_ptr<hittable> scene_loader::make_object(const json_value& spec) {
+    const json_value* type = spec.find("type");
+    if (!spec.is_object() || !type || !type->is_string()) {
+        error(spec, "an object must be an object with a \"type\"");
+        return nullptr;
+    }
+    const std::string& kind = type->text;
+    auto material_member = [&]() -> shared_ptr<material> {
+        const json_value* member = spec.find("material");
+        if (!member) {
+            error(spec, kind + " needs a \"material\"");
+            return nullptr;
+        }
+        return make_material(*member);
+    };
+
+    shared_ptr<hittable> object;
+    shared_ptr<material> m;
+    if (kind == "sphere") {
+        check_members(spec, { "type", "flip", "transform", "center", "radius", "material" });
+        vec3 center;
+        double radius;
+        if (!point(spec, "center", center) || !number(spec, "radius", radius) || !(m = material_member()))
+            return nullptr;
+        object = make_shared<sphere>(center, radius, m);
+    }
+    else if (kind == "moving_sphere") {
+        check_members(spec, { "type", "flip", "transform", "center0", "center1", "time0", "time1", "radius", "material" });
+        vec3 center0, center1;
+        double time0 = 0, time1 = 1, radius;
+        if (!point(spec, "center0", center0) || !point(spec, "center1", center1) || !number(spec, "time0", time0, false)
+            || !number(spec, "time1", time1, false) || !number(spec, "radius", radius) || !(m = material_member()))
+            return nullptr;
+        object = make_shared<moving_sphere>(center0, center1, time0, time1, radius, m);
+    }
+    else if (kind == "xy_rect" || kind == "xz_rect" || kind == "yz_rect") {
+        //两个字母分别是矩形所在的两个轴，k是第三个轴上的坐标
+        const std::string a(1, kind[0]), b(1, kind[1]);
+        check_members(spec, { "type", "flip", "transform", a.c_str(), b.c_str(), "k", "material" });
+        double a0, a1, b0, b1, k;
+        if (!interval(spec, a.c_str(), a0, a1) || !interval(spec, b.c_str(), b0, b1) || !number(spec, "k", k)
+            || !(m = material_member()))
+            return nullptr;
+        if (kind == "xy_rect")
+            object = make_shared<xy_rect>(a0, a1, b0, b1, k, m);
+        else if (kind == "xz_rect")
+            object = make_shared<xz_rect>(a0, a1, b0, b1, k, m);
+        else
+            object = make_shared<yz_rect>(a0, a1, b0, b1, k, m);
+    }
+    else if (kind == "box") {
+        check_members(spec, { "type", "flip", "transform", "min", "max", "material" });
+        vec3 lo, hi;
+        if (!point(spec, "min", lo) || !point(spec, "max", hi) || !(m = material_member()))
+            return nullptr;
+        object = make_shared<box>(lo, hi, m);
+    }
+    else if (kind == "mesh") {
+        check_members(spec, { "type", "flip", "transform", "file", "positions", "normals", "uvs", "faces", "material" });
+        if (!(m = material_member()) || !(object = make_mesh(spec, m)))
+            return nullptr;
+    }
+    else if (kind == "group") {
+        //一组物体，默认在组内建一棵BVH
+        check_members(spec, { "type", "flip", "transform", "objects", "bvh" });
+        const json_value* children = spec.find("objects");
+        if (!children || !children->is_array() || children->items.empty()) {
+            error(spec, "group needs a non-empty \"objects\" array");
+            return nullptr;
+        }
+        hittableList list;
+        for (const auto& child : children->items) {
+            auto built = make_object(child);
+            if (!built)
+                return nullptr;
+            list.add(built);
+        }
+        const json_value* use_bvh = spec.find("bvh");
+        if (use_bvh && use_bvh->type != json_value::kind::boolean) {
+            error(*use_bvh, "\"bvh\" must be true or false");
+            return nullptr;
+        }
+        if (!use_bvh || use_bvh->boolean)
+            object = make_shared<bvh_node>(list, 0, 1);
+        else
+            object = make_shared<hittableList>(list);
+    }
+    else if (kind == "constant_medium") {
+        check_members(spec, { "type", "flip", "transform", "boundary", "density", "albedo" });
+        const json_value* boundary = spec.find("boundary");
+        const json_value* albedo = spec.find("albedo");
+        double density;
+        if (!boundary || !albedo) {
+            error(spec, "constant_medium needs \"boundary\" and \"albedo\"");
+            return nullptr;
+        }
+        if (!number(spec, "density", density))
+            return nullptr;
+        if (density <= 0) {
+            error(spec, "\"density\" must be positive");
+            return nullptr;
+        }
+        auto shape = make_object(*boundary);
+        auto color = shape ? make_texture(*albedo) : nullptr;
+        if (!color)
+            return nullptr;
+        object = make_shared<constant_medium>(shape, density, color);
+    }
+    else if (kind == "instance") {
+        //shapes中定义的几何体，多个实例共享同一份几何体和BVH
+        check_members(spec, { "type", "flip", "transform", "shape" });
+        const json_value* name = spec.find("shape");
+        if (!name || !name->is_string()) {
+            error(spec, "instance needs a \"shape\" name");
+            return nullptr;
+        }
+        auto found = shapes.find(name->text);
+        if (found == shapes.end()) {
+            error(*name, "unknown shape \"" + name->text + "\"");
+            return nullptr;
+        }
+        object = found->second;
+    }
+    else {
+        error(*type, "unknown object type \"" + kind + "\"");
+        return nullptr;
+    }
+
+    if (const json_value* flip = spec.find("flip")) {
+        if (flip->type != json_value::kind::boolean) {
+            error(*flip, "\"flip\" must be true or false");
+            return nullptr;
+        }
+        if (flip->boolean)
+            object = make_shared<flip_face>(object);
+    }
+    if (const json_value* steps = spec.find("transform")) {
+        affine3 matrix;
+        if (!make_transform(*steps, matrix))
+            return nullptr;
+        object = make_shared<transform>(object, matrix);
+    }
+    return object;
+}
+
+bool scene_loader::build(const json_value& document, scene_description& scene) {
+    if (!document.is_object())
+        return error(document, "a scene must be a JSON object");
+    check_members(document, { "camera", "background", "textures", "materials", "shapes", "objects" });
+    scene.name = file;
+    scene.summary = "scene file";
+
+    if (const json_value* camera = document.find("camera")) {
+        if (!camera->is_object())
+            return error(*camera, "\"camera\" must be an object");
+        check_members(*camera, { "lookfrom", "lookat", "vfov", "aperture", "focus_dist" });
+        if (!point(*camera, "lookfrom", scene.lookfrom) || !point(*camera, "lookat", scene.lookat)
+            || !number(*camera, "vfov", scene.vfov, false) || !number(*camera, "aperture", scene.aperture, false)
+            || !number(*camera, "focus_dist", scene.focus_dist, false))
+            return false;
+    }
+    if (!point(document, "background", scene.background, false))
+        return false;
+
+    //带名字的纹理、材质和几何体，按文件中的顺序构建，后面的可以引用前面的
+    auto named = [&](const char* key, auto make, auto& table) {
+        const json_value* section = document.find(key);
+        if (!section)
+            return true;
+        if (!section->is_object())
+            return error(*section, std::string("\"") + key + "\" must be an object of named entries");
+        for (size_t i = 0; i < section->keys.size(); i++) {
+            auto built = (this->*make)(section->items[i]);
+            if (!built)
+                return false;
+            table[section->keys[i]] = built;
+        }
+        return true;
+    };
+    if (!named("textures", &scene_loader::make_texture, textures) || !named("materials", &scene_loader::make_material, materials)
+        || !named("shapes", &scene_loader::make_object, shapes))
+        return false;
+
+    const json_value* objects = document.find("objects");
+    if (!objects || !objects->is_array() || objects->items.empty())
+        return error(objects ? *objects : document, "a scene needs a non-empty \"objects\" array");
+    hittableList world;
+    for (const auto& spec : objects->items) {
+        auto object = make_object(spec);
+        if (!object)
+            return false;
+        world.add(object);
+    }
+    scene.build = [world]() { return world; };
+    return true;
+}
+
+bool scene_loader::parse_and_build(const std::string& path, scene_description& scene) {
+    file = path;
+    const size_t slash = path.find_last_of("/\\");
+    directory = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+    //Windows上的编辑器常常在文件开头写BOM
+    if (source.compare(0, 3, "\xef\xbb\xbf") == 0)
+        source.erase(0, 3);
+    json_value document;
+    std::string message;
+    if (!parse_json(source, document, message)) {
+        std::cerr << file << ": " << message << "\n";
+        return false;
+    }
+    return build(document, scene);
+}
+
+bool scene_loader::load_json(const std::string& path, scene_description& scene) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cerr << "load_scene: cannot open " << path << "\n";
+        return false;
+    }
+    std::stringstream text;
+    text << in.rdbuf();
+    source = text.str();
+    return parse_and_build(path, scene);
+}
+
+/// <summary>
+/// 检查编译后的文件中一个网格的三角形和BVH节点引用的下标。数组直接在渲染时使用，
+/// 损坏的文件不能让求交越界读取。调用前数组本身已经确认在文件范围内
+/// </summary>
+inline bool valid_cached_mesh(const char* base, const scene_cache_mesh& mesh) {
+    const mesh_face* faces = reinterpret_cast<const mesh_face*>(base + mesh.faces.offset);
+    //-1表示没有对应的法线或纹理坐标
+    auto optional = [](int32_t index, uint64_t count) { return index == -1 || (index >= 0 && uint64_t(index) < count); };
+    for (uint64_t i = 0; i < mesh.faces.count; i++) {
+        for (int k = 0; k < 3; k++) {
+            if (faces[i].v[k] >= mesh.positions.count || !optional(faces[i].n[k], mesh.normals.count)
+                || !optional(faces[i].t[k], mesh.uvs.count))
+                return false;
+        }
+    }
+    //子节点总是排在父节点后面，这样也排除了环；叶子中的三角形必须在数组范围内。
+    //空的位置靠(+inf, -inf)的包围盒保证光线不会进入，包围盒必须原样保留。
+    //遍历栈的大小是固定的，按节点顺序往下传递层数，从根能走到的节点都不能深过bvh_max_depth
+    const float inf = std::numeric_limits<float>::infinity();
+    const wide_bvh_node<4>* nodes = reinterpret_cast<const wide_bvh_node<4>*>(base + mesh.nodes.offset);
+    std::vector<int> level(size_t(mesh.nodes.count), 0);
+    if (!level.empty())
+        level[0] = 1;
+    for (uint64_t i = 0; i < mesh.nodes.count; i++) {
+        for (int k = 0; k < 4; k++) {
+            const int32_t child = nodes[i].child[k];
+            const uint16_t count = nodes[i].count[k];
+            bool valid;
+            if (child == -1) {
+                valid = count == 0;
+                for (int a = 0; a < 3; a++)
+                    valid = valid && nodes[i].bounds[a][k] == inf && nodes[i].bounds[a + 3][k] == -inf;
+            }
+            else if (count > 0)
+                valid = child >= 0 && uint64_t(child) + (count & 0xff) <= mesh.faces.count;
+            else {
+                valid = child >= 0 && uint64_t(child) > i && uint64_t(child) < mesh.nodes.count;
+                if (valid && level[i] > 0) {
+                    level[child] = std::max(level[child], level[i] + 1);
+                    valid = level[child] <= bvh_max_depth;
+                }
+            }
+            if (!valid)
+                return false;
+        }
+    }
+    return true;
+}
+
+bool scene_loader::load_compiled(const std::string& path, scene_description& scene) {
+    auto mapping = make_shared<mapped_file>();
+    if (!mapping->open(path))
+        return false;
+    scene_cache_header header, expected;
+    if (mapping->size() < sizeof(header)) {
+        std::cerr << "load_scene: " << path << " is not a compiled scene\n";
+        return false;
+    }
+    memcpy(&header, mapping->data(), sizeof(header));
+    if (std::string(header.magic, 4) != std::string(expected.magic, 4) || header.version != expected.version) {
+        std::cerr << "load_scene: " << path << " is not a compiled scene\n";
+        return false;
+    }
+    if (header.vec3_size != expected.vec3_size || header.face_size != expected.face_size || header.node_size != expected.node_size) {
+        std::cerr << "load_scene: " << path << " was compiled with a different vec3 or BVH layout"
+            " (RT_SINGLE_PRECISION, RT_VEC3_SIMD), compile the scene again\n";
+        return false;
+    }
+
+    //映射的数组直接使用，先确认都在文件范围内并且对齐
+    const uint64_t size = mapping->size();
+    auto inside = [&](uint64_t offset, uint64_t count, uint64_t element) {
+        return offset % scene_cache_alignment == 0 && offset <= size && count <= (size - offset) / element;
+    };
+    bool valid = header.json_offset <= size && header.json_size <= size - header.json_offset
+        && inside(header.mesh_table_offset, header.mesh_count, sizeof(scene_cache_mesh));
+    const scene_cache_mesh* table = valid
+        ? reinterpret_cast<const scene_cache_mesh*>(mapping->data() + header.mesh_table_offset) : nullptr;
+    for (uint32_t i = 0; valid && i < header.mesh_count; i++) {
+        valid = inside(table[i].positions.offset, table[i].positions.count, sizeof(vec3))
+            && inside(table[i].normals.offset, table[i].normals.count, sizeof(vec3))
+            && inside(table[i].uvs.offset, table[i].uvs.count, sizeof(vec3))
+            && inside(table[i].faces.offset, table[i].faces.count, sizeof(mesh_face))
+            && inside(table[i].nodes.offset, table[i].nodes.count, sizeof(wide_bvh_node<4>))
+            && valid_cached_mesh(mapping->data(), table[i]);
+    }
+    if (!valid) {
+        std::cerr << "load_scene: " << path << " is truncated or corrupt\n";
+        return false;
+    }
+
+    cache = mapping;
+    cache_meshes = table;
+    cache_mesh_count = header.mesh_count;
+    source.assign(mapping->data() + header.json_offset, size_t(header.json_size));
+    if (!parse_and_build(path, scene))
+        return false;
+    if (meshes.size() != cache_mesh_count) {
+        std::cerr << "load_scene: " << path << " contains " << cache_mesh_count << " meshes but its scene uses "
+            << meshes.size() << "\n";
+        return false;
+    }
+    return true;
+}
+
+inline bool has_extension(const std::string& path, const char* extension) {
+    const size_t n = strlen(extension);
+    return path.size() >= n && path.compare(path.size() - n, n, extension) == 0;
+}
+
+/// <summary>
+/// --scene的参数是不是场景文件而不是注册的场景名
+/// </summary>
+inline bool is_scene_file(const std::string& path) {
+    return has_extension(path, ".json") || has_extension(path, ".rtscene");
+}
+
+/// <summary>
+/// 场景的指纹，用来确认检查点和分布式渲染的两端是同一个场景。注册的场景是场景名的散列；
+/// 场景文件是文件内容的散列，与路径无关，文件改过以后指纹就不同。JSON中按路径引用的网格和纹理不在内，
+/// 编译后的场景文件则包含了网格数据
+/// </summary>
+uint64_t scene_fingerprint(const std::string& scene) {
+    if (!is_scene_file(scene))
+        return fnv1a(scene.data(), scene.size());
+    mapped_file file;
+    if (!file.open(scene))
+        return 0;
+    return fnv1a(file.data(), file.size());
+}
+
+/// <summary>
+/// 按扩展名读取JSON场景文件或编译后的场景文件
+/// </summary>
+bool load_scene_file(const std::string& path, scene_description& scene) {
+    auto start = std::chrono::steady_clock::now();
+    scene_loader loader;
+    bool loaded = has_extension(path, ".rtscene") ? loader.load_compiled(path, scene) : loader.load_json(path, scene);
+    if (loaded) {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        size_t triangles = 0;
+        for (const auto& mesh : loader.meshes)
+            triangles += mesh->triangle_count();
+        std::cerr << "Loaded " << path << " in " << seconds << "s";
+        if (!loader.meshes.empty())
+            std::cerr << ", " << loader.meshes.size() << " meshes, " << triangles << " triangles";
+        std::cerr << "\n";
+    }
+    return loaded;
+}
+
+/// <summary>
+/// 把JSON场景编译成二进制文件：构建一遍场景，把JSON文本和每个网格的数组、BVH按映射时使用的布局写出。
+/// 与检查点一样先写临时文件再改名，正在映射旧文件的进程不受影响
+/// </summary>
+bool compile_scene_file(const std::string& json_path, const std::string& output) {
+    scene_loader loader;
+    scene_description scene;
+    if (!loader.load_json(json_path, scene))
+        return false;
+
+    auto align = [](uint64_t offset) {
+        return (offset + scene_cache_alignment - 1) / scene_cache_alignment * scene_cache_alignment;
+    };
+    scene_cache_header header;
+    header.mesh_count = static_cast<uint32_t>(loader.meshes.size());
+    header.json_offset = sizeof(header);
+    header.json_size = loader.source.size();
+    header.mesh_table_offset = align(header.json_offset + header.json_size);
+    uint64_t offset = align(header.mesh_table_offset + loader.meshes.size() * sizeof(scene_cache_mesh));
+
+    std::vector<scene_cache_mesh> table(loader.meshes.size());
+    auto place = [&](scene_cache_array& a, size_t count, size_t element) {
+        a.offset = offset;
+        a.count = count;
+        offset = align(offset + count * element);
+    };
+    for (size_t i = 0; i < table.size(); i++) {
+        const triangle_mesh& mesh = *loader.meshes[i];
+        place(table[i].positions, mesh.positions.size(), sizeof(vec3));
+        place(table[i].normals, mesh.normals.size(), sizeof(vec3));
+        place(table[i].uvs, mesh.uvs.size(), sizeof(vec3));
+        place(table[i].faces, mesh.faces.size(), sizeof(mesh_face));
+        place(table[i].nodes, mesh.bvh.nodes.size(), sizeof(wide_bvh_node<4>));
+        for (int a = 0; a < 3; a++) {
+            table[i].box_min[a] = mesh.bvh.box.min()[a];
+            table[i].box_max[a] = mesh.bvh.box.max()[a];
+        }
+        table[i].depth = mesh.bvh.depth;
+    }
+
+    const std::string temp = output + ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary);
+        if (!out) {
+            std::cerr << "compile_scene: cannot open " << temp << "\n";
+            return false;
+        }
+        uint64_t written = 0;
+        auto write_at = [&](uint64_t position, const void* data, size_t bytes) {
+            static const char zeros[scene_cache_alignment] = {};
+            while (written < position) {
+                size_t n = static_cast<size_t>(std::min<uint64_t>(sizeof(zeros), position - written));
+                out.write(zeros, n);
+                written += n;
+            }
+            out.write(static_cast<const char*>(data), bytes);
+            written += bytes;
+        };
+        write_at(0, &header, sizeof(header));
+        write_at(header.json_offset, loader.source.data(), loader.source.size());
+        write_at(header.mesh_table_offset, table.data(), table.size() * sizeof(scene_cache_mesh));
+        for (size_t i = 0; i < table.size(); i++) {
+            const triangle_mesh& mesh = *loader.meshes[i];
+            write_at(table[i].positions.offset, mesh.positions.data(), mesh.positions.size() * sizeof(vec3));
+            write_at(table[i].normals.offset, mesh.normals.data(), mesh.normals.size() * sizeof(vec3));
+            write_at(table[i].uvs.offset, mesh.uvs.data(), mesh.uvs.size() * sizeof(vec3));
+            write_at(table[i].faces.offset, mesh.faces.data(), mesh.faces.size() * sizeof(mesh_face));
+            write_at(table[i].nodes.offset, mesh.bvh.nodes.data(), mesh.bvh.nodes.size() * sizeof(wide_bvh_node<4>));
+        }
+        //最后一个数组后面补齐，空数组的偏移也不会超出文件
+        write_at(offset, nullptr, 0);
+        if (!out) {
+            std::cerr << "compile_scene: write failed " << temp << "\n";
+            return false;
+        }
+    }
+    //Windows上rename不能覆盖已有的文件
+    if (std::rename(temp.c_str(), output.c_str()) != 0) {
+        std::remove(output.c_str());
+        if (std::rename(temp.c_str(), output.c_str()) != 0) {
+            std::cerr << "compile_scene: cannot rename " << temp << " to " << output << "\n";
+            return false;
+        }
+    }
+    std::cerr << "Compiled " << json_path << " to " << output << ": " << table.size() << " meshes, "
+        << offset / (1 << 20) << "MB\n";
+    return true;
+}
@@ -8,20 +8,27 @@ public:
 	sphere() {};
 	sphere(vec3 cen, double r, shared_ptr<material> m) :center(cen), radius(r),mat_ptr(m) {};
 	virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const;
+    virtual bool intersect(const ray& r, double tmin, double tmax, hit_record& rec) const;
+    virtual void finalize(const ray& r, hit_record& rec) const;
     virtual bool bounding_box(double t0, double t1, aabb& output_box) const;
-	vec3 getCenter() {
+    virtual double pdf_value(const vec3& o, const vec3& v) const;
+    virtual vec3 random(const vec3& o) const;
+	vec3 getCenter() const {
 		return this->center;
 	}
-	double getRadius() {
+	double getRadius() const {
 		return this->radius;
 	}
+	shared_ptr<material> getMaterial() const {
+		return this->mat_ptr;
+	}
 private:
 	vec3 center;
 	double radius;
     shared_ptr<material> mat_ptr;
 };
 
-void get_sphere_uv(const vec3& p, double& u, double& v) {
+void get_sphere_uv(const vec3& p, real& u, real& v) {
     auto phi = atan2(p.z(), p.x());
     auto theta = asin(p.y());
     u = 1 - (phi + pi) / (2 * pi);
@@ -37,41 +44,52 @@ void get_sphere_uv(const vec3& p, double& u, double& v) {
 /// <param name="rec">记录相交信息</param>
 /// <returns>bool类型，是否相交</returns>
 bool sphere::hit(const ray& r, double tmin, double tmax, hit_record& rec)const{
-    //计算u，v坐标
-    get_sphere_uv((rec.p - center) / radius, rec.u, rec.v);
-    vec3 oc = r.origin() - center;
-    auto a = r.direction().length_squared();
-    auto half_b = dot(oc, r.direction());
+    if (!intersect(r, tmin, tmax, rec))
+        return false;
+    finalize(r, rec);
+    return true;
+}
+
+/// <summary>
+/// 只求交点的t，交点、法线和u，v坐标（atan2和asin）留到finalize中对最近的交点计算。
+/// 二次方程总是用double求解：大球（地面半径1000）的c = |oc|^2 - r^2相消严重，float会让交点偏离球面
+/// </summary>
+bool sphere::intersect(const ray& r, double tmin, double tmax, hit_record& rec) const {
+    dvec3 oc = dvec3(r.origin()) - dvec3(center);
+    auto a = dvec3(r.direction()).length_squared();
+    auto half_b = dot(oc, dvec3(r.direction()));
     auto c = oc.length_squared() - radius * radius;
     auto discriminant = half_b * half_b - a * c;
 
     if (discriminant > 0) {
         auto root = sqrt(discriminant);
         auto temp = (-half_b - root) / a;
-
- 
-
         if (temp < tmax && temp > tmin) {
             rec.t = temp;
-            rec.p = r.at(rec.t);
-            vec3 outward_normal = (rec.p - center) / radius;
-            rec.set_face_normal(r, outward_normal);
-            rec.mat_ptr = mat_ptr;
+            rec.prim = this;
             return true;
         }
         temp = (-half_b + root) / a;
         if (temp < tmax && temp > tmin) {
             rec.t = temp;
-            rec.p = r.at(rec.t);
-            vec3 outward_normal = (rec.p - center) / radius;
-            rec.set_face_normal(r, outward_normal);
-            rec.mat_ptr = mat_ptr;
+            rec.prim = this;
             return true;
         }
     }
     return false;
 }
 
+void sphere::finalize(const ray& r, hit_record& rec) const {
+    rec.p = r.at(rec.t);
+    vec3 outward_normal = (rec.p - center) / radius;
+    rec.set_face_normal(r, outward_normal);
+    get_sphere_uv(outward_normal, rec.u, rec.v);
+    rec.mat_ptr = mat_ptr.get();
+    //t的误差与球心和半径的大小成正比，交点离原点很近时远大于按交点坐标估计的误差
+    rec.p_error = static_cast<real>(ray_offset_scale_double * (max_abs(center) + radius));
+    rec.prim = nullptr;
+}
+
 
 
 bool sphere::bounding_box(double t0, double t1, aabb& output_box) const {
@@ -79,6 +97,50 @@ bool sphere::bounding_box(double t0, double t1, aabb& output_box) const {
     return true;
 }
 
+/// <summary>
+/// 在以w为轴、半顶角余弦为cos_theta_max的圆锥内均匀地生成一个单位方向
+/// </summary>
+vec3 random_in_cone(const vec3& w, double cos_theta_max) {
+    //以w为z轴建立正交基
+    vec3 a = fabs(w.x()) > 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0);
+    vec3 v = unit_vector(cross(w, a));
+    vec3 u = cross(w, v);
+
+    auto r1 = random_double();
+    auto r2 = random_double();
+    auto z = 1 + r2 * (cos_theta_max - 1);
+    auto phi = 2 * pi * r1;
+    auto sin_theta = sqrt(1 - z * z);
+    return cos(phi) * sin_theta * u + sin(phi) * sin_theta * v + z * w;
+}
+
+/// <summary>
+/// 球形光源的采样：在球对点o所张的圆锥内均匀采样，概率密度为圆锥立体角的倒数
+/// </summary>
+double sphere::pdf_value(const vec3& o, const vec3& v) const {
+    hit_record rec;
+    if (!this->intersect(ray(o, v), 0.001, infinity, rec))
+        return 0;
+
+    //点在球内时不能用圆锥采样
+    auto distance_squared = (center - o).length_squared();
+    if (distance_squared <= radius * radius)
+        return 0;
+
+    auto cos_theta_max = sqrt(1 - radius * radius / distance_squared);
+    auto solid_angle = 2 * pi * (1 - cos_theta_max);
+    return 1 / solid_angle;
+}
+
+vec3 sphere::random(const vec3& o) const {
+    vec3 direction = center - o;
+    auto distance_squared = direction.length_squared();
+    if (distance_squared <= radius * radius)
+        return random_unit_vector();
+    auto cos_theta_max = sqrt(1 - radius * radius / distance_squared);
+    return random_in_cone(unit_vector(direction), cos_theta_max);
+}
+
 
 
 class moving_sphere : public hittable {
@@ -90,6 +152,8 @@ public:
     {};
 
     virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const;
+    virtual bool intersect(const ray& r, double tmin, double tmax, hit_record& rec) const;
+    virtual void finalize(const ray& r, hit_record& rec) const;
     virtual bool bounding_box(double t0, double t1, aabb& output_box) const ;
     vec3 center(double time) const;
 
@@ -105,9 +169,18 @@ vec3 moving_sphere::center(double time) const {
 }
 bool moving_sphere::hit(
     const ray& r, double t_min, double t_max, hit_record& rec) const {
-    vec3 oc = r.origin() - center(r.time());
-    auto a = r.direction().length_squared();
-    auto half_b = dot(oc, r.direction());
+    if (!intersect(r, t_min, t_max, rec))
+        return false;
+    finalize(r, rec);
+    return true;
+}
+
+bool moving_sphere::intersect(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    //与sphere::intersect一样用double求解，球心也在double中计算
+    dvec3 moved = dvec3(center0) + ((r.time() - time0) / (time1 - time0)) * (dvec3(center1) - dvec3(center0));
+    dvec3 oc = dvec3(r.origin()) - moved;
+    auto a = dvec3(r.direction()).length_squared();
+    auto half_b = dot(oc, dvec3(r.direction()));
     auto c = oc.length_squared() - radius * radius;
 
     auto discriminant = half_b * half_b - a * c;
@@ -118,26 +191,30 @@ bool moving_sphere::hit(
         auto temp = (-half_b - root) / a;
         if (temp < t_max && temp > t_min) {
             rec.t = temp;
-            rec.p = r.at(rec.t);
-            vec3 outward_normal = (rec.p - center(r.time())) / radius;
-            rec.set_face_normal(r, outward_normal);
-            rec.mat_ptr = mat_ptr;
+            rec.prim = this;
             return true;
         }
 
         temp = (-half_b + root) / a;
         if (temp < t_max && temp > t_min) {
             rec.t = temp;
-            rec.p = r.at(rec.t);
-            vec3 outward_normal = (rec.p - center(r.time())) / radius;
-            rec.set_face_normal(r, outward_normal);
-            rec.mat_ptr = mat_ptr;
+            rec.prim = this;
             return true;
         }
     }
     return false;
 }
 
+void moving_sphere::finalize(const ray& r, hit_record& rec) const {
+    rec.p = r.at(rec.t);
+    vec3 moved = center(r.time());
+    vec3 outward_normal = (rec.p - moved) / radius;
+    rec.set_face_normal(r, outward_normal);
+    rec.mat_ptr = mat_ptr.get();
+    rec.p_error = static_cast<real>(ray_offset_scale_double * (max_abs(moved) + radius));
+    rec.prim = nullptr;
+}
+
 
 bool moving_sphere::bounding_box(double t0, double t1, aabb& output_box) const {
     aabb box0(
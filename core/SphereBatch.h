@@ -0,0 +1,224 @@
+﻿#pragma once
+//球的批量求交：若干个球的球心和半径按SoA连续存放，有AVX时一次测试4个球，
+//与sphere::intersect和moving_sphere::intersect逐个求交的结果完全相同（同样的运算顺序，距离相同时取前面的球）
+#include "Sphere.h"
+#include "HittableList.h"
+#include <vector>
+#if defined(__AVX__)
+#define RT_SPHERE_BATCH_AVX
+#include <immintrin.h>
+#endif
+
+struct sphere_soa {
+    std::vector<double> center_x, center_y, center_z, radius;
+    //运动的球：球心为center + (time - time0) / duration * motion，静止的球motion为0
+    std::vector<double> motion_x, motion_y, motion_z, time0, duration;
+    bool moving = false;
+
+    void push_back(const dvec3& center, double r) {
+        push_back(center, dvec3(0, 0, 0), 0, 1, r);
+    }
+    void push_back(const dvec3& center, const dvec3& motion, double t0, double t1, double r) {
+        center_x.push_back(center.x());
+        center_y.push_back(center.y());
+        center_z.push_back(center.z());
+        radius.push_back(r);
+        motion_x.push_back(motion.x());
+        motion_y.push_back(motion.y());
+        motion_z.push_back(motion.z());
+        time0.push_back(t0);
+        duration.push_back(t1 - t0);
+    }
+    void resize(size_t n) {
+        for (auto values : { &center_x, &center_y, &center_z, &radius, &motion_x, &motion_y, &motion_z, &time0 })
+            values->resize(n, 0.0);
+        duration.resize(n, 1.0);
+    }
+    size_t size() const { return radius.size(); }
+};
+
+/// <summary>
+/// 物体是sphere或moving_sphere时把它加入s，返回是否加入
+/// </summary>
+bool add_batch_sphere(sphere_soa& s, const hittable* object) {
+    if (auto ball = dynamic_cast<const sphere*>(object)) {
+        s.push_back(dvec3(ball->getCenter()), ball->getRadius());
+        return true;
+    }
+    if (auto ball = dynamic_cast<const moving_sphere*>(object)) {
+        s.push_back(dvec3(ball->center0), dvec3(ball->center1) - dvec3(ball->center0), ball->time0, ball->time1, ball->radius);
+        s.moving = true;
+        return true;
+    }
+    return false;
+}
+
+template <bool Moving>
+int intersect_sphere_batch(const sphere_soa& s, int start, int count, const ray& r, double t_min, double& closest) {
+    const double ox = r.origin().x(), oy = r.origin().y(), oz = r.origin().z();
+    const double dx = r.direction().x(), dy = r.direction().y(), dz = r.direction().z();
+    const double a = r.direction().length_squared();
+    const int end = start + count;
+    int index = -1;
+    int i = start;
+#ifdef RT_SPHERE_BATCH_AVX
+    const __m256d vox = _mm256_set1_pd(ox), voy = _mm256_set1_pd(oy), voz = _mm256_set1_pd(oz);
+    const __m256d vdx = _mm256_set1_pd(dx), vdy = _mm256_set1_pd(dy), vdz = _mm256_set1_pd(dz);
+    const __m256d va = _mm256_set1_pd(a);
+    const __m256d vt_min = _mm256_set1_pd(t_min);
+    const __m256d vtime = _mm256_set1_pd(r.time());
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    for (; i + 4 <= end; i += 4) {
+        __m256d cx = _mm256_loadu_pd(&s.center_x[i]);
+        __m256d cy = _mm256_loadu_pd(&s.center_y[i]);
+        __m256d cz = _mm256_loadu_pd(&s.center_z[i]);
+        if (Moving) {
+            const __m256d f = _mm256_div_pd(_mm256_sub_pd(vtime, _mm256_loadu_pd(&s.time0[i])), _mm256_loadu_pd(&s.duration[i]));
+            cx = _mm256_add_pd(cx, _mm256_mul_pd(f, _mm256_loadu_pd(&s.motion_x[i])));
+            cy = _mm256_add_pd(cy, _mm256_mul_pd(f, _mm256_loadu_pd(&s.motion_y[i])));
+            cz = _mm256_add_pd(cz, _mm256_mul_pd(f, _mm256_loadu_pd(&s.motion_z[i])));
+        }
+        const __m256d ocx = _mm256_sub_pd(vox, cx);
+        const __m256d ocy = _mm256_sub_pd(voy, cy);
+        const __m256d ocz = _mm256_sub_pd(voz, cz);
+        const __m256d radius = _mm256_loadu_pd(&s.radius[i]);
+        const __m256d half_b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, vdx), _mm256_mul_pd(ocy, vdy)), _mm256_mul_pd(ocz, vdz));
+        const __m256d oc2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)), _mm256_mul_pd(ocz, ocz));
+        const __m256d c = _mm256_sub_pd(oc2, _mm256_mul_pd(radius, radius));
+        const __m256d discriminant = _mm256_sub_pd(_mm256_mul_pd(half_b, half_b), _mm256_mul_pd(va, c));
+        const __m256d positive = _mm256_cmp_pd(discriminant, _mm256_setzero_pd(), _CMP_GT_OQ);
+        if (!_mm256_movemask_pd(positive))
+            continue;
+
+        //判别式不大于0的通道sqrt得到NaN，下面的比较对NaN都不成立
+        const __m256d root = _mm256_sqrt_pd(discriminant);
+        const __m256d neg_half_b = _mm256_xor_pd(half_b, sign);
+        const __m256d t_near = _mm256_div_pd(_mm256_sub_pd(neg_half_b, root), va);
+        const __m256d t_far = _mm256_div_pd(_mm256_add_pd(neg_half_b, root), va);
+        const __m256d vclosest = _mm256_set1_pd(closest);
+        const __m256d near_ok = _mm256_and_pd(_mm256_cmp_pd(t_near, vclosest, _CMP_LT_OQ), _mm256_cmp_pd(t_near, vt_min, _CMP_GT_OQ));
+        const __m256d far_ok = _mm256_and_pd(_mm256_cmp_pd(t_far, vclosest, _CMP_LT_OQ), _mm256_cmp_pd(t_far, vt_min, _CMP_GT_OQ));
+        int mask = _mm256_movemask_pd(_mm256_and_pd(positive, _mm256_or_pd(near_ok, far_ok)));
+        if (!mask)
+            continue;
+
+        //近交点有效时用近交点，否则用远交点；各通道按顺序比较，距离相同时保留前面的球
+        alignas(32) double t[4];
+        _mm256_store_pd(t, _mm256_blendv_pd(t_far, t_near, near_ok));
+        for (int k = 0; k < 4; k++) {
+            if ((mask & (1 << k)) && t[k] < closest) {
+                closest = t[k];
+                index = i + k;
+            }
+        }
+    }
+#endif
+    for (; i < end; i++) {
+        double cx = s.center_x[i], cy = s.center_y[i], cz = s.center_z[i];
+        if (Moving) {
+            const double f = (r.time() - s.time0[i]) / s.duration[i];
+            cx = cx + f * s.motion_x[i];
+            cy = cy + f * s.motion_y[i];
+            cz = cz + f * s.motion_z[i];
+        }
+        const double ocx = ox - cx;
+        const double ocy = oy - cy;
+        const double ocz = oz - cz;
+        const double half_b = ocx * dx + ocy * dy + ocz * dz;
+        const double c = ocx * ocx + ocy * ocy + ocz * ocz - s.radius[i] * s.radius[i];
+        const double discriminant = half_b * half_b - a * c;
+        if (discriminant <= 0)
+            continue;
+        const double root = sqrt(discriminant);
+        double t = (-half_b - root) / a;
+        if (!(t < closest && t > t_min))
+            t = (-half_b + root) / a;
+        if (t < closest && t > t_min) {
+            closest = t;
+            index = i;
+        }
+    }
+    return index;
+}
+
+/// <summary>
+/// 求光线与下标在[start, start + count)中的球的最近交点，返回该球的下标，没有交点返回-1
+/// </summary>
+/// <param name="closest">输入为t的上限，击中时写入最近交点的t</param>
+int intersect_sphere_batch(const sphere_soa& s, int start, int count, const ray& r, double t_min, double& closest) {
+    if (s.moving)
+        return intersect_sphere_batch<true>(s, start, count, r, t_min, closest);
+    return intersect_sphere_batch<false>(s, start, count, r, t_min, closest);
+}
+
+/// <summary>
+/// 一组球作为一个物体，用批量求交代替逐个调用intersect，交点信息仍由击中的球计算
+/// </summary>
+class sphere_batch : public hittable {
+public:
+    sphere_batch() {}
+
+    /// <summary>
+    /// 加入一个sphere或moving_sphere，其他物体返回false
+    /// </summary>
+    bool add(const shared_ptr<hittable>& ball) {
+        if (!add_batch_sphere(geometry, ball.get()))
+            return false;
+        spheres.push_back(ball);
+        return true;
+    }
+
+    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const;
+    virtual bool intersect(const ray& r, double t_min, double t_max, hit_record& rec) const;
+    virtual bool bounding_box(double t0, double t1, aabb& output_box) const;
+
+public:
+    sphere_soa geometry;
+    std::vector<shared_ptr<hittable>> spheres;
+};
+
+bool sphere_batch::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    if (!intersect(r, t_min, t_max, rec))
+        return false;
+    finalize_hit(r, rec);
+    return true;
+}
+
+bool sphere_batch::intersect(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    double closest = t_max;
+    int index = intersect_sphere_batch(geometry, 0, static_cast<int>(geometry.size()), r, t_min, closest);
+    if (index < 0)
+        return false;
+    rec.t = closest;
+    rec.prim = spheres[index].get();
+    return true;
+}
+
+bool sphere_batch::bounding_box(double t0, double t1, aabb& output_box) const {
+    if (spheres.empty()) return false;
+    spheres[0]->bounding_box(t0, t1, output_box);
+    for (size_t i = 1; i < spheres.size(); i++) {
+        aabb ball_box;
+        spheres[i]->bounding_box(t0, t1, ball_box);
+        output_box = surrounding_box(output_box, ball_box);
+    }
+    return true;
+}
+
+/// <summary>
+/// 把列表中所有的球换成一个sphere_batch，放在第一个球原来的位置，其余物体的顺序不变
+/// </summary>
+void batch_spheres(hittableList& list) {
+    auto batch = make_shared<sphere_batch>();
+    std::vector<shared_ptr<hittable>> objects;
+    for (const auto& object : list.objects) {
+        if (batch->add(object)) {
+            if (batch->spheres.size() == 1)
+                objects.push_back(batch);
+        }
+        else {
+            objects.push_back(object);
+        }
+    }
+    list.objects.swap(objects);
+}
@@ -0,0 +1,151 @@
+﻿#pragma once
+//工作窃取线程池：每个工作线程维护自己的任务队列，自己的队列空了就去别的线程队列的另一端偷任务
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class thread_pool {
+public:
+    //参数为任务的工作线程编号，便于任务使用线程私有的数据
+    using task = std::function<void(int)>;
+
+    /// <summary>
+    /// 创建线程池
+    /// </summary>
+    /// <param name="thread_count">线程数，小于等于0时使用机器的硬件线程数</param>
+    thread_pool(int thread_count = 0);
+    ~thread_pool();
+
+    int size() const { return static_cast<int>(queues.size()); }
+
+    /// <summary>
+    /// 执行一批任务并阻塞等待全部完成，任务按轮询方式预先分配到各个线程的队列
+    /// </summary>
+    void run(std::vector<task>& tasks);
+
+    //最近一次run中每个线程真正执行任务的时间（秒）以及整批任务的墙钟时间
+    std::vector<double> busy_seconds;
+    double wall_seconds = 0;
+
+private:
+    struct work_queue {
+        std::mutex lock;
+        std::deque<task*> tasks;
+    };
+
+    void worker_loop(int id);
+    bool pop_task(int id, task*& out);
+
+    std::vector<std::thread> workers;
+    std::vector<work_queue> queues;
+    std::mutex state_lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    size_t generation = 0;
+    std::atomic<size_t> remaining{ 0 };
+    bool stopping = false;
+};
+
+thread_pool::thread_pool(int thread_count) {
+    if (thread_count <= 0)
+        thread_count = static_cast<int>(std::thread::hardware_concurrency());
+    if (thread_count <= 0)
+        thread_count = 1;
+
+    queues = std::vector<work_queue>(thread_count);
+    busy_seconds.assign(thread_count, 0.0);
+    for (int i = 0; i < thread_count; i++)
+        workers.emplace_back(&thread_pool::worker_loop, this, i);
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+void thread_pool::run(std::vector<task>& tasks) {
+    auto start = std::chrono::steady_clock::now();
+    busy_seconds.assign(size(), 0.0);
+    if (tasks.empty()) {
+        wall_seconds = 0;
+        return;
+    }
+
+    //先设置计数再入队，防止上一批还没睡下的线程提前取到任务
+    remaining = tasks.size();
+    for (size_t i = 0; i < tasks.size(); i++) {
+        auto& q = queues[i % queues.size()];
+        std::lock_guard<std::mutex> guard(q.lock);
+        q.tasks.push_back(&tasks[i]);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        generation++;
+    }
+    wake.notify_all();
+
+    std::unique_lock<std::mutex> guard(state_lock);
+    done.wait(guard, [this] { return remaining == 0; });
+    wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// <summary>
+/// 先从自己队列的尾部取任务，取不到再从其他线程队列的头部偷
+/// </summary>
+bool thread_pool::pop_task(int id, task*& out) {
+    {
+        auto& own = queues[id];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            out = own.tasks.back();
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (int k = 1; k < size(); k++) {
+        auto& victim = queues[(id + k) % size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            out = victim.tasks.front();
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void thread_pool::worker_loop(int id) {
+    size_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(state_lock);
+            wake.wait(guard, [&] { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+        }
+
+        task* t;
+        while (pop_task(id, t)) {
+            auto begin = std::chrono::steady_clock::now();
+            (*t)(id);
+            //计时写在计数递减之前，run返回时所有线程的统计都已经写完
+            busy_seconds[id] += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            if (--remaining == 0) {
+                std::lock_guard<std::mutex> guard(state_lock);
+                done.notify_all();
+            }
+        }
+    }
+}
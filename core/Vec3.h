@@ -1,125 +1,133 @@
 #pragma once
+#include <cmath>
 #include <iostream>
+#include <utility>
 #include "utils.h"
-class vec3 {
+
+//ȾıȣĬdoubleRT_SINGLE_PRECISIONߡͳе궼float洢
+//ڴʹ룻Ķη̵ļȻdouble
+//RT_VEC3_SIMDvec3SSEʵֵvec3afloat洢ͬʱ򿪵
+#if defined(RT_VEC3_SIMD) && !defined(RT_SINGLE_PRECISION)
+#define RT_SINGLE_PRECISION
+#endif
+#ifdef RT_SINGLE_PRECISION
+typedef float real;
+#else
+typedef double real;
+#endif
+
+template <typename T>
+class vec3_t {
 public:
-    vec3() : e{ 0,0,0 } {}
-    vec3(double e0, double e1, double e2) : e{ e0, e1, e2 } {}
+    typedef T value_type;
+
+    vec3_t() : e{ 0,0,0 } {}
+    vec3_t(T e0, T e1, T e2) : e{ e0, e1, e2 } {}
+    //ͬȡͬʵ(vec3a)ֻ֮ʽת
+    template <typename V, typename = decltype(std::declval<const V&>().e[2])>
+    explicit vec3_t(const V& v) : e{ static_cast<T>(v.e[0]), static_cast<T>(v.e[1]), static_cast<T>(v.e[2]) } {}
 
-    double x() const { return e[0]; }
-    double y() const { return e[1]; }
-    double z() const { return e[2]; }
+    T x() const { return e[0]; }
+    T y() const { return e[1]; }
+    T z() const { return e[2]; }
 
-    vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-    double operator[](int i) const { return e[i]; }
-    double& operator[](int i) { return e[i]; }
+    vec3_t operator-() const { return vec3_t(-e[0], -e[1], -e[2]); }
+    T operator[](int i) const { return e[i]; }
+    T& operator[](int i) { return e[i]; }
 
-    vec3& operator+=(const vec3& v) {
+    vec3_t& operator+=(const vec3_t& v) {
         e[0] += v.e[0];
         e[1] += v.e[1];
         e[2] += v.e[2];
         return *this;
     }
 
-    vec3& operator*=(const double t) {
+    vec3_t& operator*=(const T t) {
         e[0] *= t;
         e[1] *= t;
         e[2] *= t;
         return *this;
     }
 
-    vec3& operator/=(const double t) {
+    vec3_t& operator/=(const T t) {
         return *this *= 1 / t;
     }
 
-    double length() const {
-        return sqrt(length_squared());
+    T length() const {
+        return std::sqrt(length_squared());
     }
 
-    double length_squared() const {
+    T length_squared() const {
         return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
     }
-    /// <summary>
-    /// һؿԷߣȻȡƽ
-    /// ۼɫԲ
-    /// </summary>
-    /// <param name="image"></param>
-    /// <param name="i">x</param>
-    /// <param name="j">y</param>
-    /// <param name="samples_per_pixel"></param>
-    void write_color(cv::Mat& image, int j, int i,int samples_per_pixel) const {
-        auto scale = 1.0 / samples_per_pixel;
-        //gamma=2٤עҪΪ1/2ݣ൱ڿ
-        auto r = sqrt(scale * e[0]);
-        auto g = sqrt(scale * e[1]);
-        auto b = sqrt(scale * e[2]);
-        r = static_cast<int>(256 * clamp(r, 0.0, 0.999));
-        g = static_cast<int>(256 * clamp(g, 0.0, 0.999));
-        b = static_cast<int>(256 * clamp(b, 0.0, 0.999));
-        image.at<cv::Vec3b>(j, i) = cv::Vec3b(b,g,r); // ֵע BGR ˳
-    }
-    inline static vec3 random() {
-        return vec3(random_double(), random_double(), random_double());
-    }
-
-    inline static vec3 random(double min, double max) {
-        return vec3(random_double(min, max), random_double(min, max), random_double(min, max));
+    inline static vec3_t random() {
+        return vec3_t(random_double(), random_double(), random_double());
     }
 
-public:
-    double e[3];
-};
-
+    inline static vec3_t random(double min, double max) {
+        return vec3_t(random_double(min, max), random_double(min, max), random_double(min, max));
+    }
 
+    //ԪģƵdoubleĳֱӳfloat
+    friend std::ostream& operator<<(std::ostream& out, const vec3_t& v) {
+        return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
+    }
 
+    friend vec3_t operator+(const vec3_t& u, const vec3_t& v) {
+        return vec3_t(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+    }
 
-inline std::ostream& operator<<(std::ostream& out, const vec3& v) {
-    return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
-}
+    friend vec3_t operator-(const vec3_t& u, const vec3_t& v) {
+        return vec3_t(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+    }
 
-inline vec3 operator+(const vec3& u, const vec3& v) {
-    return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
-}
+    friend vec3_t operator*(const vec3_t& u, const vec3_t& v) {
+        return vec3_t(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+    }
 
-inline vec3 operator-(const vec3& u, const vec3& v) {
-    return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
-}
+    friend vec3_t operator*(T t, const vec3_t& v) {
+        return vec3_t(t * v.e[0], t * v.e[1], t * v.e[2]);
+    }
 
-inline vec3 operator*(const vec3& u, const vec3& v) {
-    return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
-}
+    friend vec3_t operator*(const vec3_t& v, T t) {
+        return t * v;
+    }
 
-inline vec3 operator*(double t, const vec3& v) {
-    return vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
-}
+    friend vec3_t operator/(vec3_t v, T t) {
+        return (1 / t) * v;
+    }
 
-inline vec3 operator*(const vec3& v, double t) {
-    return t * v;
-}
+    friend T dot(const vec3_t& u, const vec3_t& v) {
+        return u.e[0] * v.e[0]
+            + u.e[1] * v.e[1]
+            + u.e[2] * v.e[2];
+    }
 
-inline vec3 operator/(vec3 v, double t) {
-    return (1 / t) * v;
-}
+    friend vec3_t cross(const vec3_t& u, const vec3_t& v) {
+        return vec3_t(u.e[1] * v.e[2] - u.e[2] * v.e[1],
+            u.e[2] * v.e[0] - u.e[0] * v.e[2],
+            u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+    }
 
-inline double dot(const vec3& u, const vec3& v) {
-    return u.e[0] * v.e[0]
-        + u.e[1] * v.e[1]
-        + u.e[2] * v.e[2];
-}
+    friend vec3_t unit_vector(vec3_t v) {
+        return v / v.length();
+    }
 
-inline vec3 cross(const vec3& u, const vec3& v) {
-    return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
-        u.e[2] * v.e[0] - u.e[0] * v.e[2],
-        u.e[0] * v.e[1] - u.e[1] * v.e[0]);
-}
+    friend vec3_t reflect(const vec3_t& v, const vec3_t& n) {
+        return v - 2 * dot(v, n) * n;
+    }
 
-inline vec3 unit_vector(vec3 v) {
-    return v / v.length();
-}
+public:
+    T e[3];
+};
 
-inline vec3 reflect(const vec3& v, const vec3& n) {
-    return v - 2 * dot(v, n) * n;
-}
+#ifdef RT_VEC3_SIMD
+#include "Vec3a.h"
+typedef vec3a vec3;
+#else
+typedef vec3_t<real> vec3;
+#endif
+typedef vec3_t<double> dvec3; //Ҫߵм
 
 /// <summary>
 /// ڵ㡣ǻ򵥵:񶨷(rejection method), һxyzȡֵΧΪ-1+1ĵλѡȡһ, ֱõ
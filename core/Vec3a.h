@@ -0,0 +1,209 @@
+﻿#pragma once
+//16字节对齐的SIMD向量：x,y,z放在一个__m128的前三个分量里，第四个分量不参与点积、长度等运算。
+//公开接口与vec3_t相同，定义RT_VEC3_SIMD后Vec3.h把vec3换成vec3a，材质、相机等代码不用改写就使用SSE运算。
+//没有SSE的平台上退回逐分量的标量实现，数据布局相同
+#include <cmath>
+#include <iostream>
+#include <type_traits>
+#include <utility>
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define RT_VEC3A_SSE
+#include <immintrin.h>
+#endif
+//GCC和Clang的-mavx2并不打开FMA，要看__FMA__；MSVC没有__FMA__，/arch:AVX2保证有FMA3
+#if defined(RT_VEC3A_SSE) && (defined(__FMA__) || (defined(_MSC_VER) && defined(__AVX2__)))
+#define RT_VEC3A_FMA
+#endif
+
+class alignas(16) vec3a {
+public:
+    typedef float value_type;
+
+    vec3a() : e{ 0, 0, 0, 0 } {}
+    vec3a(float e0, float e1, float e2) : e{ e0, e1, e2, 0 } {}
+    //从任何带e[3]分量的向量显式转换，例如精度更高的dvec3
+    template <typename V, typename = decltype(std::declval<const V&>().e[2])>
+    explicit vec3a(const V& v) : e{ static_cast<float>(v.e[0]), static_cast<float>(v.e[1]), static_cast<float>(v.e[2]), 0 } {}
+
+    float x() const { return e[0]; }
+    float y() const { return e[1]; }
+    float z() const { return e[2]; }
+
+    float operator[](int i) const { return e[i]; }
+    float& operator[](int i) { return e[i]; }
+
+#ifdef RT_VEC3A_SSE
+    explicit vec3a(__m128 v) : m(v) {}
+
+    vec3a operator-() const { return vec3a(_mm_xor_ps(m, _mm_set1_ps(-0.0f))); }
+
+    vec3a& operator+=(const vec3a& v) {
+        m = _mm_add_ps(m, v.m);
+        return *this;
+    }
+
+    vec3a& operator*=(const float t) {
+        m = _mm_mul_ps(m, _mm_set1_ps(t));
+        return *this;
+    }
+
+    float length_squared() const {
+        return dot(*this, *this);
+    }
+#else
+    vec3a operator-() const { return vec3a(-e[0], -e[1], -e[2]); }
+
+    vec3a& operator+=(const vec3a& v) {
+        e[0] += v.e[0];
+        e[1] += v.e[1];
+        e[2] += v.e[2];
+        return *this;
+    }
+
+    vec3a& operator*=(const float t) {
+        e[0] *= t;
+        e[1] *= t;
+        e[2] *= t;
+        return *this;
+    }
+
+    float length_squared() const {
+        return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
+    }
+#endif
+
+    vec3a& operator/=(const float t) {
+        return *this *= 1 / t;
+    }
+
+    float length() const {
+        return std::sqrt(length_squared());
+    }
+
+    inline static vec3a random() {
+        return vec3a(random_double(), random_double(), random_double());
+    }
+
+    inline static vec3a random(double min, double max) {
+        return vec3a(random_double(min, max), random_double(min, max), random_double(min, max));
+    }
+
+    friend std::ostream& operator<<(std::ostream& out, const vec3a& v) {
+        return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
+    }
+
+#ifdef RT_VEC3A_SSE
+    /// <summary>
+    /// c-a*b，有FMA指令时只舍入一次
+    /// </summary>
+    static __m128 neg_mul_add(__m128 a, __m128 b, __m128 c) {
+#ifdef RT_VEC3A_FMA
+        return _mm_fnmadd_ps(a, b, c);
+#else
+        return _mm_sub_ps(c, _mm_mul_ps(a, b));
+#endif
+    }
+
+    /// <summary>
+    /// 前三个分量的和广播到所有分量；第四个分量可能因为乘以无穷大变成NaN，所以不能参与求和
+    /// </summary>
+    static __m128 sum3(__m128 v) {
+        __m128 y = _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1));
+        __m128 z = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2));
+        return _mm_add_ps(_mm_add_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0)), y), z);
+    }
+
+    friend vec3a operator+(const vec3a& u, const vec3a& v) {
+        return vec3a(_mm_add_ps(u.m, v.m));
+    }
+
+    friend vec3a operator-(const vec3a& u, const vec3a& v) {
+        return vec3a(_mm_sub_ps(u.m, v.m));
+    }
+
+    friend vec3a operator*(const vec3a& u, const vec3a& v) {
+        return vec3a(_mm_mul_ps(u.m, v.m));
+    }
+
+    friend vec3a operator*(float t, const vec3a& v) {
+        return vec3a(_mm_mul_ps(_mm_set1_ps(t), v.m));
+    }
+
+    friend float dot(const vec3a& u, const vec3a& v) {
+        return _mm_cvtss_f32(sum3(_mm_mul_ps(u.m, v.m)));
+    }
+
+    //u.yzx*v.zxy - u.zxy*v.yzx，先算u*v.yzx - u.yzx*v，最后整体轮换一次
+    friend vec3a cross(const vec3a& u, const vec3a& v) {
+        __m128 u_yzx = _mm_shuffle_ps(u.m, u.m, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 v_yzx = _mm_shuffle_ps(v.m, v.m, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 c = neg_mul_add(u_yzx, v.m, _mm_mul_ps(u.m, v_yzx));
+        return vec3a(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+    }
+
+    //rsqrt只有12位精度，再做一次牛顿迭代 y' = y * (1.5 - 0.5 * x * y * y)，误差降到float的几个ulp
+    friend vec3a unit_vector(const vec3a& v) {
+        __m128 len2 = sum3(_mm_mul_ps(v.m, v.m));
+        __m128 y = _mm_rsqrt_ps(len2);
+        __m128 half_x = _mm_mul_ps(_mm_set1_ps(0.5f), len2);
+        y = _mm_mul_ps(y, neg_mul_add(_mm_mul_ps(half_x, y), y, _mm_set1_ps(1.5f)));
+        return vec3a(_mm_mul_ps(v.m, y));
+    }
+
+    friend vec3a reflect(const vec3a& v, const vec3a& n) {
+        return vec3a(neg_mul_add(_mm_set1_ps(2 * dot(v, n)), n.m, v.m));
+    }
+#else
+    friend vec3a operator+(const vec3a& u, const vec3a& v) {
+        return vec3a(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+    }
+
+    friend vec3a operator-(const vec3a& u, const vec3a& v) {
+        return vec3a(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+    }
+
+    friend vec3a operator*(const vec3a& u, const vec3a& v) {
+        return vec3a(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+    }
+
+    friend vec3a operator*(float t, const vec3a& v) {
+        return vec3a(t * v.e[0], t * v.e[1], t * v.e[2]);
+    }
+
+    friend float dot(const vec3a& u, const vec3a& v) {
+        return u.e[0] * v.e[0] + u.e[1] * v.e[1] + u.e[2] * v.e[2];
+    }
+
+    friend vec3a cross(const vec3a& u, const vec3a& v) {
+        return vec3a(u.e[1] * v.e[2] - u.e[2] * v.e[1],
+            u.e[2] * v.e[0] - u.e[0] * v.e[2],
+            u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+    }
+
+    friend vec3a unit_vector(const vec3a& v) {
+        return (1 / v.length()) * v;
+    }
+
+    friend vec3a reflect(const vec3a& v, const vec3a& n) {
+        return v - 2 * dot(v, n) * n;
+    }
+#endif
+
+    friend vec3a operator*(const vec3a& v, float t) {
+        return t * v;
+    }
+
+    friend vec3a operator/(const vec3a& v, float t) {
+        return (1 / t) * v;
+    }
+
+public:
+#ifdef RT_VEC3A_SSE
+    union {
+        __m128 m;
+        float e[4];
+    };
+#else
+    float e[4];
+#endif
+};
@@ -0,0 +1,387 @@
+﻿#pragma once
+//宽BVH(QBVH/OBVH)：每个节点按SoA方式保存4个或8个子节点的包围盒，用SSE/AVX一次测试全部子节点
+//光线方向的倒数和符号在每条光线开始遍历前只计算一次
+#include "BVH.h"
+#include "SphereBatch.h"
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define RT_WIDE_BVH_SSE
+#include <immintrin.h>
+#endif
+#if defined(RT_WIDE_BVH_SSE) && defined(__AVX__)
+#define RT_WIDE_BVH_AVX
+#endif
+
+template <int Width>
+struct alignas(32) wide_bvh_node {
+    //bounds[axis]为最小值，bounds[axis + 3]为最大值，空的子节点存一个反向的盒子，永远不会被击中
+    float bounds[6][Width];
+    int32_t child[Width]; //内部节点：子节点下标；叶子：第一个图元的下标；空：-1
+    uint16_t count[Width]; //叶子中的图元数量，0表示内部节点或空
+};
+
+//一条光线在遍历宽BVH时使用的预计算数据
+struct wide_ray {
+    float origin[3];
+    float inv_dir[3];
+    int near_index[3]; //每个轴上近平面在bounds中的行号
+    int far_index[3];
+
+    wide_ray(const ray& r) {
+        for (int a = 0; a < 3; a++) {
+            origin[a] = static_cast<float>(r.origin()[a]);
+            inv_dir[a] = static_cast<float>(1.0 / r.direction()[a]);
+            bool negative = inv_dir[a] < 0;
+            near_index[a] = negative ? a + 3 : a;
+            far_index[a] = negative ? a : a + 3;
+        }
+    }
+};
+
+//叶子中的图元全部是球时count的最高位置1，叶子用批量求交代替逐个调用虚函数
+const uint16_t wide_bvh_sphere_leaf = 0x8000;
+
+//float计算的远端距离放大这个比例，抵消舍入误差（PBRT中的 1 + 2*gamma(3)）
+const float wide_bvh_far_scale = 1.0f + 2.0f * (3.0f * std::numeric_limits<float>::epsilon() * 0.5f) / (1.0f - 3.0f * std::numeric_limits<float>::epsilon() * 0.5f);
+
+/// <summary>
+/// 用一条光线测试一个节点的全部子节点，返回被击中的子节点的位掩码，t_near中写入进入各子节点的距离
+/// </summary>
+template <int Width>
+inline int intersect_children(const wide_bvh_node<Width>& node, const wide_ray& wr, float t_min, float t_max, float* t_near) {
+    int mask = 0;
+    for (int i = 0; i < Width; i++) {
+        float t0 = t_min, t1 = t_max;
+        for (int a = 0; a < 3; a++) {
+            float tn = (node.bounds[wr.near_index[a]][i] - wr.origin[a]) * wr.inv_dir[a];
+            float tf = (node.bounds[wr.far_index[a]][i] - wr.origin[a]) * wr.inv_dir[a] * wide_bvh_far_scale;
+            t0 = tn > t0 ? tn : t0;
+            t1 = tf < t1 ? tf : t1;
+        }
+        t_near[i] = t0;
+        if (t0 <= t1)
+            mask |= 1 << i;
+    }
+    return mask;
+}
+
+#ifdef RT_WIDE_BVH_SSE
+template <>
+inline int intersect_children<4>(const wide_bvh_node<4>& node, const wide_ray& wr, float t_min, float t_max, float* t_near) {
+    __m128 t0 = _mm_set1_ps(t_min);
+    __m128 t1 = _mm_set1_ps(t_max);
+    const __m128 scale = _mm_set1_ps(wide_bvh_far_scale);
+    for (int a = 0; a < 3; a++) {
+        const __m128 o = _mm_set1_ps(wr.origin[a]);
+        const __m128 inv = _mm_set1_ps(wr.inv_dir[a]);
+        __m128 tn = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[wr.near_index[a]]), o), inv);
+        __m128 tf = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[wr.far_index[a]]), o), inv), scale);
+        //max/min在第一个参数为NaN时返回第二个参数，0*inf产生的NaN不会影响结果
+        t0 = _mm_max_ps(tn, t0);
+        t1 = _mm_min_ps(tf, t1);
+    }
+    _mm_storeu_ps(t_near, t0);
+    return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+}
+#endif
+
+#ifdef RT_WIDE_BVH_AVX
+template <>
+inline int intersect_children<8>(const wide_bvh_node<8>& node, const wide_ray& wr, float t_min, float t_max, float* t_near) {
+    __m256 t0 = _mm256_set1_ps(t_min);
+    __m256 t1 = _mm256_set1_ps(t_max);
+    const __m256 scale = _mm256_set1_ps(wide_bvh_far_scale);
+    for (int a = 0; a < 3; a++) {
+        const __m256 o = _mm256_set1_ps(wr.origin[a]);
+        const __m256 inv = _mm256_set1_ps(wr.inv_dir[a]);
+        __m256 tn = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[wr.near_index[a]]), o), inv);
+        __m256 tf = _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[wr.far_index[a]]), o), inv), scale);
+        t0 = _mm256_max_ps(tn, t0);
+        t1 = _mm256_min_ps(tf, t1);
+    }
+    _mm256_storeu_ps(t_near, t0);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+}
+#endif
+
+template <int Width>
+class wide_bvh : public hittable {
+public:
+    /// <param name="sphere_leaf_size">子树中只有不超过这么多个球时折叠成一个球叶子，0表示不使用球叶子</param>
+    wide_bvh(shared_ptr<bvh_node> root, double time0 = 0, double time1 = 1, int sphere_leaf_size = 4);
+
+    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const;
+    virtual bool intersect(const ray& r, double t_min, double t_max, hit_record& rec) const;
+    virtual bool bounding_box(double t0, double t1, aabb& output_box) const {
+        output_box = box;
+        return true;
+    }
+
+public:
+    std::vector<wide_bvh_node<Width>> nodes;
+    std::vector<const hittable*> primitives; //不持有所有权，图元的生命周期由root和subtrees保证
+    sphere_soa spheres; //与primitives的下标对应，只有球叶子中的位置有效
+    std::vector<shared_ptr<wide_bvh>> subtrees; //超过遍历栈深度的子树单独折叠，作为叶子中的图元
+    shared_ptr<bvh_node> root;
+    aabb box;
+
+    //每层出栈一个、最多压入Width个子节点，深度不超过bvh_max_depth时栈中最多有(Width-1)*bvh_max_depth+1项
+    static const int stack_size = 64 * Width;
+    static_assert((Width - 1) * bvh_max_depth + 1 <= stack_size, "wide_bvh traversal stack too small");
+
+private:
+    //折叠二叉树时的一个候选子节点
+    struct slot {
+        const hittable* object;
+        aabb box;
+        const bvh_node* node; //object为bvh_node时不为空
+        bool interior;        //bvh_node且至少有一个子节点也是bvh_node，可以继续展开
+        int sphere_count;     //子树中只有不超过sphere_leaf_size个球时为球的数量，否则为0
+    };
+
+    slot make_slot(const shared_ptr<hittable>& object) const;
+    int count_spheres(const hittable* object, int limit) const;
+    void add_spheres(const hittable* object);
+    int build(const bvh_node* node, int level);
+
+    double time0, time1;
+    int sphere_leaf_size; //默认4个，正好一次AVX批量求交
+};
+
+using qbvh = wide_bvh<4>;
+using obvh = wide_bvh<8>;
+
+template <int Width>
+wide_bvh<Width>::wide_bvh(shared_ptr<bvh_node> tree, double t0, double t1, int sphere_leaf)
+    : root(tree), box(tree->box), time0(t0), time1(t1), sphere_leaf_size(sphere_leaf) {
+    build(root.get(), 1);
+}
+
+template <int Width>
+typename wide_bvh<Width>::slot wide_bvh<Width>::make_slot(const shared_ptr<hittable>& object) const {
+    slot s;
+    s.object = object.get();
+    s.node = dynamic_cast<const bvh_node*>(object.get());
+    if (s.node) {
+        s.box = s.node->box;
+        s.interior = dynamic_cast<const bvh_node*>(s.node->left.get()) || dynamic_cast<const bvh_node*>(s.node->right.get());
+    }
+    else {
+        object->bounding_box(time0, time1, s.box);
+        s.interior = false;
+    }
+    s.sphere_count = std::max(count_spheres(s.object, sphere_leaf_size), 0);
+    if (s.sphere_count > 0)
+        s.interior = false;
+    return s;
+}
+
+/// <summary>
+/// 子树中全部是球且不超过limit个时返回球的数量，否则返回-1
+/// </summary>
+template <int Width>
+int wide_bvh<Width>::count_spheres(const hittable* object, int limit) const {
+    if (dynamic_cast<const sphere*>(object) || dynamic_cast<const moving_sphere*>(object))
+        return limit > 0 ? 1 : -1;
+    auto node = dynamic_cast<const bvh_node*>(object);
+    if (!node)
+        return -1;
+    int left = count_spheres(node->left.get(), limit);
+    if (left < 0 || left > limit)
+        return -1;
+    int right = node->right == node->left ? 0 : count_spheres(node->right.get(), limit - left);
+    if (right < 0 || left + right > limit)
+        return -1;
+    return left + right;
+}
+
+/// <summary>
+/// 按从左到右的顺序把子树中的球加入图元数组和球的SoA数组
+/// </summary>
+template <int Width>
+void wide_bvh<Width>::add_spheres(const hittable* object) {
+    auto node = dynamic_cast<const bvh_node*>(object);
+    if (!node) {
+        primitives.push_back(object);
+        add_batch_sphere(spheres, object);
+        return;
+    }
+    add_spheres(node->left.get());
+    if (node->right != node->left)
+        add_spheres(node->right.get());
+}
+
+/// <summary>
+/// 从二叉BVH折叠出一个宽节点：反复展开面积最大的内部子节点，直到凑满Width个子节点
+/// </summary>
+template <int Width>
+int wide_bvh<Width>::build(const bvh_node* node, int level) {
+    //只包含一个物体的节点，该物体本身又是一棵BVH时直接展开
+    while (node->left == node->right && dynamic_cast<const bvh_node*>(node->left.get()))
+        node = static_cast<const bvh_node*>(node->left.get());
+
+    std::vector<slot> slots;
+    bool binary_interior = dynamic_cast<const bvh_node*>(node->left.get()) || dynamic_cast<const bvh_node*>(node->right.get());
+    if (binary_interior) {
+        slots.push_back(make_slot(node->left));
+        slots.push_back(make_slot(node->right));
+    }
+    else {
+        //整棵树只有一个叶子
+        slot s = { node, node->box, node, false, 0 };
+        s.sphere_count = std::max(count_spheres(node, sphere_leaf_size), 0);
+        slots.push_back(s);
+    }
+
+    while (static_cast<int>(slots.size()) < Width) {
+        int widest = -1;
+        for (int i = 0; i < static_cast<int>(slots.size()); i++)
+            if (slots[i].interior && (widest < 0 || slots[i].box.area() > slots[widest].box.area()))
+                widest = i;
+        if (widest < 0)
+            break;
+        const bvh_node* expanded = slots[widest].node;
+        slots[widest] = make_slot(expanded->left);
+        if (expanded->right != expanded->left)
+            slots.push_back(make_slot(expanded->right));
+    }
+
+    int index = static_cast<int>(nodes.size());
+    nodes.push_back(wide_bvh_node<Width>());
+    int32_t child[Width];
+    uint16_t count[Width];
+    for (int i = 0; i < Width; i++) {
+        child[i] = -1;
+        count[i] = 0;
+        if (i >= static_cast<int>(slots.size()))
+            continue;
+        const slot& s = slots[i];
+        if (s.interior && level == bvh_max_depth) {
+            //每棵bvh_node的深度在构建时已经限制住了，叶子中嵌套的bvh_node展开后深度会叠加，
+            //到了栈的深度上限时剩下的子树单独折叠，和root共享所有权
+            subtrees.push_back(make_shared<wide_bvh>(shared_ptr<bvh_node>(root, const_cast<bvh_node*>(s.node)),
+                time0, time1, sphere_leaf_size));
+            child[i] = static_cast<int32_t>(primitives.size());
+            primitives.push_back(subtrees.back().get());
+            count[i] = 1;
+        }
+        else if (s.interior) {
+            child[i] = build(s.node, level + 1);
+        }
+        else if (s.sphere_count > 0) {
+            child[i] = static_cast<int32_t>(primitives.size());
+            spheres.resize(primitives.size());
+            add_spheres(s.object);
+            count[i] = static_cast<uint16_t>(s.sphere_count | wide_bvh_sphere_leaf);
+        }
+        else {
+            child[i] = static_cast<int32_t>(primitives.size());
+            if (s.node) {
+                primitives.push_back(s.node->left.get());
+                if (s.node->right != s.node->left)
+                    primitives.push_back(s.node->right.get());
+            }
+            else {
+                primitives.push_back(s.object);
+            }
+            count[i] = static_cast<uint16_t>(primitives.size() - child[i]);
+        }
+    }
+
+    //递归过程中数组可能扩容，最后再通过下标写入
+    auto& n = nodes[index];
+    for (int i = 0; i < Width; i++) {
+        n.child[i] = child[i];
+        n.count[i] = count[i];
+        for (int a = 0; a < 3; a++) {
+            if (i < static_cast<int>(slots.size())) {
+                float lo = static_cast<float>(slots[i].box.min()[a]);
+                float hi = static_cast<float>(slots[i].box.max()[a]);
+                if (lo > slots[i].box.min()[a]) lo = std::nextafter(lo, -std::numeric_limits<float>::infinity());
+                if (hi < slots[i].box.max()[a]) hi = std::nextafter(hi, std::numeric_limits<float>::infinity());
+                n.bounds[a][i] = lo;
+                n.bounds[a + 3][i] = hi;
+            }
+            else {
+                n.bounds[a][i] = std::numeric_limits<float>::infinity();
+                n.bounds[a + 3][i] = -std::numeric_limits<float>::infinity();
+            }
+        }
+    }
+    return index;
+}
+
+template <int Width>
+bool wide_bvh<Width>::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    if (!intersect(r, t_min, t_max, rec))
+        return false;
+    finalize_hit(r, rec);
+    return true;
+}
+
+template <int Width>
+bool wide_bvh<Width>::intersect(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    struct entry {
+        int32_t child;
+        uint16_t count;
+        float t_near;
+    };
+
+    const wide_ray wr(r);
+    bool hit_anything = false;
+    double closest_so_far = t_max;
+    entry stack[stack_size];
+    int top = 0;
+    stack[top++] = { 0, 0, static_cast<float>(t_min) };
+
+    while (top > 0) {
+        const entry e = stack[--top];
+        if (e.t_near > closest_so_far)
+            continue;
+
+        if (e.count & wide_bvh_sphere_leaf) {
+            double closest = closest_so_far;
+            int index = intersect_sphere_batch(spheres, e.child, e.count & ~wide_bvh_sphere_leaf, r, t_min, closest);
+            if (index >= 0) {
+                hit_anything = true;
+                closest_so_far = closest;
+                rec.t = closest;
+                rec.prim = primitives[index];
+            }
+            continue;
+        }
+        if (e.count > 0) {
+            for (int i = 0; i < e.count; i++) {
+                if (primitives[e.child + i]->intersect(r, t_min, closest_so_far, rec)) {
+                    hit_anything = true;
+                    closest_so_far = rec.t;
+                }
+            }
+            continue;
+        }
+
+        const auto& node = nodes[e.child];
+        alignas(32) float t_near[Width];
+        int mask = intersect_children<Width>(node, wr, static_cast<float>(t_min), static_cast<float>(closest_so_far), t_near);
+
+        //按进入距离从远到近压栈，近的子节点先出栈
+        int first = top;
+        while (mask) {
+            int i = 0;
+            while (!(mask & (1 << i))) i++;
+            mask &= mask - 1;
+            entry child = { node.child[i], node.count[i], t_near[i] };
+            int j = top++;
+            while (j > first && stack[j - 1].t_near < child.t_near) {
+                stack[j] = stack[j - 1];
+                j--;
+            }
+            stack[j] = child;
+        }
+    }
+
+    return hit_anything;
+}
@@ -1,12 +1,15 @@
 ﻿#pragma once
-#include "HittableList.h"
-#include "xyz_rect.h"
+#include "Hittable.h"
+//长方体：一个图元，用slab方法求交，不再拆成六个矩形
 class box : public hittable {
 public:
     box() {}
-    box(const vec3& p0, const vec3& p1, shared_ptr<material> ptr);
+    box(const vec3& p0, const vec3& p1, shared_ptr<material> ptr)
+        : box_min(p0), box_max(p1), mp(ptr) {}
 
     virtual bool hit(const ray& r, double t0, double t1, hit_record& rec) const;
+    virtual bool intersect(const ray& r, double t0, double t1, hit_record& rec) const;
+    virtual void finalize(const ray& r, hit_record& rec) const;
 
     virtual bool bounding_box(double t0, double t1, aabb& output_box) const {
         output_box = aabb(box_min, box_max);
@@ -16,26 +19,72 @@ public:
 public:
     vec3 box_min;
     vec3 box_max;
-    hittableList sides;
+    shared_ptr<material> mp;
 };
 
-box::box(const vec3& p0, const vec3& p1, shared_ptr<material> ptr) {
-    box_min = p0;
-    box_max = p1;
-
-    sides.add(make_shared<xy_rect>(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), ptr));
-    sides.add(make_shared<flip_face>(
-        make_shared<xy_rect>(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), ptr)));
+bool box::hit(const ray& r, double t0, double t1, hit_record& rec) const {
+    if (!intersect(r, t0, t1, rec))
+        return false;
+    finalize(r, rec);
+    return true;
+}
 
-    sides.add(make_shared<xz_rect>(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), ptr));
-    sides.add(make_shared<flip_face>(
-        make_shared<xz_rect>(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), ptr)));
+/// <summary>
+/// 三组平行平面的进入距离取最大、离开距离取最小。进入点在区间内时击中进入的面，
+/// 否则光线从盒子内部出发，击中离开的面。rec.prim_id记录击中的面：轴*2，最大值一侧的面再加1
+/// </summary>
+bool box::intersect(const ray& r, double t0, double t1, hit_record& rec) const {
+    double t_near = -infinity, t_far = infinity;
+    int near_face = 0, far_face = 0;
+    for (int a = 0; a < 3; a++) {
+        const double inv_d = 1.0 / r.direction()[a];
+        double ta = (box_min[a] - r.origin()[a]) * inv_d;
+        double tb = (box_max[a] - r.origin()[a]) * inv_d;
+        //沿负方向前进时先进入最大值一侧的面
+        const int side = inv_d < 0;
+        if (side)
+            std::swap(ta, tb);
+        //写成比较的形式，光线平行于某个面且起点恰好在面上时产生的NaN不会影响结果
+        if (ta > t_near) {
+            t_near = ta;
+            near_face = a * 2 + side;
+        }
+        if (tb < t_far) {
+            t_far = tb;
+            far_face = a * 2 + 1 - side;
+        }
+    }
+    if (t_near > t_far)
+        return false;
 
-    sides.add(make_shared<yz_rect>(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), ptr));
-    sides.add(make_shared<flip_face>(
-        make_shared<yz_rect>(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), ptr)));
+    if (t_near >= t0 && t_near <= t1) {
+        rec.t = t_near;
+        rec.prim_id = near_face;
+    }
+    else if (t_far >= t0 && t_far <= t1) {
+        rec.t = t_far;
+        rec.prim_id = far_face;
+    }
+    else {
+        return false;
+    }
+    rec.prim = this;
+    return true;
 }
 
-bool box::hit(const ray& r, double t0, double t1, hit_record& rec) const {
-    return sides.hit(r, t0, t1, rec);
-}
\ No newline at end of file
+/// <summary>
+/// 法线和uv与原来的六个矩形相同：垂直于z的面uv为(x,y)，垂直于y的面为(x,z)，垂直于x的面为(y,z)
+/// </summary>
+void box::finalize(const ray& r, hit_record& rec) const {
+    const int axis = rec.prim_id / 2;
+    const int u_axis = axis == 0 ? 1 : 0;
+    const int v_axis = axis == 2 ? 1 : 2;
+    rec.p = r.at(rec.t);
+    rec.u = (rec.p[u_axis] - box_min[u_axis]) / (box_max[u_axis] - box_min[u_axis]);
+    rec.v = (rec.p[v_axis] - box_min[v_axis]) / (box_max[v_axis] - box_min[v_axis]);
+    vec3 outward_normal(0, 0, 0);
+    outward_normal[axis] = rec.prim_id & 1 ? 1 : -1;
+    rec.set_face_normal(r, outward_normal);
+    rec.mat_ptr = mp.get();
+    rec.prim = nullptr;
+}
@@ -1,5 +1,6 @@
 ﻿#pragma once
 #include "Hittable.h"
+#include "Affine.h"
 class translate : public hittable {
 public:
     translate(shared_ptr<hittable> p, const vec3& displacement)
@@ -113,4 +114,88 @@ bool rotate_y::hit(const ray& r, double t_min, double t_max, hit_record& rec) co
     rec.set_face_normal(rotated_r, normal);
 
     return true;
-}
\ No newline at end of file
+}
+
+/// <summary>
+/// 一般的仿射变换节点：保存预先算好的变换矩阵和逆矩阵，可以表示任意的旋转、缩放、错切和平移。
+/// 每次求交只变换一次光线，交点信息推迟到finalize中在物体空间计算后再变换回世界空间。
+/// 场景构建完成后collapse_transforms会把translate/rotate_y/transform的嵌套链合并成一个transform
+/// </summary>
+class transform : public hittable {
+public:
+    /// <param name="to_world">从物体空间到世界空间的变换</param>
+    transform(shared_ptr<hittable> p, const affine3& to_world);
+
+    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const;
+    virtual bool intersect(const ray& r, double t_min, double t_max, hit_record& rec) const;
+    virtual void finalize(const ray& r, hit_record& rec) const;
+    virtual bool bounding_box(double t0, double t1, aabb& output_box) const {
+        output_box = bbox;
+        return hasbox;
+    }
+
+public:
+    shared_ptr<hittable> ptr;
+    affine3 to_world;
+    affine3 to_object;
+    bool hasbox;
+    aabb bbox;
+};
+
+transform::transform(shared_ptr<hittable> p, const affine3& matrix)
+    : ptr(p), to_world(matrix), to_object(matrix.inverse()) {
+    hasbox = ptr->bounding_box(0, 1, bbox);
+    if (hasbox)
+        bbox = to_world.apply(bbox);
+}
+
+bool transform::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    if (!intersect(r, t_min, t_max, rec))
+        return false;
+    finalize(r, rec);
+    return true;
+}
+
+/// <summary>
+/// 把光线变换到物体空间求交。方向不归一化，物体空间中的t与世界空间中的t相同
+/// </summary>
+bool transform::intersect(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    const ray local_r = to_object.apply(r);
+    //用自己作为标记：物体内部又有变换节点击中时local_prim会被改写
+    const hittable* previous = rec.local_prim;
+    rec.local_prim = this;
+    if (!ptr->intersect(local_r, t_min, t_max, rec)) {
+        rec.local_prim = previous;
+        return false;
+    }
+    if (rec.local_prim != this) {
+        //嵌套的变换：在本节点的物体空间中立即填好交点信息
+        finalize_hit(local_r, rec);
+        rec.local_prim = nullptr;
+    }
+    else {
+        rec.local_prim = rec.prim;
+    }
+    rec.prim = this;
+    return true;
+}
+
+void transform::finalize(const ray& r, hit_record& rec) const {
+    if (rec.local_prim) {
+        rec.local_prim->finalize(to_object.apply(r), rec);
+        //重复使用的hit_record不能把这次的图元带到下一条光线
+        rec.local_prim = nullptr;
+    }
+    //法线用逆矩阵的转置变换；仿射变换不改变光线方向与法线点积的符号，front_face保持不变
+    const vec3 local_p = rec.p;
+    rec.p = to_world.point(local_p);
+    rec.normal = unit_vector(to_object.transpose_vector(rec.normal));
+    //物体空间中的误差被矩阵放大，再加上变换本身的舍入误差
+    double scale = 0, translation = 0;
+    for (int i = 0; i < 3; i++) {
+        scale = std::max(scale, std::fabs(to_world.m[i][0]) + std::fabs(to_world.m[i][1]) + std::fabs(to_world.m[i][2]));
+        translation = std::max(translation, std::fabs(to_world.m[i][3]));
+    }
+    rec.p_error = static_cast<real>(scale * (rec.p_error + ray_offset_scale * max_abs(local_p)) + ray_offset_scale * translation);
+    rec.prim = nullptr;
+}
@@ -1,9 +1,12 @@
 ﻿#pragma once
 //工具文件 记录常用常量和函数
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 #include <limits>
 #include <memory>
+#include "Sampler.h"
 // Usings
 
 using std::shared_ptr;
@@ -24,7 +27,8 @@ inline double ffmin(double a, double b) { return a <= b ? a : b; }
 inline double ffmax(double a, double b) { return a >= b ? a : b; }
 inline double random_double() {
     // Returns a random real in [0,1).
-    return rand() / (RAND_MAX + 1.0);
+    //使用线程私有的采样器，渲染器按像素和采样序号重新定位随机序列
+    return thread_sampler().next_double();
 }
 
 inline double random_double(double min, double max) {
@@ -32,6 +36,18 @@ inline double random_double(double min, double max) {
     return min + (max - min) * random_double();
 }
 
+/// <summary>
+/// FNV-1a散列，h为前面数据的散列值，可以分几段接着算
+/// </summary>
+inline uint64_t fnv1a(const void* data, size_t size, uint64_t h = 0xcbf29ce484222325ULL) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        h ^= bytes[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
 inline int random_int(int min, int max) {
     return min + (max - min) * random_double();
 }
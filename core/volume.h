@@ -13,6 +13,10 @@ public:
         attenuation = albedo->value(rec.u, rec.v, rec.p);
         return true;
     }
+    //各向同性：所有方向的概率密度都是 1/(4pi)
+    virtual double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const {
+        return 1 / (4 * pi);
+    }
 
 public:
     shared_ptr<texture> albedo;
@@ -79,7 +83,7 @@ bool constant_medium::hit(const ray& r, double t_min, double t_max, hit_record&
 
     rec.normal = vec3(1, 0, 0);  // arbitrary
     rec.front_face = true;     // also arbitrary
-    rec.mat_ptr = phase_function;
+    rec.mat_ptr = phase_function.get();
 
     return true;
 }
\ No newline at end of file
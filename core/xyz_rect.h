@@ -8,17 +8,29 @@ public:
         : x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(mat) {};
 
     virtual bool hit(const ray& r, double t0, double t1, hit_record& rec) const;
+    virtual bool intersect(const ray& r, double t0, double t1, hit_record& rec) const;
+    virtual void finalize(const ray& r, hit_record& rec) const;
 
     virtual bool bounding_box(double t0, double t1, aabb& output_box) const {
         output_box = aabb(vec3(x0, y0, k - 0.0001), vec3(x1, y1, k + 0.0001));
         return true;
     }
 
+    virtual double pdf_value(const vec3& o, const vec3& v) const;
+    virtual vec3 random(const vec3& o) const;
+
 public:
     shared_ptr<material> mp;
     double x0, x1, y0, y1, k;
 };
 bool xy_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const {
+    if (!intersect(r, t0, t1, rec))
+        return false;
+    finalize(r, rec);
+    return true;
+}
+
+bool xy_rect::intersect(const ray& r, double t0, double t1, hit_record& rec) const {
     auto t = (k - r.origin().z()) / r.direction().z();
     if (t < t0 || t > t1)
         return false;
@@ -26,14 +38,19 @@ bool xy_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const {
     auto y = r.origin().y() + t * r.direction().y();
     if (x < x0 || x > x1 || y < y0 || y > y1)
         return false;
-    rec.u = (x - x0) / (x1 - x0);
-    rec.v = (y - y0) / (y1 - y0);
     rec.t = t;
+    rec.prim = this;
+    return true;
+}
+
+void xy_rect::finalize(const ray& r, hit_record& rec) const {
+    rec.p = r.at(rec.t);
+    rec.u = (rec.p.x() - x0) / (x1 - x0);
+    rec.v = (rec.p.y() - y0) / (y1 - y0);
     vec3 outward_normal = vec3(0, 0, 1);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
-    rec.p = r.at(t);
-    return true;
+    rec.mat_ptr = mp.get();
+    rec.prim = nullptr;
 }
 class xz_rect : public hittable {
 public:
@@ -43,12 +60,17 @@ public:
         : x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
 
     virtual bool hit(const ray& r, double t0, double t1, hit_record& rec) const;
+    virtual bool intersect(const ray& r, double t0, double t1, hit_record& rec) const;
+    virtual void finalize(const ray& r, hit_record& rec) const;
 
     virtual bool bounding_box(double t0, double t1, aabb& output_box) const {
         output_box = aabb(vec3(x0, k - 0.0001, z0), vec3(x1, k + 0.0001, z1));
         return true;
     }
 
+    virtual double pdf_value(const vec3& o, const vec3& v) const;
+    virtual vec3 random(const vec3& o) const;
+
 public:
     shared_ptr<material> mp;
     double x0, x1, z0, z1, k;
@@ -62,18 +84,30 @@ public:
         : y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
 
     virtual bool hit(const ray& r, double t0, double t1, hit_record& rec) const;
+    virtual bool intersect(const ray& r, double t0, double t1, hit_record& rec) const;
+    virtual void finalize(const ray& r, hit_record& rec) const;
 
     virtual bool bounding_box(double t0, double t1, aabb& output_box) const {
         output_box = aabb(vec3(k - 0.0001, y0, z0), vec3(k + 0.0001, y1, z1));
         return true;
     }
 
+    virtual double pdf_value(const vec3& o, const vec3& v) const;
+    virtual vec3 random(const vec3& o) const;
+
 public:
     shared_ptr<material> mp;
     double y0, y1, z0, z1, k;
 };
 
 bool xz_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const {
+    if (!intersect(r, t0, t1, rec))
+        return false;
+    finalize(r, rec);
+    return true;
+}
+
+bool xz_rect::intersect(const ray& r, double t0, double t1, hit_record& rec) const {
     auto t = (k - r.origin().y()) / r.direction().y();
     if (t < t0 || t > t1)
         return false;
@@ -81,17 +115,29 @@ bool xz_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const {
     auto z = r.origin().z() + t * r.direction().z();
     if (x < x0 || x > x1 || z < z0 || z > z1)
         return false;
-    rec.u = (x - x0) / (x1 - x0);
-    rec.v = (z - z0) / (z1 - z0);
     rec.t = t;
+    rec.prim = this;
+    return true;
+}
+
+void xz_rect::finalize(const ray& r, hit_record& rec) const {
+    rec.p = r.at(rec.t);
+    rec.u = (rec.p.x() - x0) / (x1 - x0);
+    rec.v = (rec.p.z() - z0) / (z1 - z0);
     vec3 outward_normal = vec3(0, 1, 0);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
-    rec.p = r.at(t);
-    return true;
+    rec.mat_ptr = mp.get();
+    rec.prim = nullptr;
 }
 
 bool yz_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const {
+    if (!intersect(r, t0, t1, rec))
+        return false;
+    finalize(r, rec);
+    return true;
+}
+
+bool yz_rect::intersect(const ray& r, double t0, double t1, hit_record& rec) const {
     auto t = (k - r.origin().x()) / r.direction().x();
     if (t < t0 || t > t1)
         return false;
@@ -99,12 +145,71 @@ bool yz_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const {
     auto z = r.origin().z() + t * r.direction().z();
     if (y < y0 || y > y1 || z < z0 || z > z1)
         return false;
-    rec.u = (y - y0) / (y1 - y0);
-    rec.v = (z - z0) / (z1 - z0);
     rec.t = t;
+    rec.prim = this;
+    return true;
+}
+
+void yz_rect::finalize(const ray& r, hit_record& rec) const {
+    rec.p = r.at(rec.t);
+    rec.u = (rec.p.y() - y0) / (y1 - y0);
+    rec.v = (rec.p.z() - z0) / (z1 - z0);
     vec3 outward_normal = vec3(1, 0, 0);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
-    rec.p = r.at(t);
-    return true;
-}
\ No newline at end of file
+    rec.mat_ptr = mp.get();
+    rec.prim = nullptr;
+}
+
+/// <summary>
+/// 矩形光源的采样：在矩形上均匀取点，面积上的概率密度 1/area 换算成立体角上的 距离^2/(cos*area)
+/// </summary>
+double xy_rect::pdf_value(const vec3& o, const vec3& v) const {
+    //只需要t，法线就是z轴
+    hit_record rec;
+    if (!this->intersect(ray(o, v), 0.001, infinity, rec))
+        return 0;
+
+    auto area = (x1 - x0) * (y1 - y0);
+    auto distance_squared = rec.t * rec.t * v.length_squared();
+    auto cosine = fabs(v.z() / v.length());
+    return distance_squared / (cosine * area);
+}
+
+vec3 xy_rect::random(const vec3& o) const {
+    auto random_point = vec3(random_double(x0, x1), random_double(y0, y1), k);
+    return random_point - o;
+}
+
+double xz_rect::pdf_value(const vec3& o, const vec3& v) const {
+    //只需要t，法线就是y轴
+    hit_record rec;
+    if (!this->intersect(ray(o, v), 0.001, infinity, rec))
+        return 0;
+
+    auto area = (x1 - x0) * (z1 - z0);
+    auto distance_squared = rec.t * rec.t * v.length_squared();
+    auto cosine = fabs(v.y() / v.length());
+    return distance_squared / (cosine * area);
+}
+
+vec3 xz_rect::random(const vec3& o) const {
+    auto random_point = vec3(random_double(x0, x1), k, random_double(z0, z1));
+    return random_point - o;
+}
+
+double yz_rect::pdf_value(const vec3& o, const vec3& v) const {
+    //只需要t，法线就是x轴
+    hit_record rec;
+    if (!this->intersect(ray(o, v), 0.001, infinity, rec))
+        return 0;
+
+    auto area = (y1 - y0) * (z1 - z0);
+    auto distance_squared = rec.t * rec.t * v.length_squared();
+    auto cosine = fabs(v.x() / v.length());
+    return distance_squared / (cosine * area);
+}
+
+vec3 yz_rect::random(const vec3& o) const {
+    auto random_point = vec3(k, random_double(y0, y1), random_double(z0, z1));
+    return random_point - o;
+}
@@ -16,6 +16,21 @@
 #include "core/box.h"
 #include "core/transform.h"
 #include "core/volume.h"
+#include "core/LinearBVH.h"
+#include "core/Renderer.h"
+#include "core/Packet.h"
+#include "core/Lights.h"
+#include "core/Progressive.h"
+#include "core/Mesh.h"
+#include "core/MeshLoader.h"
+#include "core/Instance.h"
+#include "core/Benchmark.h"
+#include "core/Film.h"
+#include "core/Checkpoint.h"
+#include "core/Distributed.h"
+#include "core/Scene.h"
+#include "core/Options.h"
+#include "core/SceneFile.h"
 static void glfw_error_callback(int error, const char* description)
 {
     fprintf(stderr, "GLFW Error %d: %s\n", error, description);
@@ -48,24 +63,65 @@ static void glfw_error_callback(int error, const char* description)
 //    return (1.0 - t) * vec3(1.0, 1.0, 1.0) + t * vec3(0.5, 0.7, 1.0);
 //}
 
-vec3 ray_color(const ray& r, const vec3& background, const hittableList& world, int depth) {
-    hit_record rec;
+/// <summary>
+/// 从一次求交结果开始迭代地追踪一条路径：累积路径上的衰减率，
+/// 反弹次数达到roulette_depth以后用俄罗斯轮盘赌随机终止路径，存活的路径除以存活概率，保证结果无偏。
+/// 每个非镜面交点额外朝光源采样一次，与材质采样击中光源的结果用MIS组合。
+/// 光线包模式下主光线的求交在包里完成，之后从这里继续
+/// </summary>
+/// <param name="lights">可以直接采样的光源，见collect_lights，为空时只靠材质采样</param>
+/// <param name="depth">最多求交的次数</param>
+/// <param name="roulette_depth">从第几次反弹开始使用轮盘赌，不小于depth时关闭</param>
+vec3 shade_hit(ray r, bool hit, hit_record rec, const vec3& background, const hittableList& world, const hittableList& lights,
+    int depth, int roulette_depth) {
+    vec3 radiance(0, 0, 0);
+    vec3 throughput(1, 1, 1);
+    double scattering_pdf = 0; //上一个交点的材质生成当前光线方向的概率密度
+    for (int bounce = 1; ; bounce++) {
+        // If the ray hits nothing, return the background color.
+        if (!hit) {
+            radiance += throughput * background;
+            break;
+        }
 
-    // If we've exceeded the ray bounce limit, no more light is gathered.
-    if (depth <= 0)
-        return vec3(0, 0, 0);
+        ray scattered;
+        vec3 attenuation;
+        vec3 emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+        //这个光源在上一个交点处也可能被光源采样选中，按MIS权重只计一部分
+        if (scattering_pdf > 0 && emitted.length_squared() > 0)
+            emitted *= emission_weight(lights, r, scattering_pdf);
+        radiance += throughput * emitted;
+        if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
+            break;
+
+        // If we've exceeded the ray bounce limit, no more light is gathered.
+        if (bounce >= depth)
+            break;
+        scattering_pdf = rec.mat_ptr->scattering_pdf(r, rec, scattered);
+        if (scattering_pdf > 0)
+            radiance += throughput * sample_lights(world, lights, r, rec, attenuation, ray_t_min);
+        throughput = throughput * attenuation;
+        if (bounce >= roulette_depth) {
+            double survival = roulette_survival(throughput);
+            if (random_double() >= survival)
+                break;
+            throughput /= survival;
+        }
 
-    // If the ray hits nothing, return the background color.
-    if (!world.hit(r, 0.001, infinity, rec))
-        return background;
+        r = spawn_ray(r, rec, scattered.direction());
+        hit = world.hit(r, ray_t_min, infinity, rec);
+    }
+    return radiance;
+}
 
-    ray scattered;
-    vec3 attenuation;
-    vec3 emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
-    if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-        return emitted;
+vec3 ray_color(const ray& r, const vec3& background, const hittableList& world, const hittableList& lights,
+    int depth, int roulette_depth) {
+    if (depth <= 0)
+        return vec3(0, 0, 0);
 
-    return emitted + attenuation * ray_color(scattered, background, world, depth - 1);
+    hit_record rec;
+    bool hit = world.hit(r, ray_t_min, infinity, rec);
+    return shade_hit(r, hit, rec, background, world, lights, depth, roulette_depth);
 }
 
 hittableList random_scene() {
@@ -126,8 +182,7 @@ hittableList two_perlin_spheres() {
 
 hittableList earth() {
     int nx, ny, nn;
-    std::string filename = "E:\\learn_for_job\\project\\myRayTracing\\diff.jpg";
-    unsigned char* texture_data = stbi_load(filename.c_str(), &nx, &ny, &nn, 0);
+    unsigned char* texture_data = stbi_load("earthmap.jpg", &nx, &ny, &nn, 0);
     auto earth_surface =make_shared<lambertian>(make_shared<image_texture>(texture_data, nx, ny));
     auto globe = make_shared<sphere>(vec3(0, 0, 0), 2, earth_surface);
 
@@ -207,6 +262,33 @@ hittableList cornell_smoke() {
 
     return objects;
 }
+/// <summary>
+/// 康奈尔盒子中放一个从OBJ/PLY文件读入的网格，网格的底部中心放在地板中央
+/// </summary>
+hittableList cornell_mesh(const std::string& filename) {
+    hittableList objects;
+
+    auto red = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.65, 0.05, 0.05)));
+    auto white = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.73, 0.73, 0.73)));
+    auto green = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.12, 0.45, 0.15)));
+    auto light = make_shared<diffuse_light>(make_shared<constant_texture>(vec3(15, 15, 15)));
+
+    objects.add(make_shared<flip_face>(make_shared<yz_rect>(0, 555, 0, 555, 555, green)));
+    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
+    objects.add(make_shared<xz_rect>(213, 343, 227, 332, 554, light));
+    objects.add(make_shared<flip_face>(make_shared<xz_rect>(0, 555, 0, 555, 555, white)));
+    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
+    objects.add(make_shared<flip_face>(make_shared<xy_rect>(0, 555, 0, 555, 555, white)));
+
+    auto mesh = load_mesh(filename, white);
+    if (mesh) {
+        aabb bounds;
+        mesh->bounding_box(0, 1, bounds);
+        vec3 offset = vec3(277.5, 0, 277.5) - vec3(bounds.centroid().x(), bounds.min().y(), bounds.centroid().z());
+        objects.add(make_shared<translate>(mesh, offset));
+    }
+    return objects;
+}
 hittableList final_scene() {
     hittableList boxes1;
     auto ground =
@@ -268,72 +350,198 @@ hittableList final_scene() {
         boxes2.add(make_shared<sphere>(vec3::random(0, 165), 10, white));
     }
 
-    objects.add(make_shared<translate>(
-        make_shared<rotate_y>(
-            make_shared<bvh_node>(boxes2, 0.0, 1.0), 15),
-        vec3(-100, 270, 395)
-        )
-    );
+    objects.add(make_shared<instance>(make_shared<bvh_node>(boxes2, 0.0, 1.0),
+        affine3::translation(vec3(-100, 270, 395)) * affine3::rotation_y(15)));
 
     return objects;
 }
+/// <summary>
+/// 注册表中的场景及其默认相机，--scene按名字选择
+/// </summary>
+std::vector<scene_description> scene_registry() {
+    const vec3 sky(0.70, 0.80, 1.00);
+    std::vector<scene_description> scenes;
+    scenes.push_back({ "random_scene", "random spheres on a checker ground, with motion blur", random_scene,
+        vec3(13, 2, 3), vec3(0, 0, 0), 20, 0.0, 10.0, sky });
+    scenes.push_back({ "two_perlin_spheres", "two spheres with Perlin noise marble", two_perlin_spheres,
+        vec3(13, 2, 3), vec3(0, 0, 0), 20, 0.0, 10.0, sky });
+    scenes.push_back({ "earth", "image-textured globe (needs earthmap.jpg)", earth,
+        vec3(13, 2, 3), vec3(0, 0, 0), 20, 0.0, 10.0, sky });
+    scenes.push_back({ "simple_light", "noise spheres lit by a rectangle and a sphere light", simple_light,
+        vec3(26, 3, 6), vec3(0, 2, 0), 20, 0.0, 10.0, vec3(0, 0, 0) });
+    scenes.push_back({ "cornell_box", "Cornell box with two rotated boxes", cornell_box,
+        vec3(278, 278, -800), vec3(278, 278, 0), 40, 0.0, 10.0, vec3(0, 0, 0) });
+    scenes.push_back({ "cornell_smoke", "Cornell box with smoke boxes", cornell_smoke,
+        vec3(278, 278, -800), vec3(278, 278, 0), 40, 0.0, 10.0, vec3(0, 0, 0) });
+    scenes.push_back({ "final_scene", "the final scene of The Next Week (needs earthmap.jpg)", final_scene,
+        vec3(478, 278, -600), vec3(278, 278, 0), 40, 0.0, 10.0, vec3(0, 0, 0) });
+    return scenes;
+}
+
+/// <summary>
+/// --bench：各个子系统的性能测试
+/// </summary>
+void run_benchmarks() {
+    bench_random();
+    bench_bvh();
+    bench_material_handles();
+    bench_deferred_hits();
+    bench_mesh();
+    bench_instancing();
+    bench_transforms();
+    bench_boxes();
+    bench_compiled_scene("random_scene", random_scene());
+    bench_compiled_scene("cornell_box", cornell_box());
+    bench_compiled_scene("final_scene ground", bench_box_ground());
+    bench_sphere_batch("sphere cluster (1000)", bench_sphere_cluster(1000));
+    bench_sphere_batch("random_scene", random_scene());
+    bench_sphere_batch_scene("final_scene", final_scene);
+    bench_packets("cornell_box", cornell_box(),
+        camera(vec3(278, 278, -800), vec3(278, 278, 0), vec3(0, 1, 0), 40, 1.0, 0.0, 10.0, 0.0, 1.0));
+    bench_packets("random_scene", random_scene(),
+        camera(vec3(13, 2, 3), vec3(0, 0, 0), vec3(0, 1, 0), 20, 1.0, 0.0, 10.0, 0.0, 1.0));
+    auto smoke = cornell_smoke();
+    auto smoke_lights = collect_lights(smoke);
+    smoke = hittableList(flatten_bvh(make_shared<bvh_node>(smoke, 0, 1)));
+    const camera cornell_camera(vec3(278, 278, -800), vec3(278, 278, 0), vec3(0, 1, 0), 40, 1.0, 0.0, 10.0, 0.0, 1.0);
+    bench_roulette("cornell_smoke", cornell_camera,
+        [&](const ray& r, int roulette_depth) { return ray_color(r, vec3(0, 0, 0), smoke, smoke_lights, 50, roulette_depth); });
+    auto cornell = cornell_box();
+    auto cornell_lights = collect_lights(cornell);
+    cornell = hittableList(flatten_bvh(make_shared<bvh_node>(cornell, 0, 1)));
+    const hittableList no_lights;
+    bench_light_sampling("cornell_box", cornell_camera, [&](const ray& r, bool sample_lights) {
+        return ray_color(r, vec3(0, 0, 0), cornell, sample_lights ? cornell_lights : no_lights, 50, 5);
+    });
+    bench_adaptive("cornell_box", cornell_camera,
+        [&](const ray& r) { return ray_color(r, vec3(0, 0, 0), cornell, cornell_lights, 50, 5); });
+    bench_precision("cornell_box", cornell_camera,
+        [&](const ray& r) { return ray_color(r, vec3(0, 0, 0), cornell, cornell_lights, 50, 5); });
+    bench_vec3();
+}
+
 // Main code
-int main(int, char**)
+int main(int argc, char** argv)
 {
-    const int image_width =200;
-    const int image_height =100;
-    const int samples_per_pixel = 5000;
-    const int max_depth = 50;
-    const vec3 background(0, 0, 0);
-    const auto aspect_ratio = double(image_width) / image_height;
-    // 创建一个空白的图像
-    cv::Mat image(image_height, image_width, CV_8UC3, cv::Scalar(0, 0, 0));
-
-    //物体 如果将球的半径设为负值, 形状看上去并没什么变化, 但是法相全都翻转到内部去了。所以就可以用这个特性来做出一个通透的玻璃球:【把一个小球套在大球里, 光线发生两次折射, 于是负负得正, 上下不会颠倒】
-    //hittableList sceneObjects;
-    //sceneObjects.add(make_shared<sphere>(vec3(0, 0, -1), 0.5, make_shared<lambertian>(vec3(0.1, 0.2, 0.5))));
-    //sceneObjects.add(make_shared<sphere>(
-    //    vec3(0, -100.5, -1), 100, make_shared<lambertian>(vec3(0.8, 0.8, 0.0))));
-    //sceneObjects.add(make_shared<sphere>(vec3(1, 0, -1), 0.5, make_shared<metal>(vec3(0.8, 0.6, 0.2), 0.3)));
-    //sceneObjects.add(make_shared<sphere>(vec3(-1, 0, -1), 0.5, make_shared<dielectric>(1.5)));
-    //sceneObjects.add(make_shared<sphere>(vec3(-1, 0, -1), -0.45, make_shared<dielectric>(1.5)));
-    //相机
-    //vec3 lookfrom(13, 2, 3);
-    //vec3 lookat(0, 0, 0);
-    //vec3 vup(0, 1, 0);
-    //auto dist_to_focus = 10.0;
-    //auto aperture = 0.0;
-    vec3 lookfrom(278, 278, -300);
-    vec3 lookat(278, 278, 0);
-    vec3 vup(0, 1, 0);
-    auto dist_to_focus = 10.0;
-    auto aperture = 0.0;
-    auto vfov = 40.0;
-    camera camera(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus, 0.0, 1.0);
-    // 生成图像像素值
-    //auto world = random_scene();
-    //auto world = two_perlin_spheres();
-    //auto world = earth();
-    //auto world = cornell_smoke();
-    auto world =final_scene();
-    for (int j = image_height - 1; j >= 0; --j) {
-        std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-        for (int i = 0; i < image_width; ++i) {
-            vec3 color(0, 0, 0);
-            for (int s = 0; s < samples_per_pixel; ++s) {
-                auto u = double(i + random_double()) / image_width;
-                auto v = double(j + random_double()) / image_height;
-                ray r = camera.get_ray(u, v);
-                color += ray_color(r,background, world,max_depth);
-            }
-            color.write_color(image,j,i,samples_per_pixel); // 将像素值写入到图像中
+    auto scenes = scene_registry();
+    std::vector<std::string> scene_names;
+    for (const auto& scene : scenes)
+        scene_names.push_back(scene.name);
+    render_options options;
+    if (!parse_options(argc, argv, options)) {
+        std::cerr << "run " << argv[0] << " --help for the list of options\n";
+        return 2;
+    }
+    if (options.help) {
+        print_usage(argv[0], scene_names);
+        return 0;
+    }
+    if (options.list_scenes) {
+        for (const auto& scene : scenes)
+            std::cout << scene.name << "\t" << scene.summary << "\n";
+        return 0;
+    }
+    if (options.bench) {
+        run_benchmarks();
+        return bench_failures ? 1 : 0;
+    }
+    if (!options.compile_output.empty()) {
+        if (!has_extension(options.scene, ".json")) {
+            std::cerr << "--compile-scene needs a .json scene file given with --scene\n";
+            return 2;
         }
+        return compile_scene_file(options.scene, options.compile_output) ? 0 : 1;
+    }
+    //注册的场景名优先，其次是场景文件
+    scene_description file_scene;
+    const scene_description* scene = find_scene(scenes, options.scene);
+    if (!scene && is_scene_file(options.scene)) {
+        if (!load_scene_file(options.scene, file_scene))
+            return 1;
+        scene = &file_scene;
+    }
+    if (!scene) {
+        std::cerr << "unknown scene " << options.scene << ", run " << argv[0] << " --list-scenes to see the scenes\n";
+        return 2;
     }
-    // 显示图像
-    cv::flip(image, image, 0);
-    cv::imshow("Image", image);
-    cv::imwrite("image.jpg", image);
-    cv::waitKey(0); // 等待按键事件
 
-    return 0;
+    const render_settings& settings = options.settings;
+    const int image_width = settings.image_width;
+    const int image_height = settings.image_height;
+    const int max_depth = settings.max_depth;
+    const vec3 background = scene->background;
+    camera camera = scene->make_camera(double(image_width) / image_height);
+    //检查点和分布式渲染的两端用指纹确认是同一个场景、同一个相机
+    const uint64_t scene_id = scene_fingerprint(options.scene);
+    options.distributed.scene = scene_id;
+    options.distributed.camera = camera.fingerprint();
+    auto world = scene->build();
+    //压平BVH之前先找出场景中可以直接采样的光源
+    auto lights = collect_lights(world);
+    //平移旋转的嵌套链合并成一个变换节点
+    collapse_transforms(world);
+    //光线包模式要求最外层是二叉的线性BVH：在整个场景上再建一层BVH，然后把场景中所有的BVH压平成连续的节点数组。
+    //其余模式把场景编译成按图元类型分组的结构数组，编译不了的物体里面的BVH同样压平
+    size_t unflattened = 0;
+    if (settings.mode == render_mode::packet) {
+        world = hittableList(flatten_bvh(make_shared<bvh_node>(world, 0, 1), bvh_layout::binary));
+        unflattened = count_bvh_nodes(world);
+    }
+    else {
+        auto compiled = make_shared<compiled_scene>(world);
+        for (const auto& other : compiled->others)
+            unflattened += count_bvh_nodes(*other);
+        world = hittableList(compiled);
+    }
+    //漏掉的bvh_node仍然能正确求交，只是慢很多，不容易察觉，所以在这里直接报错
+    if (unflattened) {
+        std::cerr << "internal error: " << unflattened << " bvh_node left in the scene after flatten_bvh\n";
+        return 1;
+    }
+    //多线程分块渲染，结果只取决于种子，与线程数无关
+    //采样累加在胶片上，最后再输出HDR和8位图像
+    film image_film(image_width, image_height);
+    image_film.set_sample_count(settings.samples_per_pixel);
+    const linear_bvh* packet_bvh = find_packet_bvh(world);
+    if (options.coordinator) {
+        if (!run_coordinator(settings, options.distributed, image_film))
+            return 1;
+    }
+    else if (!options.coordinator_host.empty()) {
+        //工作进程只渲染任务，不输出图像
+        return run_worker(settings, options.distributed, camera, [&](const ray& r) {
+            return ray_color(r, background, world, lights, max_depth, settings.roulette_depth);
+        }, options.coordinator_host) ? 0 : 1;
+    }
+    else if (settings.mode == render_mode::packet && packet_bvh) {
+        render_packets(settings, camera, *packet_bvh, ray_t_min, [&](const ray& r, bool hit, const hit_record& rec) {
+            return shade_hit(r, hit, rec, background, world, lights, max_depth, settings.roulette_depth);
+        }, image_film.accum);
+    }
+    else {
+        //保存检查点时，被抢占(SIGTERM)或者Ctrl+C后在当前这一遍结束时保存检查点再退出
+        if (!options.checkpoint_path.empty())
+            install_render_stop_handler();
+        bool rendered = render_checkpointed(settings, camera, [&](const ray& r) {
+            return ray_color(r, background, world, lights, max_depth, settings.roulette_depth);
+        }, image_film, options.checkpoint_path, options.resume, scene_id);
+        if (!rendered || render_stop_requested)
+            return 1;
+    }
+    // 线性HDR结果可以与其他渲染合并，8位图像用于查看
+    if (options.outputs.empty())
+        options.outputs = { "image.exr", "image.jpg" };
+    bool written = true;
+    for (const auto& output : options.outputs) {
+        if (!image_film.write(output)) {
+            std::cerr << "cannot write " << output << "\n";
+            written = false;
+        }
+    }
+    // 批处理时不打开窗口，只有--show才显示图像
+    if (options.show) {
+        cv::imshow("Image", image_film.tonemap());
+        cv::waitKey(0); // 等待按键事件
+    }
+    return written ? 0 : 1;
 }